@@ -29,6 +29,7 @@ __END__
         <li><a href="/">Home</a></li>
         <li><a href="/configuration.html">Configuration</a></li>
         <li><a href="/commands.html">Commands</a></li>
+        <li><a href="/protocol.html">Protocol</a></li>
         <li><a href="https://github.com/nullreff/redpile">Code</a></li>
       </ul>
       <div class="content">
@@ -0,0 +1,99 @@
+require 'spec_helper'
+include Helpers
+
+describe 'FORK' do
+  it 'lists the main world by default' do
+    run('FORK').should == '* main'
+  end
+
+  it 'lists created forks' do
+    run(
+      'FORK test',
+      'FORK'
+    ).should == "* main\n  test"
+  end
+
+  it 'marks the fork in use' do
+    run(
+      'FORK test',
+      'SWITCH test',
+      'FORK'
+    ).should == "* test\n  main"
+  end
+
+  it 'does not create the same fork twice' do
+    run(
+      'FORK test',
+      'FORK test'
+    ).should == "The fork 'test' already exists"
+  end
+
+  it 'copies the nodes of the world' do
+    run(
+      'NODE 0,0,0 WIRE power:5',
+      'FORK test',
+      'SWITCH test',
+      'NODE 0,0,0'
+    ).should == '0,0,0 WIRE power:5'
+  end
+
+  it 'isolates changes made to a fork' do
+    run(
+      'NODE 0,0,0..1 WIRE power:5',
+      'FORK test',
+      'SWITCH test',
+      'FIELD 0,0,0 power:7',
+      'DELETE 0,0,1',
+      'SWITCH main',
+      'NODE 0,0,0..1'
+    ).should == "0,0,0 WIRE power:5\n0,0,1 WIRE power:5"
+  end
+
+  it 'isolates changes made to the original world' do
+    run(
+      'NODE 0,0,0 WIRE power:5',
+      'FORK test',
+      'FIELD 0,0,0 power:7',
+      'NODE 100,0,0 WIRE',
+      'SWITCH test',
+      'NODE 0,0,0',
+      'NODE 100,0,0'
+    ).should == "0,0,0 WIRE power:5\n100,0,0 AIR"
+  end
+
+  it 'runs ticks independently' do
+    result = run(
+      'NODE 0,0,0 TORCH direction:UP',
+      'FORK test',
+      'TICKQ',
+      'SWITCH test',
+      'NODE 0,0,0'
+    )
+    result.should =~ /^0,0,0 TORCH/
+    result.should_not =~ /power:15/
+  end
+end
+
+describe 'SWITCH' do
+  it 'does not switch to an unknown fork' do
+    run('SWITCH test').should == "Unknown fork 'test'"
+  end
+end
+
+describe 'DROP' do
+  it 'removes a fork' do
+    run(
+      'FORK test',
+      'DROP test',
+      'FORK'
+    ).should == '* main'
+  end
+
+  it 'does not remove the fork in use' do
+    run('DROP main').should == 'Cannot drop the fork currently in use'
+  end
+
+  it 'does not remove an unknown fork' do
+    run('DROP test').should == "Unknown fork 'test'"
+  end
+end
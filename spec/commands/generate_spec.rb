@@ -0,0 +1,65 @@
+require 'spec_helper'
+include Helpers
+
+describe 'GENERATE' do
+  it 'builds a mesh of wires with torches' do
+    result = run('GENERATE 0..20,0,0..20 MESH', 'STATUS', 'NODE 1,0,0', 'FIELD 0,0,0..10%10 direction')
+    result.should =~ /^nodes: 441$/
+    result.split("\n").last(3).should == ['1,0,0 WIRE power:0', '0,0,0 UP', '0,0,10 UP']
+  end
+
+  it 'spaces out the torches in a mesh' do
+    run('GENERATE 0..4,0,0 MESH spacing:2', 'FIELD 0..4,0,0 direction').should ==
+      "0,0,0 UP\n1,0,0 nil\n2,0,0 UP\n3,0,0 nil\n4,0,0 UP"
+  end
+
+  it 'builds clocks at every location in the region' do
+    result = run('GENERATE 0..3%3,0,0 CLOCKS', 'STATUS', 'TICKQ', 'FIELD 0..3%3,0,0 power')
+    result.should =~ /^nodes: 8$/
+    result.split("\n").last(2).should == ['0,0,0 15', '3,0,0 15']
+  end
+
+  it 'builds an adder' do
+    result = run('GENERATE 0,0,0 ADDER bits:4 a:11 b:6', 'TICKQ 40', 'FIELD 0..18%6,3,0 power', 'FIELD 23,3,3 power')
+    result.should == "0,3,0 15\n6,3,0 0\n12,3,0 0\n18,3,0 0\n23,3,3 15"
+  end
+
+  it 'builds the same scatter from the same seed' do
+    first = run('GENERATE 0..99,0..99,0 SCATTER count:20 seed:5', 'NODES 0..99,0..99,0')
+    second = run('GENERATE 0..99,0..99,0 SCATTER count:20 seed:5', 'NODES 0..99,0..99,0')
+    third = run('GENERATE 0..99,0..99,0 SCATTER count:20 seed:6', 'NODES 0..99,0..99,0')
+    first.should == second
+    (first == third).should == false
+    first.split("\n").length.should > 10
+  end
+
+  it 'scatters nodes of any type' do
+    run('GENERATE 0,0,0 SCATTER count:1 type:CONDUCTOR', 'NODE 0,0,0').should == '0,0,0 CONDUCTOR power:0'
+  end
+
+  it 'fills a soup' do
+    run('GENERATE 0..1,0,0 SOUP type:WIRE field:power density:100', 'FIELD 0..1,0,0 power').should == "0,0,0 1\n1,0,0 1"
+    run('GENERATE 0..1,0,0 SOUP type:WIRE field:power density:0', 'FIELD 0..1,0,0 power').should == "0,0,0 0\n1,0,0 0"
+  end
+
+  it 'requires a known pattern' do
+    run('GENERATE 0,0,0 MAZE').should == "Unknown pattern 'MAZE'"
+  end
+
+  it 'requires known options' do
+    run('GENERATE 0,0,0 MESH bits:3').should == "Unknown option 'bits' for MESH"
+  end
+
+  it 'requires numeric options' do
+    run('GENERATE 0,0,0 ADDER bits:many').should == "'many' is not an integer"
+    run('GENERATE 0,0,0 ADDER bits:40').should == "'40' must be between 1 and 31"
+  end
+
+  it 'requires known types' do
+    run('GENERATE 0,0,0 SCATTER type:SPONGE', 'NODE 0,0,0').should == "Unknown type 'SPONGE'\n0,0,0 AIR"
+  end
+
+  it 'requires fields on the type' do
+    run('GENERATE 0,0,0 SOUP type:WIRE', 'NODE 0,0,0').should == "The type 'WIRE' doesn't have the field 'alive'\n0,0,0 AIR"
+  end
+end
@@ -0,0 +1,73 @@
+require 'spec_helper'
+require 'tmpdir'
+include Helpers
+
+describe 'HASH' do
+  it 'is zero for an empty world' do
+    run('HASH').should == '0000000000000000'
+  end
+
+  it 'changes when a node is set' do
+    run('NODE 0,0,0 WIRE', 'HASH').should_not == '0000000000000000'
+  end
+
+  it 'doesn\'t depend on the order nodes were set in' do
+    run('NODE 0,0,0 WIRE power:3', 'NODE 1,0,0 TORCH direction:UP', 'HASH').should ==
+      run('NODE 1,0,0 TORCH', 'FIELD 1,0,0 direction:UP', 'NODE 0,0,0 WIRE', 'FIELD 0,0,0 power:3', 'HASH')
+  end
+
+  it 'depends on the location, type and fields of nodes' do
+    hash = run('NODE 0,0,0 WIRE power:3', 'HASH')
+    run('NODE 0,0,1 WIRE power:3', 'HASH').should_not == hash
+    run('NODE 0,0,0 CONDUCTOR power:3', 'HASH').should_not == hash
+    run('NODE 0,0,0 WIRE power:4', 'HASH').should_not == hash
+  end
+
+  it 'treats unset fields as zero' do
+    run('NODE 0,0,0 WIRE', 'HASH').should == run('NODE 0,0,0 WIRE power:0', 'HASH')
+  end
+
+  it 'goes back to zero when nodes are deleted' do
+    run('NODE 0..3,0,0 WIRE power:3', 'DELETE 0..3,0,0', 'HASH').should == '0000000000000000'
+  end
+
+  it 'is kept up to date while ticking' do
+    result = run('GENERATE 0,0,0 ADDER bits:4 a:5 b:9', 'TICKQ 24', 'HASH', 'HASH CHECK').split("\n")
+    result.length.should == 2
+    result.first.should == result.last
+    run('GENERATE 0,0,0 ADDER bits:4 a:5 b:9', 'TICKQ 24', 'HASH').should_not == run('GENERATE 0,0,0 ADDER bits:4 a:5 b:9', 'HASH')
+  end
+
+  it 'is the same for the same simulation' do
+    run('GENERATE 0..12%3,0,0..12%3 CLOCKS', 'TICKQ 5', 'HASH').should ==
+      run('GENERATE 0..12%3,0,0..12%3 CLOCKS', 'TICKQ 5', 'HASH')
+  end
+
+  it 'is kept for each fork' do
+    result = run(
+      'NODE 0,0,0 TORCH direction:UP',
+      'NODE 0,1,0 WIRE',
+      'HASH',
+      'FORK other',
+      'SWITCH other',
+      'TICKQ 1',
+      'HASH CHECK',
+      'SWITCH main',
+      'HASH'
+    ).split("\n")
+    result[0].should == result[2]
+    result[1].should_not == result[0]
+  end
+
+  it 'is the same after loading a snapshot' do
+    Dir.mktmpdir do |dir|
+      path = File.join(dir, 'world')
+      hash = run('GENERATE 0..6%3,0,0..6%3 CLOCKS', 'TICKQ 3', 'HASH', "SAVE \"#{path}\"")
+      redpile("--load #{path}").run(['HASH CHECK']).should == hash
+    end
+  end
+
+  it 'requires a known mode' do
+    run('HASH ALL').should == "Unknown hash mode 'ALL'"
+  end
+end
@@ -0,0 +1,82 @@
+require 'spec_helper'
+require 'tmpdir'
+require 'socket'
+include Helpers
+
+describe 'METRICS' do
+  around(:each) do |example|
+    Dir.mktmpdir do |dir|
+      @dir = dir
+      @path = File.join(dir, 'ticks.log')
+      example.run
+    end
+  end
+
+  def records
+    File.read(@path).lines.map do |line|
+      line.should =~ /^redpile_tick \S+ \d+$/
+      Hash[line.split(' ')[1].split(',').map { |field| name, value = field.split('='); [name, value.chomp('i').to_i] }]
+    end
+  end
+
+  it 'writes a record for every tick' do
+    run('NODE 0,0,0 TORCH direction:UP', "METRICS ON \"#{@path}\"", 'TICKQ 3').should == ''
+    records.map { |record| record['tick'] }.should == [0, 1, 2]
+  end
+
+  it 'counts nodes, passes and messages' do
+    run(
+      'NODE 0,0,0 TORCH direction:UP',
+      'NODE 0,0,1..3 REPEATER direction:SOUTH state:3',
+      "METRICS ON \"#{@path}\"",
+      'TICKQ 2'
+    )
+    first = records.first
+    first['nodes'].should == 4
+    first['passes'].should == 1
+    first['delivered'].should > 0
+    first['delayed'].should > 0
+    first['nanoseconds'].should > 0
+  end
+
+  it 'counts system outputs' do
+    run('NODE 0,0,0 TORCH direction:UP', 'NODE 0,1,0 WIRE', "METRICS ON \"#{@path}\"", 'TICKQ 1')
+    records.first['outputs'].should == 1
+  end
+
+  it 'includes the world hash after each tick' do
+    hash = run('NODE 0,0,0 TORCH direction:UP', 'NODE 0,1,0 WIRE', "METRICS ON \"#{@path}\"", 'TICKQ 1', 'HASH')
+    File.read(@path).should =~ /,hash="#{hash}" \d+$/
+  end
+
+  it 'stops writing records when turned off' do
+    run('NODE 0,0,0 TORCH direction:UP', "METRICS ON \"#{@path}\"", 'TICKQ 2', 'METRICS OFF', 'TICKQ 2')
+    records.length.should == 2
+  end
+
+  it 'writes to a unix socket' do
+    socket_path = File.join(@dir, 'metrics.sock')
+    server = Socket.new(:UNIX, :DGRAM)
+    server.bind(Socket.sockaddr_un(socket_path))
+    run('NODE 0,0,0 TORCH direction:UP', "METRICS ON \"#{socket_path}\"", 'TICKQ 2')
+    server.recv(4096).should =~ /^redpile_tick tick=0i,/
+    server.recv(4096).should =~ /^redpile_tick tick=1i,/
+    server.close
+  end
+
+  it 'only writes to one place at a time' do
+    run("METRICS ON \"#{@path}\"", "METRICS ON \"#{@path}\"").should == "Metrics are already being written to '#{@path}'"
+  end
+
+  it 'needs to be on before turning it off' do
+    run('METRICS OFF').should == "Metrics aren't being written"
+  end
+
+  it 'requires a file it can write' do
+    run('METRICS ON "/nonexistent/ticks.log"').should =~ /^Unable to open '\/nonexistent\/ticks.log'/
+  end
+
+  it 'requires a known action' do
+    run('METRICS UP').should == "Unknown metrics action 'UP'"
+  end
+end
@@ -0,0 +1,81 @@
+require 'spec_helper'
+require 'timeout'
+include Helpers
+
+describe 'MIRROR' do
+  before(:each) do
+    @path = "/tmp/redpile-#{rand(1000000)}.mirror"
+    start_server
+    @client = connect
+  end
+
+  after(:each) { stop_server }
+
+  def send(*commands)
+    @client.puts commands
+    @client.puts 'PING'
+    Timeout.timeout(5) do
+      lines = []
+      lines << @client.gets.chomp until lines.last == 'PONG'
+      lines[0..-2].join("\n")
+    end
+  end
+
+  def mirror
+    data = File.binread(@path)
+    magic, header_size, sequence, _, tick, *rest = data.unpack('a4VVVQ<l<3l<3V3')
+    {
+      magic: magic, header_size: header_size, sequence: sequence, tick: tick,
+      origin: rest[0..2], step: rest[3..5], size: rest[6..8],
+      cells: data[header_size..-1].unpack('c*')
+    }
+  end
+
+  it 'returns an id for each mirror' do
+    send("MIRROR 0,0,0..3 power \"#{@path}\"").should == '1'
+  end
+
+  it 'describes the region in the header' do
+    send("MIRROR 3..0,0,0..6%2 power \"#{@path}\"")
+    result = mirror
+    result[:magic].should == 'RPM1'
+    result[:header_size].should == 64
+    result[:origin].should == [0, 0, 0]
+    result[:step].should == [1, 1, 2]
+    result[:size].should == [4, 1, 4]
+    result[:cells].length.should == 16
+  end
+
+  it 'updates the field after each tick' do
+    send(
+      'NODE 0,0,0 TORCH direction:UP',
+      'NODE 0,0,1..3 WIRE',
+      "MIRROR 0,0,0..4 power \"#{@path}\""
+    )
+    mirror[:cells].should == [0, 0, 0, 0, 0]
+    send('TICKQ 3')
+    result = mirror
+    result[:cells].should == [15, 15, 14, 13, 0]
+    result[:tick].should == 3
+    result[:sequence].should == 8
+  end
+
+  it 'lists mirrors' do
+    send("MIRROR 0,0,0 power \"#{@path}\"")
+    send('MIRROR').should == "1 power #{@path}"
+  end
+
+  it 'removes mirrors and their files' do
+    send("MIRROR 0,0,0 power \"#{@path}\"")
+    send('UNMIRROR 1').should == ''
+    File.exist?(@path).should == false
+  end
+
+  it 'fails to remove unknown mirrors' do
+    send('UNMIRROR 1').should == 'Unknown mirror 1'
+  end
+
+  it 'fails to write to a missing directory' do
+    send('MIRROR 0,0,0 power "/missing/file"').should == "Unable to write the mirror '/missing/file': No such file or directory"
+  end
+end
@@ -0,0 +1,69 @@
+require 'spec_helper'
+include Helpers
+
+describe 'NEXT' do
+  it 'reads nodes a page at a time' do
+    run(
+      'NODE 0..2,0,0 WIRE',
+      'NODE 0..2,0,0 LIMIT 2',
+      'NEXT 1'
+    ).should == "0,0,0 WIRE power:0\n1,0,0 WIRE power:0\nCURSOR 1\n2,0,0 WIRE power:0\nCURSOR 0"
+  end
+
+  it 'reads fields a page at a time' do
+    run(
+      'NODE 0..2,0,0 WIRE power:3',
+      'FIELD 0..2,0,0 power LIMIT 2',
+      'NEXT 1'
+    ).should == "0,0,0 3\n1,0,0 3\nCURSOR 1\n2,0,0 3\nCURSOR 0"
+  end
+
+  it 'finishes when the region fits in one page' do
+    run('NODE 0,0,0 LIMIT 10').should == "0,0,0 AIR\nCURSOR 0"
+  end
+
+  it 'forgets finished cursors' do
+    run(
+      'NODE 0,0,0 LIMIT 10',
+      'NEXT 1'
+    ).should =~ /^Unknown cursor 1$/
+  end
+
+  it 'expires cursors when the world changes' do
+    run(
+      'NODE 0..2,0,0 LIMIT 2',
+      'NODE 5,5,5 WIRE',
+      'NEXT 1'
+    ).should =~ /^The cursor 1 has expired since the world changed$/
+  end
+
+  it 'expires cursors when switching forks' do
+    run(
+      'FORK test',
+      'NODE 0..2,0,0 LIMIT 2',
+      'SWITCH test',
+      'NEXT 1'
+    ).should =~ /^The cursor 1 has expired since the world changed$/
+  end
+
+  it 'forgets cursors on dropped forks' do
+    run(
+      'FORK test',
+      'SWITCH test',
+      'NODES 0..2,0,0 LIMIT 2',
+      'SWITCH main',
+      'DROP test',
+      'FORK test',
+      'SWITCH test',
+      'NEXT 1'
+    ).should =~ /^Unknown cursor 1$/
+  end
+
+  it 'requires a positive limit' do
+    run('NODE 0,0,0 LIMIT 0').should == 'Limit must be greater than zero'
+  end
+
+  it 'fails with unknown options' do
+    run('NODE 0,0,0 WIRE 3').should == "Unknown option 'WIRE'"
+  end
+end
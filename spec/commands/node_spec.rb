@@ -44,6 +44,21 @@ describe 'NODE' do
     it 'a range of nodes with step' do
       run('NODE -2..2%2,-2..2%2,-2..2%2').should == NODE_RANGE2
     end
+
+    it 'a node far from the origin' do
+      run(
+        'NODE 1000000,-1000000,1000000 WIRE',
+        'NODE 1000000,-1000000,1000000'
+      ).should == '1000000,-1000000,1000000 WIRE power:0'
+    end
+
+    it 'a range of nodes across chunks' do
+      run(
+        'NODE -1..32,0,0 WIRE',
+        'DELETE 0..31,0,0',
+        'NODE -1..32%33,0,0'
+      ).should == "-1,0,0 WIRE power:0\n32,0,0 WIRE power:0"
+    end
   end
 
   it 'errors if given an incorrect direction' do
@@ -0,0 +1,69 @@
+require 'spec_helper'
+include Helpers
+
+describe 'NODES' do
+  def scattered
+    ['NODE 0,0,0 WIRE', 'NODE 100,0,0 WIRE power:3', 'NODE 5000,5000,5000 TORCH direction:UP', 'NODE 1,0,0 AIR']
+  end
+
+  it 'skips empty nodes' do
+    run('NODE 0,0,2 WIRE', 'NODES 0,0,0..3').should == '0,0,2 WIRE power:0'
+  end
+
+  it 'skips nodes of the default type' do
+    run(*scattered, 'NODES 0..1,0,0').should == '0,0,0 WIRE power:0'
+  end
+
+  it 'skips nodes outside the region' do
+    run(*scattered, 'NODES 0..200,0..1,0..1').split("\n").sort.should == [
+      '0,0,0 WIRE power:0',
+      '100,0,0 WIRE power:3'
+    ]
+  end
+
+  it 'skips nodes outside the step of the region' do
+    run('NODE 0,0,0..3 WIRE', 'NODES 0,0,0..3%2').should == "0,0,0 WIRE power:0\n0,0,2 WIRE power:0"
+  end
+
+  it 'finds nodes in regions larger than the world' do
+    result = run(*scattered, 'NODES -10000..10000,-10000..10000,-10000..10000').split("\n")
+    result.length.should == 3
+    result.sort.last.should =~ /^5000,5000,5000 TORCH/
+  end
+
+  it 'finds nodes in regions larger than the number of chunks' do
+    result = run(*scattered, 'NODES -1000000..1000000,-1000000..1000000,-1000000..1000000').split("\n")
+    result.length.should == 3
+  end
+
+  it 'returns nothing for an empty region' do
+    run(*scattered, 'NODES 10..20,10..20,10..20').should == ''
+  end
+
+  it 'reads a page at a time' do
+    result = run(*scattered, 'NODES -10000..10000,-10000..10000,-10000..10000 LIMIT 2', 'NEXT 1').split("\n")
+    result.length.should == 5
+    result[2].should == 'CURSOR 1'
+    result[4].should == 'CURSOR 0'
+  end
+
+  it 'reads a page at a time from the node index' do
+    result = run(*scattered, 'NODES -1000000..1000000,0,-1000000..1000000 LIMIT 1', 'NEXT 1', 'NEXT 1')
+    result.split("\n").reject { |line| line =~ /^CURSOR/ }.length.should == 2
+    result.split("\n").last.should == 'CURSOR 0'
+  end
+end
+
+describe 'FIELDS' do
+  it 'skips empty nodes' do
+    run('NODE 0,0,1 WIRE power:4', 'FIELDS 0,0,0..3 power').should == '0,0,1 4'
+  end
+
+  it 'reads a page at a time' do
+    run(
+      'NODE 0,0,0..2 WIRE power:4',
+      'FIELDS 0,0,0..9 power LIMIT 2',
+      'NEXT 1'
+    ).should == "0,0,0 4\n0,0,1 4\nCURSOR 1\n0,0,2 4\nCURSOR 0"
+  end
+end
@@ -0,0 +1,59 @@
+require 'spec_helper'
+require 'tmpdir'
+include Helpers
+
+describe 'PROFILE' do
+  around(:each) do |example|
+    Dir.mktmpdir do |dir|
+      @path = File.join(dir, 'lua.folded')
+      example.run
+    end
+  end
+
+  it 'writes sampled Lua stacks in the folded format' do
+    run(
+      'GENERATE 0..60%3,0,0..60%3 CLOCKS',
+      "PROFILE LUA START \"#{@path}\" 100",
+      'TICKQ 10',
+      'PROFILE LUA STOP'
+    ).should =~ /^\d+ samples written to #{@path}$/
+
+    lines = File.read(@path).lines
+    (lines.length > 0).should == true
+    lines.each { |line| line.should =~ /^\S+ \d+$/ }
+    lines.grep(/^power_(torch|wire)@conf\/redstone\.lua:\d+[; ]/).length.should > 0
+  end
+
+  it 'names the binding a sample was taken in' do
+    run(
+      'GENERATE 0..60%3,0,0..60%3 CLOCKS',
+      "PROFILE LUA START \"#{@path}\" 100",
+      'TICKQ 30',
+      'PROFILE LUA STOP'
+    )
+    File.read(@path).should =~ /;adjacent(_each)? \d+$/
+  end
+
+  it 'can only run one profile at a time' do
+    run(
+      "PROFILE LUA START \"#{@path}\"",
+      "PROFILE LUA START \"#{@path}\""
+    ).should == 'The Lua profiler is already running'
+  end
+
+  it 'needs to be started before stopping' do
+    run('PROFILE LUA STOP').should == "The Lua profiler isn't running"
+  end
+
+  it 'requires a file it can write' do
+    run('PROFILE LUA START "/nonexistent/lua.folded"').should =~ /^Unable to open '\/nonexistent\/lua.folded'/
+  end
+
+  it 'requires a known profiler' do
+    run('PROFILE C STOP').should == "Unknown profiler 'C'"
+  end
+
+  it 'requires a known action' do
+    run('PROFILE LUA PAUSE').should == "Unknown profile action 'PAUSE'"
+  end
+end
@@ -0,0 +1,169 @@
+require 'spec_helper'
+require 'tmpdir'
+include Helpers
+
+describe 'SAVE' do
+  around(:each) do |example|
+    Dir.mktmpdir do |dir|
+      @dir = dir
+      example.run
+    end
+  end
+
+  def path(name)
+    File.join(@dir, name)
+  end
+
+  def load(name, *commands)
+    redpile("--load #{path(name)}").run(commands)
+  end
+
+  it 'saves a snapshot' do
+    run('NODE 0,0,0 WIRE', "SAVE \"#{path('base')}\"").should == ''
+    File.exist?(path('base')).should == true
+  end
+
+  it 'loads a snapshot' do
+    run('TICKQ 2', 'NODE 0,0,0..1 WIRE power:5', 'NODE 0,0,100 TORCH direction:UP', "SAVE \"#{path('base')}\"")
+    result = load('base', 'NODE 0,0,0..1', 'NODE 0,0,100', 'STATUS')
+    result.should =~ /^0,0,0 WIRE power:5$/
+    result.should =~ /^0,0,1 WIRE power:5$/
+    result.should =~ /^0,0,100 TORCH/
+    result.should =~ /^ticks: 2$/
+    result.should =~ /^nodes: 3$/
+  end
+
+  it 'keeps messages in flight' do
+    run(
+      'NODE 0,0,0 TORCH direction:UP',
+      'NODE 0,0,1..3 REPEATER direction:SOUTH state:3',
+      'TICKQ 3',
+      "SAVE \"#{path('base')}\"",
+      'MESSAGE'
+    ).should == load('base', 'MESSAGE')
+  end
+
+  it 'tracks chunks changed since the last snapshot' do
+    run(
+      'NODE 0,0,0 WIRE',
+      'NODE 100,0,0 WIRE',
+      'NODE 200,0,0 WIRE',
+      "SAVE \"#{path('base')}\"",
+      'FIELD 100,0,0 power:3',
+      'STATUS'
+    ).should =~ /^dirty_chunks: 1$/
+  end
+
+  it 'saves only changed chunks incrementally' do
+    run(
+      'NODE 0..100,0,0 WIRE',
+      "SAVE \"#{path('base')}\"",
+      'FIELD 0,0,0 power:3',
+      "SAVE INCREMENTAL \"#{path('incremental')}\""
+    )
+    File.size(path('incremental')).should < File.size(path('base'))
+  end
+
+  it 'loads a chain of incremental snapshots' do
+    run(
+      'NODE 0,0,0..2 WIRE',
+      'NODE 100,0,0 WIRE',
+      "SAVE \"#{path('base')}\"",
+      'FIELD 0,0,0 power:3',
+      "SAVE INCREMENTAL \"#{path('first')}\"",
+      'DELETE 0,0,1',
+      'NODE 0,0,-100 WIRE',
+      "SAVE INCREMENTAL \"#{path('second')}\""
+    )
+    load('second', 'NODE 0,0,0..2', 'NODE 100,0,0', 'NODE 0,0,-100').should ==
+      "0,0,0 WIRE power:3\n0,0,1 AIR\n0,0,2 WIRE power:0\n100,0,0 WIRE power:0\n0,0,-100 WIRE power:0"
+  end
+
+  it 'does not save incrementally without a snapshot' do
+    run("SAVE INCREMENTAL \"#{path('incremental')}\"").should ==
+      'There is no snapshot to build on, use SAVE first'
+  end
+
+  it 'does not overwrite a snapshot in the chain' do
+    run(
+      "SAVE \"#{path('base')}\"",
+      "SAVE INCREMENTAL \"#{path('base')}\""
+    ).should == "The snapshot '#{path('base')}' is needed by the one being saved"
+  end
+
+  it 'does not accept an unknown mode' do
+    run("SAVE SOMETIMES \"#{path('base')}\"").should == "Unknown save mode 'SOMETIMES'"
+  end
+
+  it 'errors when loading a missing snapshot' do
+    redpile(opts: "--load #{path('missing')}", result: EXIT_FAILURE).run.should ==
+      "Unable to read the snapshot '#{path('missing')}': No such file or directory"
+  end
+
+  it 'errors when loading a file that is not a snapshot' do
+    File.write(path('base'), 'not a snapshot')
+    redpile(opts: "--load #{path('base')}", result: EXIT_FAILURE).run.should ==
+      "The file '#{path('base')}' is not a redpile snapshot"
+  end
+
+  it 'saves in the background' do
+    run(
+      'NODE 0,0,0..1 WIRE power:5',
+      "SAVE BACKGROUND \"#{path('base')}\"",
+      'STATUS'
+    ).should =~ /^save_state: (running|done)$/
+    load('base', 'NODE 0,0,0..1').should == "0,0,0 WIRE power:5\n0,0,1 WIRE power:5"
+  end
+
+  it 'saves the world as it was when a background save started' do
+    run(
+      'NODE 0,0,0 WIRE',
+      "SAVE BACKGROUND \"#{path('base')}\"",
+      'NODE 0,0,1 WIRE'
+    )
+    load('base', 'STATUS').should =~ /^nodes: 1$/
+  end
+
+  it 'keeps journal records made during a background save' do
+    journal = path('journal')
+    redpile("--journal #{journal}").run('NODE 0,0,0 WIRE', "SAVE BACKGROUND \"#{path('base')}\"", 'NODE 0,0,1 WIRE')
+    redpile("--load #{path('base')} --journal #{journal}").run('STATUS').should =~ /^nodes: 2$/
+  end
+
+  it 'empties the journal' do
+    journal = path('journal')
+    redpile("--journal #{journal}").run('NODE 0,0,0 WIRE', "SAVE \"#{path('base')}\"", 'NODE 0,0,1 WIRE')
+    redpile("--load #{path('base')} --journal #{journal}").run('STATUS').should =~ /^nodes: 2$/
+  end
+end
+
+describe 'COMPACT' do
+  around(:each) do |example|
+    Dir.mktmpdir do |dir|
+      @dir = dir
+      example.run
+    end
+  end
+
+  def path(name)
+    File.join(@dir, name)
+  end
+
+  it 'merges a chain into a single snapshot' do
+    run(
+      'NODE 0,0,0 WIRE',
+      "SAVE \"#{path('base')}\"",
+      'NODE 0,0,1 WIRE',
+      "SAVE INCREMENTAL \"#{path('incremental')}\"",
+      "COMPACT \"#{path('incremental')}\""
+    ).should == ''
+
+    File.delete(path('base'))
+    redpile("--load #{path('incremental')}").run('STATUS').should =~ /^nodes: 2$/
+  end
+
+  it 'errors on a missing snapshot' do
+    run("COMPACT \"#{path('missing')}\"").should ==
+      "Unable to read the snapshot '#{path('missing')}': No such file or directory"
+  end
+end
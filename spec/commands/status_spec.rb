@@ -30,4 +30,64 @@ describe 'STATUS' do
       'STATUS'
     ).should =~ /^nodes: 1$/
   end
+
+  it 'keeps the same tree depth for distant nodes' do
+    run(
+      'NODE 1000000,0,1000000 WIRE',
+      'NODE -1000000,0,-1000000 WIRE',
+      'STATUS'
+    ).should =~ /^tree_depth: 4$/
+  end
+
+  it 'displays the number of chunks' do
+    run(
+      'NODE 0,0,0 WIRE',
+      'NODE 31,31,31 WIRE',
+      'NODE -1,0,0 WIRE',
+      'STATUS'
+    ).should =~ /^tree_chunks: 2$/
+  end
+
+  it 'drops chunks once their nodes are deleted' do
+    run(
+      'NODE 0,0,0..1 WIRE',
+      'NODE -1,0,0 WIRE',
+      'DELETE 0,0,0..1',
+      'STATUS'
+    ).should =~ /^tree_chunks: 1$/
+  end
+
+  it 'displays memory used by each part of the world' do
+    result = run('NODE 0,0,0..9 WIRE power:1', 'STATUS MEMORY')
+    result.should =~ /^memory_nodes_objects: 11$/
+    result.should =~ /^memory_fields_objects: 10$/
+    result.should =~ /^memory_lua_bytes: [1-9]\d*$/
+    result.should =~ /^memory_bytes_per_node: [1-9][\d.]*$/
+  end
+
+  it 'frees the memory of deleted nodes' do
+    result = run('NODE 0,0,0..9 WIRE power:1', 'DELETE 0,0,0..9', 'STATUS MEMORY')
+    result.should =~ /^memory_nodes_objects: 1$/
+    result.should =~ /^memory_nodes_peak: [1-9]\d*$/
+    result.should =~ /^memory_fields_objects: 0$/
+  end
+
+  it 'requires a known status' do
+    run('STATUS DISK').should == "Unknown status 'DISK'"
+  end
+
+  it 'displays hardware counters for each phase of a tick' do
+    result = redpile('--perf-counters').run('NODE 0,0,0..3 WIRE', 'TICK', 'STATUS')
+    if result =~ /^perf: unavailable/
+      result.should =~ /^Hardware counters are unavailable: /
+    else
+      result.should =~ /^perf_ticks: 1$/
+      result.should =~ /^perf_nodes: \d+$/
+      result.should =~ /^perf_behaviors: .*\d/
+    end
+  end
+
+  it 'doesn\'t display hardware counters unless asked' do
+    run('TICK', 'STATUS').should_not =~ /^perf/
+  end
 end
@@ -0,0 +1,97 @@
+require 'spec_helper'
+require 'tmpdir'
+require 'json'
+include Helpers
+
+describe 'TRACE' do
+  around(:each) do |example|
+    Dir.mktmpdir do |dir|
+      @path = File.join(dir, 'trace.json')
+      example.run
+    end
+  end
+
+  def events
+    JSON.parse(File.read(@path))['traceEvents'].select { |event| event['ph'] != 'M' }
+  end
+
+  def names(phase)
+    events.select { |event| event['ph'] == phase }.map { |event| event['name'] }.uniq.sort
+  end
+
+  it 'dumps the phases of each tick' do
+    run(
+      'NODE 0,0,0 TORCH direction:UP',
+      'NODE 0,1,0 WIRE',
+      'TRACE ON',
+      'TICKQ 2',
+      "TRACE DUMP \"#{@path}\""
+    ).should == "40 events written to #{@path}, 0 overwritten"
+    names('B').should == ['nodes', 'pass', 'power_torch', 'power_wire', 'process_output', 'push_breakable', 'run_messages', 'tick']
+    names('E').should == names('B')
+  end
+
+  it 'nests events inside each other' do
+    run('NODE 0,0,0 TORCH direction:UP', 'TRACE ON', 'TICKQ 1', "TRACE DUMP \"#{@path}\"")
+    events.map { |event| "#{event['ph']} #{event['name']}" }.should == [
+      'B tick', 'B pass', 'B nodes',
+      'B push_breakable', 'E push_breakable', 'B power_torch', 'E power_torch',
+      'B process_output', 'E process_output',
+      'E nodes', 'E pass',
+      'B run_messages', 'E run_messages', 'E tick'
+    ]
+  end
+
+  it 'includes node counts' do
+    run('NODE 0,0,0..2 TORCH direction:UP', 'TRACE ON', 'TICKQ 1', "TRACE DUMP \"#{@path}\"")
+    tick = events.select { |event| event['name'] == 'tick' }
+    tick.first['args'].should == {'tick' => 0}
+    tick.last['args'].should == {'nodes' => 3}
+    events.find { |event| event['name'] == 'pass' }['args'].should == {'nodes' => 3}
+  end
+
+  it 'keeps the most recent events' do
+    run('NODE 0,0,0 TORCH direction:UP', 'TRACE ON 16', 'TICKQ 3', "TRACE DUMP \"#{@path}\"").should =~ /overwritten$/
+    events.last['name'].should == 'tick'
+    events.last['args'].should == {'nodes' => 1}
+    events.length.should < 17
+  end
+
+  it 'closes the events of a tick a behavior errors in' do
+    config = File.join(File.dirname(@path), 'error.lua')
+    File.write(config, <<-LUA)
+      redpile.behavior('fail', {}, function(node, messages) error('failed') end)
+      redpile.type('EMPTY', {}, {})
+      redpile.type('BROKEN', {}, {'fail'})
+    LUA
+    redpile(config: config).run('NODE 0,0,0 BROKEN', 'TRACE ON', 'TICKQ 2', "TRACE DUMP \"#{@path}\"")
+    events.map { |event| "#{event['ph']} #{event['name']}" }.should == [
+      'B tick', 'B pass', 'B nodes', 'B fail', 'E fail', 'E nodes', 'E pass', 'E tick'
+    ]
+  end
+
+  it 'stops recording when turned off' do
+    run('NODE 0,0,0 TORCH direction:UP', 'TRACE ON', 'TICKQ 1', 'TRACE OFF', 'TICKQ 1', "TRACE DUMP \"#{@path}\"")
+    events.select { |event| event['name'] == 'tick' && event['ph'] == 'B' }.length.should == 1
+  end
+
+  it 'requires something to dump' do
+    run("TRACE DUMP \"#{@path}\"").should == 'Nothing has been traced'
+  end
+
+  it 'can only be turned on once' do
+    run('TRACE ON', 'TRACE ON').should == 'Tracing is already on'
+  end
+
+  it 'needs to be on before turning it off' do
+    run('TRACE OFF').should == "Tracing isn't on"
+  end
+
+  it 'requires a reasonable number of events' do
+    run('TRACE ON 0').should =~ /^The number of events must be between 1 and \d+$/
+  end
+
+  it 'requires a known action' do
+    run('TRACE UP').should == "Unknown trace action 'UP'"
+  end
+end
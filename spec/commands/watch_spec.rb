@@ -0,0 +1,57 @@
+require 'spec_helper'
+include Helpers
+
+describe 'WATCH' do
+  def circuit
+    ['NODE 0,0,0 TORCH direction:UP', 'NODE 0,0,1..3 WIRE']
+  end
+
+  it 'returns an id for each watch' do
+    run(
+      'WATCH 0,0,0',
+      'WATCH 0,0,0 power'
+    ).should == "1\n2"
+  end
+
+  it 'sends nodes changed by a tick' do
+    result = run(*circuit, 'WATCH 0,0,1..5', 'TICKQ 3').split("\n")
+    result.shift.should == '1'
+    result.sort.should == [
+      'WATCH 1 0,0,1 WIRE power:15',
+      'WATCH 1 0,0,2 WIRE power:14',
+      'WATCH 1 0,0,3 WIRE power:13'
+    ]
+  end
+
+  it 'sends fields changed by a tick' do
+    result = run(*circuit, 'WATCH 0,0,2..3 power', 'TICKQ 3').split("\n")
+    result.shift.should == '1'
+    result.sort.should == ['WATCH 1 0,0,2 14', 'WATCH 1 0,0,3 13']
+  end
+
+  it 'only sends changes' do
+    run(*circuit, 'TICKQ 3', 'WATCH 0,0,0..5', 'TICKQ 3').should == '1'
+  end
+
+  it 'only sends changes inside the region' do
+    run(*circuit, 'WATCH 0,0,1..3%2 power', 'TICKQ 3').split("\n").sort.should == [
+      '1', 'WATCH 1 0,0,1 15', 'WATCH 1 0,0,3 13'
+    ]
+  end
+
+  it 'watches regions too large to index' do
+    run(*circuit, 'WATCH 0,0,-100000..100000 power', 'TICKQ 3').split("\n").length.should == 5
+  end
+
+  it 'stops watching' do
+    run(*circuit, 'WATCH 0,0,0..5', 'UNWATCH 1', 'TICKQ 3').should == '1'
+  end
+
+  it 'stops all watches' do
+    run(*circuit, 'WATCH 0,0,0..5', 'WATCH 0,0,0..5 power', 'UNWATCH', 'TICKQ 3').should == "1\n2"
+  end
+
+  it 'fails to stop unknown watches' do
+    run('UNWATCH 1').should == 'Unknown watch 1'
+  end
+end
@@ -0,0 +1,87 @@
+require 'spec_helper'
+require 'tmpdir'
+include Helpers
+
+describe 'Journal' do
+  around(:each) do |example|
+    Dir.mktmpdir do |dir|
+      @journal = File.join(dir, 'redpile.journal')
+      example.run
+    end
+  end
+
+  def journaled(*commands)
+    redpile("--journal #{@journal}").run(commands)
+  end
+
+  it 'creates a journal' do
+    journaled('PING').should == 'PONG'
+    File.exist?(@journal).should == true
+  end
+
+  it 'replays nodes' do
+    journaled('NODE 0,0,0..2 WIRE power:5')
+    journaled('NODE 0,0,0..2').should == "0,0,0 WIRE power:5\n0,0,1 WIRE power:5\n0,0,2 WIRE power:5"
+  end
+
+  it 'replays fields' do
+    journaled('NODE 0,0,0 WIRE', 'FIELD 0,0,0 power:7')
+    journaled('FIELD 0,0,0 power').should == '0,0,0 7'
+  end
+
+  it 'replays deletes' do
+    journaled('NODE 0,0,0..1 WIRE', 'DELETE 0,0,1')
+    journaled('NODE 0,0,0..1').should == "0,0,0 WIRE power:0\n0,0,1 AIR"
+  end
+
+  it 'replays generated worlds' do
+    journaled('GENERATE 0..99,0,0..99 SCATTER count:30 seed:2')
+    first = journaled('NODES 0..99,0,0..99')
+    first.split("\n").length.should > 20
+    journaled('NODES 0..99,0,0..99').should == first
+  end
+
+  it 'replays ticks' do
+    journaled('NODE 0,0,0 TORCH direction:UP', 'TICK 2')
+    result = journaled('STATUS', 'NODE 0,0,0')
+    result.should =~ /^ticks: 2$/
+    result.should =~ /^0,0,0 TORCH/
+    result.should =~ /power:15/
+  end
+
+  it 'replays forks' do
+    journaled('NODE 0,0,0 WIRE', 'FORK test', 'SWITCH test', 'DELETE 0,0,0')
+    journaled('FORK', 'NODE 0,0,0').should == "* test\n  main\n0,0,0 AIR"
+  end
+
+  it 'appends across runs' do
+    journaled('NODE 0,0,0 WIRE')
+    journaled('NODE 0,0,1 WIRE')
+    journaled('STATUS').should =~ /^nodes: 2$/
+  end
+
+  it 'does not replay queries' do
+    journaled('NODE 0,0,0', 'STATUS')
+    File.size(@journal).should == 4
+  end
+
+  it 'discards an incomplete record' do
+    journaled('NODE 0,0,0 WIRE', 'NODE 0,0,1 WIRE')
+    File.truncate(@journal, File.size(@journal) - 2)
+    journaled('NODE 0,0,0..1').should ==
+      "Discarding 56 bytes of incomplete records at the end of the journal\n0,0,0 WIRE power:0\n0,0,1 AIR"
+  end
+
+  it 'discards a record with a length past the end of the file' do
+    journaled('NODE 0,0,0 WIRE')
+    File.open(@journal, 'ab') { |file| file.write([1, 0xfffffff0, 0].pack('CVV')) }
+    journaled('NODE 0,0,0').should ==
+      "Discarding 9 bytes of incomplete records at the end of the journal\n0,0,0 WIRE power:0"
+  end
+
+  it 'errors on a file that is not a journal' do
+    File.write(@journal, 'not a journal')
+    redpile(opts: "--journal #{@journal}", result: EXIT_FAILURE).run.should ==
+      "The file '#{@journal}' is not a redpile journal"
+  end
+end
@@ -0,0 +1,53 @@
+require 'spec_helper'
+require 'json'
+require 'tmpdir'
+include Helpers
+
+describe 'Load generator' do
+  LOAD = './build/tools/redpile-load'
+
+  before { start_server }
+  after { stop_server }
+
+  def load(*args)
+    IO.popen([LOAD, '--port', @port.to_s, '--connections', '2', *args], err: [:child, :out], &:read)
+  end
+
+  def commands(result)
+    result.lines.drop(2).map {|line| line.split.first }.sort
+  end
+
+  it 'sends a mix of node, field and tick commands' do
+    result = load('--count', '200')
+    result.should =~ /^200 commands over 2 connections/
+    commands(result).should == %w(field get set tick)
+  end
+
+  it 'sends only the commands in the mix' do
+    commands(load('--count', '50', '--mix', 'field=1')).should == %w(field)
+  end
+
+  it 'replays a trace' do
+    Dir.mktmpdir do |dir|
+      trace = File.join(dir, 'trace')
+      File.write(trace, "# A comment\nNODE 0,0,0 TORCH\n\nSTATUS\ntick 2\n")
+      result = load('--count', '30', trace)
+      result.should =~ /^30 commands/
+      commands(result).should == %w(NODE STATUS TICK)
+    end
+  end
+
+  it 'prints results as json' do
+    result = JSON.parse(load('--count', '40', '--rate', '400', '--json'))
+    result['commands'].should == 40
+    result['commands_by_type'].each do |command|
+      command['p50'].should > 0
+      (command['p999'] >= command['p99']).should == true
+    end
+  end
+
+  it 'requires a port' do
+    IO.popen([LOAD], err: [:child, :out], &:read).strip.
+    should == 'You must provide the port of the server with --port'
+  end
+end
@@ -0,0 +1,34 @@
+require 'spec_helper'
+require 'json'
+include Helpers
+
+describe 'Microbenchmarks' do
+  MICROBENCH = './build/tools/redpile-microbench'
+
+  def microbench(*args)
+    IO.popen([MICROBENCH, '--time', '1', '--count', '256', *args], err: [:child, :out], &:read)
+  end
+
+  it 'times every data structure' do
+    names = microbench.lines.drop(1).map {|line| line.split.first }
+    %w(hashmap octree queue message).each do |prefix|
+      names.grep(/^#{prefix}\//).size.should > 0
+    end
+  end
+
+  it 'runs only the benchmarks matching a filter' do
+    microbench('octree/get').lines.drop(1).map {|line| line.split.first }.
+    should == %w(octree/get/sequential octree/get/morton octree/get/random)
+  end
+
+  it 'prints results as json' do
+    result = JSON.parse(microbench('--json', 'hashmap/get'))
+    result['benchmarks'].map {|bench| bench['name'] }.
+    should == %w(hashmap/get/sequential hashmap/get/morton hashmap/get/random)
+    result['benchmarks'].each {|bench| bench['memory'].should > 0 }
+  end
+
+  it 'errors when given a count of zero' do
+    microbench('--count', '0').strip.should == 'You must provide a count greater than zero'
+  end
+end
@@ -1,4 +1,5 @@
 require 'spec_helper'
+require 'tmpdir'
 include Helpers
 
 REDPILE_VERSION = File.read('src/redpile.h')[/REDPILE_VERSION "(\d+\.\d+\.\d+)"/, 1]
@@ -6,7 +7,6 @@ BAD_NEGATIVES = [0, -1, -20]
 BAD_NUMBERS = ['abc', 'a12', '12c']
 BAD_POWERS = [3, 13, 28]
 BAD_PORTS = [65536, 100000000]
-EXIT_FAILURE = 256
 
 describe 'Options' do
   [true, false].each do |short|
@@ -81,6 +81,51 @@ describe 'Options' do
     redpile('--benchmark 1').run.should =~ /^--- Benchmark Start ---$/
   end
 
+  it 'prints benchmarks as json' do
+    redpile(opts: '--benchmark 1 --benchmark-format=json', config: 'conf/gameoflife.lua').
+    run.should =~ /\A\{\n  "version": "#{REDPILE_VERSION}",.*\{"name": "tick\/gliders\/32", "trials": \d+,/m
+  end
+
+  it 'compares benchmarks to a baseline' do
+    Dir.mktmpdir do |dir|
+      File.write("#{dir}/baseline.json", %Q({"name": "node/get", "median": 1.0}\n))
+      redpile(opts: "--benchmark 1 --benchmark-baseline #{dir}/baseline.json --benchmark-threshold 1000000",
+              config: 'conf/gameoflife.lua').
+      run.should =~ /^node\/get .* \+\d+\.\d%$/
+    end
+  end
+
+  it 'fails when benchmarks are slower than the baseline' do
+    Dir.mktmpdir do |dir|
+      File.write("#{dir}/baseline.json", %Q({"name": "node/get", "median": 1.0}\n))
+      redpile(opts: "--benchmark 1 --benchmark-baseline #{dir}/baseline.json --benchmark-threshold 0",
+              config: 'conf/gameoflife.lua', result: EXIT_FAILURE).
+      run.should =~ /^1 benchmark is more than 0% slower than the baseline$/
+    end
+  end
+
+  it 'errors when the benchmark baseline is missing' do
+    redpile(opts: '--benchmark 1 --benchmark-baseline missing.json', result: EXIT_FAILURE).
+    run.should == "Could not open the benchmark baseline 'missing.json': No such file or directory"
+  end
+
+  it 'errors when run with an unknown benchmark format' do
+    redpile(opts: '--benchmark 1 --benchmark-format xml', result: EXIT_FAILURE).
+    run.should == 'You must pass either text or json as the benchmark format'
+  end
+
+  BAD_NUMBERS.each do |threshold|
+    it "errors when run with a benchmark threshold of '#{threshold}'" do
+      redpile(opts: "--benchmark-threshold #{threshold}", result: EXIT_FAILURE).
+      run.should == 'You must pass an integer as the benchmark threshold'
+    end
+  end
+
+  it 'errors when run with a negative benchmark threshold' do
+    redpile(opts: '--benchmark-threshold -1', result: EXIT_FAILURE).
+    run.should == 'You must provide a benchmark threshold of zero or greater'
+  end
+
   BAD_NUMBERS.each do |count|
     it "errors when run with '#{count}' benchmarks" do
       redpile(opts: "--benchmark #{count}", result: EXIT_FAILURE).
@@ -95,6 +140,49 @@ describe 'Options' do
     end
   end
 
+  BAD_NUMBERS.each do |interval|
+    it "errors when run with a journal interval of '#{interval}'" do
+      redpile(opts: "--journal-interval #{interval}", result: EXIT_FAILURE).
+      run.should == 'You must pass an integer as the journal interval'
+    end
+  end
+
+  BAD_NUMBERS.each do |size|
+    it "errors when run with a journal buffer of '#{size}'" do
+      redpile(opts: "--journal-buffer #{size}", result: EXIT_FAILURE).
+      run.should == 'You must pass an integer as the journal buffer size'
+    end
+  end
+
+  BAD_NUMBERS.each do |rate|
+    it "errors when run with a tick rate of '#{rate}'" do
+      redpile(opts: "--port 1 --tick-rate #{rate}", result: EXIT_FAILURE).
+      run.should == 'You must pass an integer as the tick rate'
+    end
+  end
+
+  BAD_NEGATIVES.each do |rate|
+    it "errors when run with a tick rate of '#{rate}'" do
+      redpile(opts: "--port 1 --tick-rate #{rate}", result: EXIT_FAILURE).
+      run.should == 'You must provide a tick rate greater than zero'
+    end
+  end
+
+  it 'errors when run with too high a tick rate' do
+    redpile(opts: '--port 1 --tick-rate 1001', result: EXIT_FAILURE).
+    run.should == 'You must provide a tick rate less than or equal to 1000'
+  end
+
+  it 'errors when run with a tick rate without a port' do
+    redpile(opts: '--tick-rate 20', result: EXIT_FAILURE).
+    run.should == 'You must provide a port or socket to run with a tick rate'
+  end
+
+  it 'errors when run with an unknown tick overload' do
+    redpile(opts: '--port 1 --tick-overload merge', result: EXIT_FAILURE).
+    run.should == 'You must pass either catchup or skip as the tick overload'
+  end
+
   it 'errors when given an empty configuration file' do
     redpile(config: '/dev/null', result: EXIT_FAILURE).
     run.should == 'No types defined in configuration file /dev/null'
@@ -0,0 +1,146 @@
+require 'spec_helper'
+require 'timeout'
+include Helpers
+
+describe 'Binary protocol' do
+  MAGIC = "\0RPB".b
+  NIL = -2**31
+  OPS = {
+    ping: 0x00, types: 0x01, node_get: 0x02, node_set: 0x03, field_get: 0x04,
+    field_set: 0x05, tick: 0x06, region_get: 0x07, error: 0xFF
+  }
+
+  before(:each) do
+    start_server
+    @socket = connect
+    @socket.write(MAGIC + [1].pack('C'))
+    Timeout.timeout(5) { @handshake = @socket.read(5) }
+  end
+
+  after(:each) { stop_server }
+
+  def request(op, payload = ''.b)
+    frame = [OPS[op]].pack('C') + payload
+    @socket.write([frame.bytesize].pack('L<') + frame)
+  end
+
+  def reply
+    Timeout.timeout(5) do
+      length = @socket.read(4).unpack1('L<')
+      data = @socket.read(length)
+      [OPS.key(data.getbyte(0)), data[1..-1]]
+    end
+  end
+
+  def call(op, payload = ''.b)
+    request(op, payload)
+    op, data = reply
+    fail "error: #{data[4..-1]}" if op == :error
+    data
+  end
+
+  def string(value)
+    [value.bytesize].pack('L<') + value
+  end
+
+  def locations(*locations)
+    [locations.size].pack('L<') + locations.flatten.pack('l<*')
+  end
+
+  def types
+    data = call(:types)
+    count = data.unpack1('L<')
+    offset = 4
+    count.times.map do
+      length = data[offset, 4].unpack1('L<')
+      name = data[offset + 4, length]
+      offset += 4 + length
+      name
+    end
+  end
+
+  it 'replies to the handshake with its version' do
+    @handshake.should == MAGIC + [1].pack('C')
+  end
+
+  it 'replies to pings' do
+    request(:ping)
+    reply.should == [:ping, ''.b]
+  end
+
+  it 'lists types' do
+    (%w(AIR WIRE TORCH) - types).should == []
+  end
+
+  it 'sets and gets nodes' do
+    wire = types.index('WIRE')
+    call(:node_set, [wire].pack('S<') + locations([0, 0, 0], [0, 0, 2])).unpack1('L<').should == 2
+    data = call(:node_get, locations([0, 0, 0], [0, 0, 1], [0, 0, 2]))
+    data.unpack('L<S<S<S<').should == [3, wire, types.index('AIR'), wire]
+  end
+
+  it 'shares the world with text clients' do
+    call(:node_set, [types.index('TORCH')].pack('S<') + locations([1, 2, 3]))
+    text = connect
+    text.puts 'NODE 1,2,3'
+    Timeout.timeout(5) { text.gets.should =~ /^1,2,3 TORCH/ }
+  end
+
+  it 'sets and gets fields' do
+    call(:node_set, [types.index('WIRE')].pack('S<') + locations([0, 0, 0], [0, 0, 1]))
+    payload = string('power') + [1, 0, 0, 0, 7].pack('L<l<l<l<l<')
+    call(:field_set, payload).unpack1('L<').should == 1
+    data = call(:field_get, string('power') + locations([0, 0, 0], [0, 0, 1], [5, 5, 5]))
+    data.unpack('L<l<l<l<').should == [3, 7, 0, NIL]
+  end
+
+  it 'ticks' do
+    call(:tick, [3].pack('L<')).unpack1('Q<').should == 3
+    call(:tick, [2].pack('L<')).unpack1('Q<').should == 5
+  end
+
+  it 'gets only the non default nodes in a region' do
+    wire = types.index('WIRE')
+    call(:node_set, [wire].pack('S<') + locations([0, 0, 0], [3, 1, 2]))
+    data = call(:region_get, [3, 3, 3, -3, -3, -3].pack('l<*'))
+    count = data.unpack1('L<')
+    count.should == 2
+    nodes = count.times.map { |i| data[4 + i * 14, 14].unpack('l<l<l<S<') }
+    nodes.sort.should == [[0, 0, 0, wire], [3, 1, 2, wire]]
+  end
+
+  it 'pipelines requests' do
+    100.times { request(:tick, [1].pack('L<')) }
+    100.times.map { reply[1].unpack1('Q<') }.should == (1..100).to_a
+  end
+
+  it 'reports errors' do
+    request(:node_set, [999].pack('S<') + locations([0, 0, 0]))
+    op, data = reply
+    op.should == :error
+    data[4..-1].should == 'Unknown type 999'
+  end
+
+  it 'reports field errors' do
+    request(:field_set, string('power') + [1, 0, 0, 0, 7].pack('L<l<l<l<l<'))
+    op, data = reply
+    op.should == :error
+    data[4..-1].should == "The type 'AIR' doesn't have the field 'power'"
+  end
+
+  it 'reports malformed requests' do
+    request(:node_get, [5].pack('L<'))
+    op, data = reply
+    op.should == :error
+    data[4..-1].should == 'Malformed request for op 2'
+    request(:ping)
+    reply.should == [:ping, ''.b]
+  end
+
+  it 'reports unknown ops' do
+    @socket.write([1, 0x42].pack('L<C'))
+    op, data = reply
+    op.should == :error
+    data[4..-1].should == 'Unknown op 66'
+  end
+end
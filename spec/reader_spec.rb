@@ -0,0 +1,68 @@
+require 'spec_helper'
+require 'timeout'
+include Helpers
+
+describe 'Reader threads' do
+  after(:each) { stop_server }
+
+  def read_all(client)
+    client.puts 'PING'
+    Timeout.timeout(10) do
+      lines = []
+      lines << client.gets.chomp until lines.last == 'PONG'
+      lines[0..-2]
+    end
+  end
+
+  it 'answers large reads in full' do
+    start_server
+    client = connect
+    client.puts 'NODE 0..99,0..99,0 WIRE'
+    client.puts 'NODE 0..99,0..99,0'
+    read_all(client).length.should == 10000
+  end
+
+  it 'answers large field reads' do
+    start_server
+    client = connect
+    client.puts 'NODE 0..99,0..99,0 WIRE'
+    client.puts 'FIELD 0..99,0..99,0 power'
+    result = read_all(client)
+    result.length.should == 10000
+    result.first.should == '0,0,0 nil'
+  end
+
+  it 'keeps serving other clients during a large read' do
+    start_server
+    reader = connect
+    reader.puts 'NODE 0..99,0..99,0..99'
+    client = connect
+    client.puts 'NODE 0,0,0 TORCH direction:UP'
+    client.puts 'NODE 0,0,1 WIRE'
+    client.puts 'TICKQ 2'
+    client.puts 'NODE 0,0,1'
+    Timeout.timeout(5) { client.gets.should =~ powered(0, 0, 1) }
+    read_all(reader).length.should == 1000000
+  end
+
+  it 'sees the world as it was when the read was sent' do
+    start_server
+    client = connect
+    client.puts 'NODE 0..99,0..99,0 WIRE'
+    client.puts 'NODE 0..99,0..99,0'
+    client.puts 'DELETE 0..99,0..99,0'
+    client.puts 'NODE 0,0,0'
+    result = read_all(client)
+    result.length.should == 10001
+    result[0].should =~ /WIRE/
+    result[-1].should =~ /AIR/
+  end
+
+  it 'reads on the main thread without reader threads' do
+    start_server('--reader-threads', '0')
+    client = connect
+    client.puts 'NODE 0..99,0..99,0 WIRE'
+    client.puts 'NODE 0..99,0..99,0'
+    read_all(client).length.should == 10000
+  end
+end
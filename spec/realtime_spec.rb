@@ -0,0 +1,67 @@
+require 'spec_helper'
+require 'timeout'
+include Helpers
+
+describe 'Tick rate' do
+  after(:each) { stop_server }
+
+  def status(client)
+    client.puts 'STATUS'
+    client.puts 'PING'
+    Timeout.timeout(5) do
+      lines = []
+      lines << client.gets.chomp until lines.last == 'PONG'
+      Hash[lines[0..-2].map { |line| line.split(': ', 2) }]
+    end
+  end
+
+  it 'ticks on its own' do
+    start_server('--tick-rate', '100')
+    client = connect
+    sleep 0.3
+    result = status(client)
+    result['ticks'].to_i.should > 5
+    result['tick_rate'].should == '100'
+    result['tick_overload'].should == 'catchup'
+    result['tick_budget_us'].should == '10000'
+  end
+
+  it 'runs commands between ticks' do
+    start_server('--tick-rate', '100')
+    client = connect
+    client.puts 'NODE 0,0,0 TORCH direction:UP'
+    client.puts 'NODE 0,0,1 WIRE'
+    sleep 0.2
+    client.puts 'NODE 0,0,1'
+    Timeout.timeout(5) { client.gets.should =~ powered(0, 0, 1) }
+  end
+
+  # Reading a large region holds up the tick timer without making ticks slower
+  def stall
+    connect.puts 'NODE 0..99,0..99,0..49'
+    sleep 0.5
+  end
+
+  it 'catches up on ticks that fell behind' do
+    start_server('--tick-rate', '1000')
+    client = connect
+    stall
+    result = status(client)
+    result['tick_max_backlog'].to_i.should > 0
+    result['tick_skipped'].should == '0'
+  end
+
+  it 'skips ticks that fell behind' do
+    start_server('--tick-rate', '1000', '--tick-overload', 'skip')
+    client = connect
+    stall
+    result = status(client)
+    result['tick_overload'].should == 'skip'
+    result['tick_skipped'].to_i.should > 0
+  end
+
+  it 'only reports tick rate stats when enabled' do
+    start_server
+    status(connect).keys.grep(/^tick_/).should == []
+  end
+end
@@ -0,0 +1,66 @@
+require 'spec_helper'
+require 'timeout'
+include Helpers
+
+describe 'Local socket' do
+  RING_CLIENT = './build/tools/redpile-ring-client'
+
+  before(:each) do
+    @socket = "/tmp/redpile-#{rand(1000000)}.sock"
+    start_server('--socket', @socket)
+    @server.gets.should == "Listening on #{@socket}\n"
+  end
+
+  after(:each) { stop_server unless @server.closed? }
+
+  def ring_client(*commands, size: nil)
+    args = size ? ['-s', size.to_s] : []
+    IO.popen([RING_CLIENT, *args, @socket], 'r+') do |process|
+      process.puts commands
+      process.close_write
+      Timeout.timeout(10) { process.read.strip }
+    end
+  end
+
+  it 'responds to text commands' do
+    client = UNIXSocket.new(@socket)
+    client.puts 'PING'
+    Timeout.timeout(5) { client.gets.should == "PONG\n" }
+  end
+
+  it 'sends output through shared memory' do
+    ring_client(
+      'NODE 0,0,0 TORCH direction:UP',
+      'NODE 0,0,1 WIRE',
+      'TICKQ 2',
+      'NODE 0,0,1'
+    ).should =~ powered(0, 0, 1)
+  end
+
+  it 'sends errors through shared memory' do
+    ring_client('FOO').should == "Unknown command 'FOO'"
+  end
+
+  it 'sends output larger than the ring' do
+    result = ring_client('NODE 0..99,0..9,0..99 WIRE', 'NODE 0..99,0..9,0..99', size: 65536)
+    result.lines.count.should == 100000
+  end
+
+  it 'disconnects clients asking for rings of the wrong size' do
+    client = UNIXSocket.new(@socket)
+    client.write("\0RPR\x01\x00" + [1000].pack('V'))
+    Timeout.timeout(5) { client.read.should == '' }
+  end
+
+  it 'only sends output through shared memory for local clients' do
+    client = connect
+    client.write("\0RPR\x01\x00" + [65536].pack('V') + "\nPING\n")
+    Timeout.timeout(5) { client.gets.should =~ /^Unknown command/ }
+  end
+
+  it 'removes the socket when it stops' do
+    File.exist?(@socket).should == true
+    stop_server
+    File.exist?(@socket).should == false
+  end
+end
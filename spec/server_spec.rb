@@ -0,0 +1,108 @@
+require 'spec_helper'
+require 'timeout'
+include Helpers
+
+describe 'Server' do
+  before(:each) { start_server }
+  after(:each) { stop_server }
+
+  def response(socket, lines)
+    Timeout.timeout(5) { lines.times.map { socket.gets }.join.strip }
+  end
+
+  it 'responds to a client' do
+    client = connect
+    client.puts 'PING'
+    response(client, 1).should == 'PONG'
+  end
+
+  it 'serves clients concurrently' do
+    first = connect
+    second = connect
+    second.puts 'PING'
+    response(second, 1).should == 'PONG'
+    first.puts 'PING'
+    response(first, 1).should == 'PONG'
+  end
+
+  it 'shares the world between clients' do
+    first = connect
+    second = connect
+    first.puts 'NODE 0,0,0 WIRE power:3'
+    first.puts 'PING'
+    response(first, 1).should == 'PONG'
+    second.puts 'NODE 0,0,0'
+    response(second, 1).should == '0,0,0 WIRE power:3'
+  end
+
+  it 'keeps partial lines separate per client' do
+    first = connect
+    second = connect
+    first.write 'NODE 0,0,'
+    first.flush
+    second.puts 'NODE 0,0,1 TORCH'
+    second.puts 'PING'
+    response(second, 1).should == 'PONG'
+    first.puts '1'
+    response(first, 1).should =~ /^0,0,1 TORCH/
+  end
+
+  it 'keeps serving after a client disconnects' do
+    first = connect
+    first.puts 'NODE 0,0,0 WIRE'
+    first.close
+    second = connect
+    second.puts 'PING'
+    response(second, 1).should == 'PONG'
+  end
+
+  it 'runs a last command without a newline once the client hangs up' do
+    client = connect
+    client.write "PING\nPING"
+    client.close_write
+    Timeout.timeout(5) { client.read.strip }.should == "PONG\nPONG"
+  end
+
+  it 'reports errors to the client that caused them' do
+    first = connect
+    second = connect
+    first.puts 'FOO'
+    response(first, 1).should == "Unknown command 'FOO'"
+    second.puts 'PING'
+    response(second, 1).should == 'PONG'
+  end
+
+  it 'sends large responses in full' do
+    client = connect
+    client.puts 'NODE 0..99,0,0..99 WIRE'
+    client.puts 'NODE 0..99,0,0..99'
+    client.puts 'PING'
+    result = response(client, 10001).split("\n")
+    result.size.should == 10001
+    result.first.should == '0,0,0 WIRE power:0'
+    result.last.should == 'PONG'
+  end
+
+  it 'keeps serving others while a client is slow to read' do
+    slow = connect
+    slow.puts 'NODE 0..199,0..9,0..199 WIRE'
+    slow.puts 'NODE 0..199,0..9,0..199'
+    fast = connect
+    fast.puts 'PING'
+    response(fast, 1).should == 'PONG'
+    response(slow, 400000).lines.count.should == 400000
+  end
+
+  it 'sends watched changes to the client watching them' do
+    watcher = connect
+    watcher.puts 'WATCH 0,0,1 power'
+    response(watcher, 1).should == '1'
+    client = connect
+    client.puts 'NODE 0,0,0 TORCH direction:UP'
+    client.puts 'NODE 0,0,1 WIRE'
+    client.puts 'TICKQ 2'
+    client.puts 'PING'
+    response(client, 1).should == 'PONG'
+    response(watcher, 1).should == 'WATCH 1 0,0,1 15'
+  end
+end
@@ -1,8 +1,11 @@
+require 'socket'
+
 module Helpers
   DIRECTIONS = %w(NORTH SOUTH EAST WEST UP DOWN)
   REDPILE_CONF = 'conf/redstone.lua'
   REDPILE_CMD = './build/src/redpile'
   VALGRIND_CMD = 'valgrind -q --leak-check=full --show-reachable=yes '
+  EXIT_FAILURE = 256
 
   class Redpile
     def initialize(process, valgrind, result)
@@ -49,6 +52,21 @@ module Helpers
     redpile.run(commands)
   end
 
+  def start_server(*opts)
+    @port = 20000 + rand(20000)
+    @server = IO.popen([REDPILE_CMD, '--port', @port.to_s, *opts, REDPILE_CONF, err: [:child, :out]])
+    @server.gets.should == "Listening on 0.0.0.0:#{@port}\n"
+  end
+
+  def stop_server
+    Process.kill('INT', @server.pid)
+    @server.close
+  end
+
+  def connect
+    TCPSocket.new('127.0.0.1', @port)
+  end
+
   def powered(x, y, z)
     /^#{x},#{y},#{z} \S+ power:[^0]\d+$/
   end
@@ -28,91 +28,626 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include "bench.h"
 #include "command.h"
 #include "redpile.h"
 #include "repl.h"
+#include "perf.h"
+#include "generate.h"
+#include "tick.h"
+#include <errno.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/time.h>
-
-#define TO_SECONDS(x) ((x) / (1000 * 1000))
-#define MILISECONDS(x) ((x) * 1000)
-#define BENCHMARK(METHOD,PER_ITER,LIMIT)\
-    do {\
-        long long start, time, count;\
-        count = 0;\
-        start = get_time();\
-        do\
-        {\
-            for (int i = 0; i < PER_ITER; i++)\
-            {\
-                benchmark_ ## METHOD();\
-            }\
-            count += PER_ITER;\
-            time = get_time() - start;\
-        } while (time < LIMIT);\
-        float final = count / TO_SECONDS((float)time);\
-        if (final > 1000)\
-        {\
-            final /= 1000;\
-            printf(#METHOD ":\t%.2fk / sec\n", final);\
-        }\
-        else\
-        {\
-            printf(#METHOD ":\t%.2f / sec\n", final);\
-        }\
-    } while (0) 
+#include <string.h>
+#include <time.h>
+
+#define BENCH_MIN_TRIALS 5
+#define BENCH_WARMUP_PERCENT 10
+#define BENCH_NODE_COUNT 10000
+#define BENCH_SPARSE_SPACING 64
+#define NANOSECONDS(x) ((long long)(x) * 1000 * 1000)
+
+// Each scenario builds its own world in `setup` and then times `run` over
+// and over.  `prepare` is run untimed before every trial for scenarios that
+// undo their own work, like deleting a region.  Scenarios that only take a
+// fraction of a microsecond repeat `run` `batch` times per trial and report
+// the time of a single run.  Hardware counters are divided by the number of
+// nodes a single run processes, as returned by `nodes`.  Scenarios that tick
+// leave it NULL and are divided by the nodes the ticks actually ran, which
+// counts a node again for every pass that reruns it.
+typedef struct {
+    const char* name;
+    const char* requires[3];
+    int size;
+    unsigned int batch;
+    void (*setup)(int size);
+    void (*prepare)(int size);
+    void (*run)(int size);
+    unsigned int (*nodes)(int size);
+} Scenario;
+
+// All times are in nanoseconds for a single run of the scenario
+typedef struct {
+    unsigned int trials;
+    double min;
+    double median;
+    double mean;
+    double stddev;
+    double p90;
+    double p99;
+    double max;
+
+    // Counters for all trials together
+    PerfSample counters;
+    double nodes;
+} BenchStats;
+
+typedef struct {
+    char* name;
+    double median;
+} BenchBaseline;
+
+static Type* node_type;
+static Type** indexes;
+static Perf perf;
 
 static long long get_time(void)
 {
-    struct timeval value;
-    gettimeofday(&value, NULL);
+    struct timespec value;
+    clock_gettime(CLOCK_MONOTONIC, &value);
+    return ((long long)value.tv_sec) * 1000 * 1000 * 1000 + value.tv_nsec;
+}
 
-    long long time = ((long long)value.tv_sec) * 1000000;
-    time += value.tv_usec;
-    return time;
+static Region region_cube(int start, int size, int spacing)
+{
+    Range range = range_create(start, start + (size - 1) * spacing, spacing);
+    return (Region){range, range, range};
+}
+
+static Region region_plane(int x, int z, int end, int spacing)
+{
+    return (Region){
+        range_create(x, x + end, spacing),
+        range_create(0, 0, 1),
+        range_create(z, z + end, spacing)
+    };
+}
+
+static void bench_reset(void)
+{
+    World* fresh = world_allocate(config->world_size, world->type_data);
+    world_free(world);
+    world = fresh;
 }
 
-Type** indexes;
-static void benchmark_insert(void)
+static void bench_set(Region region, const char* type, const char* field, const char* value)
 {
+    CommandArgs* args = command_args_allocate(1);
+    if (field != NULL)
+        command_args_append(args, strdup(field), strdup(value));
+    command_node_set(&region, (char*)type, args);
+    command_args_free(args);
+}
+
+static void bench_field(Region region, const char* field, const char* value)
+{
+    command_field_set(&region, (char*)field, (char*)value);
+}
+
+static void setup_random(int size)
+{
+    (void)size;
+    bench_reset();
+    for (int i = 0; i < BENCH_NODE_COUNT; i++)
+    {
+        Region region;
+        region_randomize(&region, 1);
+        bench_set(region, indexes[rand() % world->type_data->type_count]->name, NULL, NULL);
+    }
+}
+
+static void setup_empty(int size)
+{
+    (void)size;
+    bench_reset();
+}
+
+static void run_insert(int size)
+{
+    (void)size;
     Region region;
     region_randomize(&region, 1);
-    char* type_name = indexes[rand() % world->type_data->type_count]->name;
-    CommandArgs* args = command_args_allocate(0);
-    command_node_set(&region, type_name, args);
-    command_args_free(args);
+    bench_set(region, indexes[rand() % world->type_data->type_count]->name, NULL, NULL);
 }
 
-static void benchmark_get(void)
+static void run_get(int size)
 {
+    (void)size;
     Region region;
     region_randomize(&region, 1);
     command_node_get(&region);
 }
 
-static void benchmark_delete(void)
+static void run_delete(int size)
 {
+    (void)size;
     Region region;
     region_randomize(&region, 1);
     command_delete(&region);
 }
 
-void bench_run(unsigned int count)
+static void setup_cube(int size)
+{
+    bench_reset();
+    bench_set(region_cube(0, size, 1), node_type->name, NULL, NULL);
+}
+
+static void run_region_set(int size)
+{
+    bench_set(region_cube(0, size, 1), node_type->name, NULL, NULL);
+}
+
+static void run_region_get(int size)
+{
+    Region region = region_cube(0, size, 1);
+    command_node_get(&region);
+}
+
+static void run_region_delete(int size)
+{
+    Region region = region_cube(0, size, 1);
+    command_delete(&region);
+}
+
+// Holds as many nodes as the dense world from setup_cube, spread out so that
+// every node lands in its own chunk
+static void setup_sparse(int size)
+{
+    bench_reset();
+    bench_set(region_cube(0, size, BENCH_SPARSE_SPACING), node_type->name, NULL, NULL);
+}
+
+static void bench_lattice_get(int size, int spacing)
+{
+    Location location = location_create(
+        (rand() % size) * spacing,
+        (rand() % size) * spacing,
+        (rand() % size) * spacing
+    );
+    Region region = {
+        range_create(location.x, location.x, 1),
+        range_create(location.y, location.y, 1),
+        range_create(location.z, location.z, 1)
+    };
+    command_node_get(&region);
+}
+
+static void run_dense_get(int size)
+{
+    bench_lattice_get(size, 1);
+}
+
+static void run_sparse_get(int size)
+{
+    bench_lattice_get(size, BENCH_SPARSE_SPACING);
+}
+
+// Both worlds are read over the area the sparse one covers
+static void run_world_nodes(int size)
+{
+    Region region = region_cube(0, size * BENCH_SPARSE_SPACING, 1);
+    command_nodes_get(&region);
+}
+
+static void bench_generate(Region region, const char* pattern)
+{
+    CommandArgs* args = command_args_allocate(0);
+    generate_run(world, &region, pattern, args);
+    command_args_free(args);
+}
+
+// The wire grid from scripts/grid.sh with a torch every ten wires
+static void setup_grid(int size)
+{
+    bench_reset();
+    bench_generate(region_plane(-size, -size, size * 2, 1), "MESH");
+    command_tick(2, LOG_QUIET);
+}
+
+// A square of torch clocks, see generate_clocks
+static void setup_clocks(int size)
+{
+    bench_reset();
+    bench_generate(region_plane(0, 0, (size - 1) * 3, 3), "CLOCKS");
+}
+
+// A field of cells from conf/gameoflife.lua with a glider in every 8x8 square
+static void setup_gliders(int size)
+{
+    int end = size - 8;
+    bench_reset();
+    bench_set(region_plane(0, 0, size - 1, 1), "CELL", NULL, NULL);
+    bench_field(region_plane(2, 0, end, 8), "alive", "1");
+    bench_field(region_plane(2, 1, end, 8), "alive", "1");
+    bench_field(region_plane(2, 2, end, 8), "alive", "1");
+    bench_field(region_plane(1, 2, end, 8), "alive", "1");
+    bench_field(region_plane(0, 1, end, 8), "alive", "1");
+}
+
+static void run_tick(int size)
+{
+    (void)size;
+    command_tick(1, LOG_QUIET);
+}
+
+static unsigned int nodes_one(int size)
 {
+    (void)size;
+    return 1;
+}
+
+static unsigned int nodes_cube(int size)
+{
+    return size * size * size;
+}
+
+static Scenario scenarios[] = {
+    {"node/insert",        {NULL},             0, 100, setup_empty,   NULL,       run_insert,        nodes_one},
+    {"node/get",           {NULL},             0, 100, setup_random,  NULL,       run_get,           nodes_one},
+    {"node/delete",        {NULL},             0, 100, setup_random,  NULL,       run_delete,        nodes_one},
+    {"region/set",         {NULL},            16,   1, setup_empty,   NULL,       run_region_set,    nodes_cube},
+    {"region/set",         {NULL},            32,   1, setup_empty,   NULL,       run_region_set,    nodes_cube},
+    {"region/get",         {NULL},            16,   1, setup_cube,    NULL,       run_region_get,    nodes_cube},
+    {"region/get",         {NULL},            32,   1, setup_cube,    NULL,       run_region_get,    nodes_cube},
+    {"region/delete",      {NULL},            16,   1, setup_empty,   setup_cube, run_region_delete, nodes_cube},
+    {"region/delete",      {NULL},            32,   1, setup_empty,   setup_cube, run_region_delete, nodes_cube},
+    {"world/dense/get",    {NULL},            16, 100, setup_cube,    NULL,       run_dense_get,     nodes_one},
+    {"world/sparse/get",   {NULL},            16, 100, setup_sparse,  NULL,       run_sparse_get,    nodes_one},
+    {"world/dense/nodes",  {NULL},            16,   1, setup_cube,    NULL,       run_world_nodes,   nodes_cube},
+    {"world/sparse/nodes", {NULL},            16,   1, setup_sparse,  NULL,       run_world_nodes,   nodes_cube},
+    {"tick/grid",          {"WIRE", "TORCH"}, 10,   1, setup_grid,    NULL,       run_tick,          NULL},
+    {"tick/grid",          {"WIRE", "TORCH"}, 25,   1, setup_grid,    NULL,       run_tick,          NULL},
+    {"tick/clocks",        {"WIRE", "TORCH"},  8,   1, setup_clocks,  NULL,       run_tick,          NULL},
+    {"tick/clocks",        {"WIRE", "TORCH"}, 16,   1, setup_clocks,  NULL,       run_tick,          NULL},
+    {"tick/gliders",       {"CELL"},          32,   1, setup_gliders, NULL,       run_tick,          NULL},
+    {"tick/gliders",       {"CELL"},          64,   1, setup_gliders, NULL,       run_tick,          NULL},
+};
+
+static const char* scenario_missing_type(Scenario* scenario)
+{
+    for (unsigned int i = 0; i < 3 && scenario->requires[i] != NULL; i++)
+    {
+        if (type_data_find_type(world->type_data, scenario->requires[i]) == NULL)
+            return scenario->requires[i];
+    }
+    return NULL;
+}
+
+static void scenario_name(Scenario* scenario, char* buffer, size_t size)
+{
+    if (scenario->size > 0)
+        snprintf(buffer, size, "%s/%d", scenario->name, scenario->size);
+    else
+        snprintf(buffer, size, "%s", scenario->name);
+}
+
+static long long scenario_trial(Scenario* scenario, PerfSample* counters, unsigned long long* processed)
+{
+    if (scenario->prepare != NULL)
+        scenario->prepare(scenario->size);
+
+    unsigned long long processed_before = tick_nodes_processed();
+    PerfSample before, after;
+    perf_read(&perf, &before);
+
+    long long start = get_time();
+    for (unsigned int i = 0; i < scenario->batch; i++)
+        scenario->run(scenario->size);
+    long long time = get_time() - start;
+
+    perf_read(&perf, &after);
+    perf_sample_add(counters, &before, &after);
+    *processed += tick_nodes_processed() - processed_before;
+    return time;
+}
+
+static int compare_samples(const void* a, const void* b)
+{
+    long long first = *(const long long*)a;
+    long long second = *(const long long*)b;
+    return (first > second) - (first < second);
+}
+
+// Nearest rank percentile of sorted samples
+static double percentile(long long* samples, unsigned int count, unsigned int percent)
+{
+    unsigned int rank = (count * percent + 99) / 100;
+    return samples[rank > 0 ? rank - 1 : 0];
+}
+
+static BenchStats scenario_measure(Scenario* scenario, long long budget)
+{
+    // Warm up caches, the allocator and Lua before anything is recorded
+    PerfSample counters = {{0}};
+    unsigned long long processed = 0;
+    long long start = get_time();
+    do
+    {
+        scenario_trial(scenario, &counters, &processed);
+    } while (get_time() - start < budget * BENCH_WARMUP_PERCENT / 100);
+
+    unsigned int count = 0;
+    unsigned int capacity = 64;
+    long long* samples = malloc(sizeof(long long) * capacity);
+    CHECK_OOM(samples);
+
+    counters = (PerfSample){{0}};
+    processed = 0;
+    start = get_time();
+    while (count < BENCH_MIN_TRIALS || get_time() - start < budget)
+    {
+        if (count == capacity)
+        {
+            capacity *= 2;
+            samples = realloc(samples, sizeof(long long) * capacity);
+            CHECK_OOM(samples);
+        }
+        samples[count++] = scenario_trial(scenario, &counters, &processed);
+    }
+
+    qsort(samples, count, sizeof(long long), compare_samples);
+
+    double sum = 0;
+    for (unsigned int i = 0; i < count; i++)
+        sum += samples[i];
+    double mean = sum / count;
+
+    double variance = 0;
+    for (unsigned int i = 0; i < count; i++)
+        variance += (samples[i] - mean) * (samples[i] - mean);
+    variance /= count > 1 ? count - 1 : 1;
+
+    double median = count % 2 == 0
+        ? (samples[count / 2 - 1] + samples[count / 2]) / 2.0
+        : samples[count / 2];
+
+    double batch = scenario->batch;
+    BenchStats stats = {
+        count,
+        samples[0] / batch,
+        median / batch,
+        mean / batch,
+        sqrt(variance) / batch,
+        percentile(samples, count, 90) / batch,
+        percentile(samples, count, 99) / batch,
+        samples[count - 1] / batch,
+        counters,
+        scenario->nodes != NULL ? (double)count * scenario->batch * scenario->nodes(scenario->size) : processed
+    };
+
+    free(samples);
+    return stats;
+}
+
+static char* format_time(char* buffer, double time)
+{
+    if (time < 1000)
+        sprintf(buffer, "%.0fns", time);
+    else if (time < 1000 * 1000)
+        sprintf(buffer, "%.2fus", time / 1000);
+    else if (time < 1000 * 1000 * 1000)
+        sprintf(buffer, "%.2fms", time / (1000 * 1000));
+    else
+        sprintf(buffer, "%.2fs", time / (1000 * 1000 * 1000));
+    return buffer;
+}
+
+// Reads back the name and median of every benchmark from a file written with
+// --benchmark-format json.  Anything else in the file is ignored.
+static BenchBaseline* baseline_load(const char* path, unsigned int* count)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+    {
+        repl_print_error("Could not open the benchmark baseline '%s': %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    unsigned int capacity = 16;
+    BenchBaseline* baseline = malloc(sizeof(BenchBaseline) * capacity);
+    CHECK_OOM(baseline);
+    *count = 0;
+
+    char line[1024];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        char name[256];
+        char* found = strstr(line, "\"name\": \"");
+        char* median = strstr(line, "\"median\": ");
+        if (found == NULL || median == NULL || sscanf(found, "\"name\": \"%255[^\"]\"", name) != 1)
+            continue;
+
+        if (*count == capacity)
+        {
+            capacity *= 2;
+            baseline = realloc(baseline, sizeof(BenchBaseline) * capacity);
+            CHECK_OOM(baseline);
+        }
+        baseline[*count].name = strdup(name);
+        baseline[*count].median = strtod(median + strlen("\"median\": "), NULL);
+        (*count)++;
+    }
+    fclose(file);
+
+    if (*count == 0)
+    {
+        repl_print_error("No benchmarks found in the baseline '%s'\n", path);
+        free(baseline);
+        return NULL;
+    }
+
+    return baseline;
+}
+
+static BenchBaseline* baseline_find(BenchBaseline* baseline, unsigned int count, const char* name)
+{
+    for (unsigned int i = 0; i < count; i++)
+    {
+        if (strcmp(baseline[i].name, name) == 0)
+            return &baseline[i];
+    }
+    return NULL;
+}
+
+static void baseline_free(BenchBaseline* baseline, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; i++)
+        free(baseline[i].name);
+    free(baseline);
+}
+
+static void print_text(const char* name, BenchStats* stats, BenchBaseline* found, double change, bool regressed, bool counters)
+{
+    char median[32], stddev[32], p90[32], p99[32];
+    printf("%-22s %10s %10s %10s %10s %8u",
+           name,
+           format_time(median, stats->median),
+           format_time(stddev, stats->stddev),
+           format_time(p90, stats->p90),
+           format_time(p99, stats->p99),
+           stats->trials);
+
+    if (found != NULL)
+        printf(" %+8.1f%%%s", change, regressed ? " REGRESSION" : "");
+    printf("\n");
+
+    if (counters)
+    {
+        char per_node[256];
+        perf_format(&perf, &stats->counters, stats->nodes, per_node, sizeof(per_node));
+        printf("%-22s per node: %s\n", "", per_node);
+    }
+    fflush(stdout);
+}
+
+static void print_json(const char* name, BenchStats* stats, Scenario* scenario, BenchBaseline* found, double change, bool first, bool counters)
+{
+    printf("%s\n    {\"name\": \"%s\", \"trials\": %u, \"batch\": %u, "
+           "\"min\": %.1f, \"median\": %.1f, \"mean\": %.1f, \"stddev\": %.1f, "
+           "\"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f",
+           first ? "" : ",",
+           name, stats->trials, scenario->batch,
+           stats->min, stats->median, stats->mean, stats->stddev,
+           stats->p90, stats->p99, stats->max);
+
+    if (found != NULL)
+        printf(", \"baseline\": %.1f, \"change\": %.2f", found->median, change);
+
+    // Counters are per node processed
+    if (counters)
+    {
+        printf(", \"counters\": {\"nodes\": %.0f", stats->nodes);
+        for (unsigned int i = 0; i < PERF_COUNTERS; i++)
+        {
+            if (perf_available(&perf, i))
+                printf(", \"%s\": %.3f", perf_names[i], stats->nodes > 0 ? stats->counters.values[i] / stats->nodes : 0);
+        }
+        printf("}");
+    }
+
+    printf("}");
+}
+
+bool bench_run(unsigned int time, BenchFormat format, const char* baseline_path, unsigned int threshold)
+{
+    unsigned int baseline_count = 0;
+    BenchBaseline* baseline = NULL;
+    if (baseline_path != NULL)
+    {
+        baseline = baseline_load(baseline_path, &baseline_count);
+        if (baseline == NULL)
+            return false;
+    }
+
     indexes = type_data_type_indexes_allocate(world->type_data);
+    node_type = indexes[world->type_data->type_count - 1];
     srand(get_time());
 
-    unsigned int limit = MILISECONDS(count);
-    assert(limit > 0);
+    long long budget = NANOSECONDS(time);
+    assert(budget > 0);
     repl_mute(true);
 
-    printf("--- Benchmark Start ---\n");
-    BENCHMARK(insert, 100, limit);
-    BENCHMARK(get,    100, limit);
-    BENCHMARK(delete, 100, limit);
+    // Benchmarks still run without counters, they just aren't reported
+    bool counters = perf_open(&perf);
+
+    if (format == BENCH_JSON)
+    {
+        printf("{\n  \"version\": \"%s\",\n  \"unit\": \"ns\",\n  \"counters\": %s,\n  \"benchmarks\": [",
+               REDPILE_VERSION, counters ? "true" : "false");
+    }
+    else
+    {
+        printf("--- Benchmark Start ---\n");
+        if (!counters)
+            printf("Hardware counters are unavailable: %s\n", strerror(perf.error));
+        printf("%-22s %10s %10s %10s %10s %8s%s\n",
+               "name", "median", "stddev", "p90", "p99", "trials",
+               baseline != NULL ? "   change" : "");
+    }
+
+    unsigned int regressions = 0;
+    bool first = true;
+    for (unsigned int i = 0; i < sizeof(scenarios) / sizeof(Scenario); i++)
+    {
+        Scenario* scenario = &scenarios[i];
+        char name[64];
+        scenario_name(scenario, name, sizeof(name));
+
+        const char* missing = scenario_missing_type(scenario);
+        if (missing != NULL)
+        {
+            if (format == BENCH_TEXT)
+                printf("%-22s skipped, the type %s is missing\n", name, missing);
+            continue;
+        }
+
+        scenario->setup(scenario->size);
+        BenchStats stats = scenario_measure(scenario, budget);
+
+        double change = 0;
+        bool regressed = false;
+        BenchBaseline* found = baseline_find(baseline, baseline_count, name);
+        if (found != NULL && found->median > 0)
+        {
+            change = (stats.median - found->median) * 100 / found->median;
+            regressed = change > threshold;
+            if (regressed)
+                regressions++;
+        }
+
+        if (format == BENCH_JSON)
+            print_json(name, &stats, scenario, found, change, first, counters);
+        else
+            print_text(name, &stats, found, change, regressed, counters);
+        first = false;
+    }
+
+    if (format == BENCH_JSON)
+        printf("\n  ]\n}\n");
 
     repl_mute(false);
+    perf_close(&perf);
     free(indexes);
-}
+    if (baseline != NULL)
+        baseline_free(baseline, baseline_count);
 
+    if (regressions > 0)
+    {
+        repl_print_error("%u benchmark%s more than %u%% slower than the baseline\n",
+                         regressions, regressions == 1 ? " is" : "s are", threshold);
+        return false;
+    }
+
+    return true;
+}
@@ -33,7 +33,11 @@
 
 #include "world.h"
 
-void bench_run(unsigned int count);
+typedef enum {
+    BENCH_TEXT,
+    BENCH_JSON
+} BenchFormat;
 
-#endif
+bool bench_run(unsigned int time, BenchFormat format, const char* baseline, unsigned int threshold);
 
+#endif
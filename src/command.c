@@ -32,37 +32,49 @@
 #include "common.h"
 #include "redpile.h"
 #include "repl.h"
+#include "journal.h"
+#include "snapshot.h"
+#include "reader.h"
+#include "watch.h"
+#include "mirror.h"
+#include "query.h"
+#include "generate.h"
+#include "memory.h"
+#include "profile.h"
+#include "metrics.h"
+#include "trace.h"
+#include <strings.h>
+#include <inttypes.h>
 
 #define PARSE_ERROR_IF(CONDITION, ...) if (CONDITION) { repl_print_error(__VA_ARGS__); goto end; }
 
-static bool direction_parse(const char* string, Direction* found_dir)
-{
-    for (int i = 0; i < DIRECTIONS_COUNT; i++)
-    {
-        if (strcasecmp(string, Directions[i]) == 0)
-        {
-            *found_dir = i;
-            return true;
-        }
-    }
+// Forks of the world that aren't currently in use.
+// The active one is always stored in the global `world`.
+typedef struct WorldFork {
+    char* name;
+    World* world;
+    struct WorldFork* next;
+} WorldFork;
 
-    return false;
-}
+static WorldFork* forks = NULL;
+static char* current_fork = NULL;
 
-static bool integer_parse(const char* string, int* found_int)
+static WorldFork** fork_find(const char* name)
 {
-    char* parse_error = NULL;
-    int value = strtol(string, &parse_error, 10);
+    WorldFork** fork = &forks;
+    while (*fork != NULL && strcmp((*fork)->name, name) != 0)
+        fork = &(*fork)->next;
+    return fork;
+}
 
-    if (!*parse_error)
-    {
-        *found_int = value;
-        return true;
-    }
-    else
-    {
-        return false;
-    }
+static void fork_add(char* name, World* world)
+{
+    WorldFork* fork = malloc(sizeof(WorldFork));
+    CHECK_OOM(fork);
+    fork->name = name;
+    fork->world = world;
+    fork->next = forks;
+    forks = fork;
 }
 
 static bool type_parse(char* string, Type** type)
@@ -85,37 +97,21 @@ static void node_field_set(Node* node, char* name, char* value)
         return;
     }
 
-    switch (field->type)
+    if (!node_field_parse(node, field, index, value))
     {
-        case FIELD_INTEGER: {
-            int result;
-            if (integer_parse(value, &result))
-            {
-                FIELD_SET(node, index, integer, result);
-            }
-            else
-            {
+        switch (field->type)
+        {
+            case FIELD_INTEGER:
                 repl_print_error("'%s' is not an integer\n", value);
-                return;
-            }
-        } break;
+                break;
 
-        case FIELD_DIRECTION: {
-            Direction result;
-            if (direction_parse(value, &result))
-            {
-                FIELD_SET(node, index, direction, result);
-            }
-            else
-            {
+            case FIELD_DIRECTION:
                 repl_print_error("'%s' is not a direction\n", value);
-                return;
-            }
-        } break;
+                break;
 
-        case FIELD_STRING:
-            FIELD_SET(node, index, string, strdup(value));
-            break;
+            case FIELD_STRING:
+                break;
+        }
     }
 }
 
@@ -150,13 +146,93 @@ void command_ping(void)
 void command_status(void)
 {
     world_stats_print(world_get_stats(world));
+    snapshot_print_status();
+    realtime_print_status();
+    tick_profile_print();
+}
+
+void command_status_show(char* section)
+{
+    if (strcasecmp(section, "MEMORY") == 0)
+        memory_print_status(world->nodes.count);
+    else
+        repl_print_error("Unknown status '%s'\n", section);
+}
+
+void command_hash(void)
+{
+    repl_print("%016" PRIx64 "\n", world->hash);
+}
+
+// Rebuilds the hash from every node to check the one kept up to date
+void command_hash_check(char* mode)
+{
+    if (strcasecmp(mode, "CHECK") != 0)
+    {
+        repl_print_error("Unknown hash mode '%s'\n", mode);
+        return;
+    }
+
+    uint64_t hash = world_hash_compute(world);
+    if (hash == world->hash)
+        repl_print("%016" PRIx64 "\n", hash);
+    else
+        repl_print_error("The world hash is %016" PRIx64 " but its nodes hash to %016" PRIx64 "\n", world->hash, hash);
 }
 
-static void command_node_get_callback(Location location, Node* node, UNUSED void* args)
+void command_profile(char* profiler, char* action, char* path, int interval)
 {
+    if (strcasecmp(profiler, "LUA") != 0)
+    {
+        repl_print_error("Unknown profiler '%s'\n", profiler);
+        return;
+    }
+
+    if (strcasecmp(action, "START") == 0 && path != NULL)
+    {
+        if (interval <= 0)
+            repl_print_error("The profiling interval must be greater than zero\n");
+        else
+            profile_lua_start(state, path, interval);
+    }
+    else if (strcasecmp(action, "STOP") == 0 && path == NULL)
+    {
+        profile_lua_stop();
+    }
+    else
+    {
+        repl_print_error("Unknown profile action '%s'\n", action);
+    }
+}
+
+void command_metrics(char* action, char* path)
+{
+    if (strcasecmp(action, "ON") == 0 && path != NULL)
+        metrics_start(path);
+    else if (strcasecmp(action, "OFF") == 0 && path == NULL)
+        metrics_stop();
+    else
+        repl_print_error("Unknown metrics action '%s'\n", action);
+}
+
+void command_trace(char* action, char* path, int events)
+{
+    if (strcasecmp(action, "ON") == 0 && path == NULL)
+        trace_start(events);
+    else if (strcasecmp(action, "OFF") == 0 && path == NULL)
+        trace_stop();
+    else if (strcasecmp(action, "DUMP") == 0 && path != NULL)
+        trace_dump(path);
+    else
+        repl_print_error("Unknown trace action '%s'\n", action);
+}
+
+static void command_node_get_callback(Location location, Node* node, void* args)
+{
+    World* view = (World*)args;
     if (NODE_IS_EMPTY(node) || node->data->type == NULL)
     {
-        Type* type = type_data_get_default_type(world->type_data);
+        Type* type = type_data_get_default_type(view->type_data);
         repl_print("%d,%d,%d %s\n", location.x, location.y, location.z, type->name);
     }
     else
@@ -165,9 +241,28 @@ static void command_node_get_callback(Location location, Node* node, UNUSED void
     }
 }
 
+// Large queries are answered by a reader thread when the client allows it
+static void* command_defer(Region* region)
+{
+    if (!reader_running() || region_area(region) < READER_MIN_AREA)
+        return NULL;
+
+    return repl_suspend();
+}
+
 void command_node_get(Region* region)
 {
-    world_get_region(world, region, command_node_get_callback, NULL);
+    void* owner = command_defer(region);
+    if (owner != NULL)
+        reader_submit(READ_NODE, region, NULL, owner);
+    else
+        command_node_read(world, region);
+}
+
+// Also used from reader threads, so only `view` may be used
+void command_node_read(World* view, Region* region)
+{
+    world_get_region(view, region, command_node_get_callback, view);
 }
 
 struct command_node_set_args {
@@ -190,6 +285,8 @@ void command_node_set(Region* region, char* type_name, CommandArgs* fields)
     Type* type;
     if (type_parse(type_name, &type))
     {
+        journal_node(region, type_name, fields);
+
         struct command_node_set_args args = {type, fields};
         world_set_region(world, region, command_node_set_callback, &args);
     }
@@ -208,7 +305,94 @@ static void command_field_get_callback(Location location, Node* node, void* args
 
 void command_field_get(Region* region, char* name)
 {
-    world_get_region(world, region, command_field_get_callback, name);
+    void* owner = command_defer(region);
+    if (owner != NULL)
+        reader_submit(READ_FIELD, region, name, owner);
+    else
+        command_field_read(world, region, name);
+}
+
+// Also used from reader threads, so only `view` may be used
+void command_field_read(World* view, Region* region, char* name)
+{
+    world_get_region(view, region, command_field_get_callback, name);
+}
+
+static bool command_check_limit(char* option, int limit)
+{
+    if (strcasecmp(option, "limit") != 0)
+    {
+        repl_print_error("Unknown option '%s'\n", option);
+        return false;
+    }
+
+    if (limit <= 0)
+    {
+        repl_print_error("Limit must be greater than zero\n");
+        return false;
+    }
+
+    return true;
+}
+
+// Prints a page of results followed by the cursor for the next one, which
+// is 0 once there's nothing left
+static void command_page(Query* query)
+{
+    bool done = query->field != NULL ?
+        query_run(query, command_field_get_callback, query->field) :
+        query_run(query, command_node_get_callback, query->world);
+
+    if (done)
+    {
+        repl_print("CURSOR 0\n");
+        query_free(query);
+    }
+    else
+    {
+        repl_print("CURSOR %u\n", query->id);
+    }
+}
+
+void command_node_page(Region* region, char* option, int limit, bool sparse)
+{
+    if (!command_check_limit(option, limit))
+        return;
+
+    Query* query = query_allocate(world, region, NULL, limit, sparse, repl_client());
+    if (query != NULL)
+        command_page(query);
+}
+
+void command_field_page(Region* region, char* name, char* option, int limit, bool sparse)
+{
+    if (!command_check_limit(option, limit))
+        return;
+
+    Query* query = query_allocate(world, region, name, limit, sparse, repl_client());
+    if (query != NULL)
+        command_page(query);
+}
+
+void command_nodes_get(Region* region)
+{
+    Query query;
+    query_init(&query, world, region, NULL, UINT_MAX, true);
+    query_run(&query, command_node_get_callback, world);
+}
+
+void command_fields_get(Region* region, char* name)
+{
+    Query query;
+    query_init(&query, world, region, name, UINT_MAX, true);
+    query_run(&query, command_field_get_callback, name);
+}
+
+void command_next(int id)
+{
+    Query* query = query_find(world, id, repl_client());
+    if (query != NULL)
+        command_page(query);
 }
 
 struct command_field_set_args {
@@ -234,15 +418,24 @@ static void command_field_set_callback(UNUSED Location location, Node* node, voi
 
 void command_field_set(Region* region, char* name, char* value)
 {
+    journal_field(region, name, value);
+
     struct command_field_set_args args = {name, value};
-    world_get_region(world, region, command_field_set_callback, &args);
+    world_edit_region(world, region, command_field_set_callback, &args);
 }
 
 void command_delete(Region* region)
 {
+    journal_delete(region);
     world_delete_region(world, region);
 }
 
+void command_generate(Region* region, char* pattern, CommandArgs* options)
+{
+    if (generate_run(world, region, pattern, options))
+        journal_generate(region, pattern, options);
+}
+
 struct command_plot_args {
     char* field;
     int start;
@@ -353,7 +546,10 @@ void command_plot(Region* region, char* field)
 void command_tick(int count, LogLevel log_level)
 {
     if (count > 0)
+    {
+        journal_tick(count);
         tick_run(state, world, count, log_level);
+    }
 }
 
 void command_message(void)
@@ -371,6 +567,145 @@ void command_type_show(char* name)
     world_print_type(world, name);
 }
 
+void command_fork_list(void)
+{
+    repl_print("* %s\n", current_fork ? current_fork : "main");
+    for (WorldFork* fork = forks; fork != NULL; fork = fork->next)
+        repl_print("  %s\n", fork->name);
+}
+
+void command_fork(char* name)
+{
+    if (strcmp(name, current_fork ? current_fork : "main") == 0 || *fork_find(name) != NULL)
+    {
+        repl_print_error("The fork '%s' already exists\n", name);
+        return;
+    }
+
+    journal_name(JOURNAL_FORK, name);
+    fork_add(strdup(name), world_fork(world));
+}
+
+void command_switch(char* name)
+{
+    WorldFork** found = fork_find(name);
+    if (*found == NULL)
+    {
+        repl_print_error("Unknown fork '%s'\n", name);
+        return;
+    }
+
+    journal_name(JOURNAL_SWITCH, name);
+
+    WorldFork* fork = *found;
+    *found = fork->next;
+
+    fork_add(current_fork ? current_fork : strdup("main"), world);
+    world = fork->world;
+    current_fork = fork->name;
+    free(fork);
+}
+
+void command_drop(char* name)
+{
+    WorldFork** found = fork_find(name);
+    if (*found == NULL)
+    {
+        if (strcmp(name, current_fork ? current_fork : "main") == 0)
+            repl_print_error("Cannot drop the fork currently in use\n");
+        else
+            repl_print_error("Unknown fork '%s'\n", name);
+        return;
+    }
+
+    journal_name(JOURNAL_DROP, name);
+
+    WorldFork* fork = *found;
+    *found = fork->next;
+    snapshot_forget(fork->world);
+    query_remove_world(fork->world);
+    world_free(fork->world);
+    free(fork->name);
+    free(fork);
+}
+
+void command_save(char* path)
+{
+    if (snapshot_save(world, path, false))
+        journal_reset();
+}
+
+void command_save_mode(char* mode, char* path)
+{
+    if (strcasecmp(mode, "INCREMENTAL") == 0)
+    {
+        if (snapshot_save(world, path, true))
+            journal_reset();
+    }
+    else if (strcasecmp(mode, "BACKGROUND") == 0)
+    {
+        snapshot_save_background(world, path);
+    }
+    else
+    {
+        repl_print_error("Unknown save mode '%s'\n", mode);
+    }
+}
+
+void command_compact(char* path)
+{
+    snapshot_compact(world, path);
+}
+
+void command_watch(Region* region, char* field)
+{
+    repl_print("%u\n", watch_add(region, field, repl_client()));
+}
+
+void command_unwatch(int id)
+{
+    if (id <= 0 || !watch_remove(id, repl_client()))
+        repl_print_error("Unknown watch %d\n", id);
+}
+
+void command_unwatch_all(void)
+{
+    watch_remove_owner(repl_client());
+}
+
+void command_mirror_list(void)
+{
+    mirror_print_list();
+}
+
+void command_mirror(Region* region, char* field, char* path)
+{
+    unsigned int id = mirror_add(world, region, field, path);
+    if (id != 0)
+        repl_print("%u\n", id);
+}
+
+void command_unmirror(int id)
+{
+    if (id <= 0 || !mirror_remove(id))
+        repl_print_error("Unknown mirror %d\n", id);
+}
+
+void command_cleanup(void)
+{
+    while (forks != NULL)
+    {
+        WorldFork* fork = forks;
+        forks = fork->next;
+        world_free(fork->world);
+        free(fork->name);
+        free(fork);
+    }
+
+    free(current_fork);
+    current_fork = NULL;
+}
+
 void command_error(const char* message)
 {
     repl_print_error("%s\n", message);
@@ -52,16 +52,44 @@ void command_args_append(CommandArgs* args, char* name, char* value);
 
 void command_ping(void);
 void command_status(void);
+void command_status_show(char* section);
+void command_hash(void);
+void command_hash_check(char* mode);
+void command_profile(char* profiler, char* action, char* path, int interval);
+void command_metrics(char* action, char* path);
+void command_trace(char* action, char* path, int events);
 void command_node_get(Region* region);
+void command_node_read(World* view, Region* region);
 void command_node_set(Region* region, char* type, CommandArgs* fields);
 void command_field_get(Region* region, char* name);
+void command_field_read(World* view, Region* region, char* name);
 void command_field_set(Region* region, char* name, char* value);
+void command_node_page(Region* region, char* option, int limit, bool sparse);
+void command_field_page(Region* region, char* name, char* option, int limit, bool sparse);
+void command_nodes_get(Region* region);
+void command_fields_get(Region* region, char* name);
+void command_next(int id);
 void command_delete(Region* region);
+void command_generate(Region* region, char* pattern, CommandArgs* options);
 void command_plot(Region* region, char* field);
 void command_tick(int count, LogLevel log_level);
 void command_message(void);
 void command_type_list(void);
 void command_type_show(char* name);
+void command_fork_list(void);
+void command_fork(char* name);
+void command_switch(char* name);
+void command_drop(char* name);
+void command_save(char* path);
+void command_save_mode(char* mode, char* path);
+void command_compact(char* path);
+void command_watch(Region* region, char* field);
+void command_unwatch(int id);
+void command_unwatch_all(void);
+void command_mirror_list(void);
+void command_mirror(Region* region, char* field, char* path);
+void command_unmirror(int id);
+void command_cleanup(void);
 
 void command_error(const char* message);
 
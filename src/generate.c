@@ -0,0 +1,458 @@
+/* generate.c - Procedural world generation
+ *
+ * Copyright (C) 2014 Ryan Mendivil <ryan@nullreff.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redpile nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "generate.h"
+#include "repl.h"
+#include <stdint.h>
+#include <strings.h>
+
+// Builds parametric scenes straight into the world for GENERATE, skipping
+// the parser and the per-command overhead of NODE and FIELD.  Everything is
+// derived from the region and the options so running the same command again
+// (or replaying it from the journal) builds exactly the same world.
+//
+// MESH and SOUP fill the region, SCATTER picks locations inside of it and
+// CLOCKS and ADDER place one copy of their circuit at every location in it, so
+// the step of each range decides how far apart they are.
+
+#define ADDER_WIDTH 6
+#define ADDER_MAX_BITS 31
+
+typedef struct {
+    int spacing;
+    int bits;
+    int a;
+    int b;
+    int count;
+    int density;
+    int seed;
+    char* type;
+    char* field;
+} GenerateOptions;
+
+typedef struct {
+    const char* name;
+    const char* options[4];
+    bool (*run)(World* world, Region* region, GenerateOptions* options);
+} Pattern;
+
+typedef enum {
+    PART_CONDUCTOR,
+    PART_TORCH,
+    PART_SWITCH_A,
+    PART_SWITCH_B
+} PartKind;
+
+typedef struct {
+    PartKind kind;
+    int x;
+    int y;
+    int z;
+    Direction direction;
+} Part;
+
+// One bit of a ripple-carry adder built out of NOR gates, each a conductor
+// powered by the torches next to it with torches of its own as outputs.  The
+// inputs are switches at 0,0,4 (a) and 0,1,5 (b), the sum is the power of the
+// conductor at 0,3,0 and the carry is passed through three inverters into the
+// next bit, which starts six blocks along x.  The last three parts are that
+// carry chain.  See docs/commands.md for the timing.
+static Part adder_parts[] = {
+    {PART_TORCH,     0, 2, 0, NORTH},
+    {PART_CONDUCTOR, 0, 3, 0, NORTH},
+    {PART_TORCH,     1, 3, 0, NORTH},
+    {PART_CONDUCTOR, 0, 2, 1, NORTH},
+    {PART_TORCH,     1, 2, 1, NORTH},
+    {PART_CONDUCTOR, 1, 3, 1, NORTH},
+    {PART_TORCH,     0, 2, 2, NORTH},
+    {PART_CONDUCTOR, 1, 2, 2, NORTH},
+    {PART_TORCH,     2, 2, 2, EAST},
+    {PART_TORCH,     1, 3, 2, NORTH},
+    {PART_TORCH,     1, 0, 3, NORTH},
+    {PART_TORCH,     0, 1, 3, WEST},
+    {PART_CONDUCTOR, 1, 1, 3, NORTH},
+    {PART_TORCH,     2, 1, 3, NORTH},
+    {PART_CONDUCTOR, 0, 2, 3, NORTH},
+    {PART_CONDUCTOR, 2, 2, 3, NORTH},
+    {PART_CONDUCTOR, 1, 3, 3, NORTH},
+    {PART_SWITCH_A,  0, 0, 4, WEST},
+    {PART_CONDUCTOR, 1, 0, 4, NORTH},
+    {PART_TORCH,     2, 0, 4, EAST},
+    {PART_CONDUCTOR, 2, 1, 4, NORTH},
+    {PART_TORCH,     0, 2, 4, WEST},
+    {PART_CONDUCTOR, 1, 2, 4, NORTH},
+    {PART_TORCH,     2, 2, 4, UP},
+    {PART_SWITCH_B,  0, 1, 5, WEST},
+    {PART_CONDUCTOR, 1, 1, 5, NORTH},
+    {PART_TORCH,     2, 1, 5, EAST},
+    {PART_TORCH,     1, 2, 5, UP},
+    {PART_TORCH,     3, 2, 3, EAST},
+    {PART_CONDUCTOR, 4, 2, 3, NORTH},
+    {PART_TORCH,     4, 3, 3, UP},
+    {PART_CONDUCTOR, 5, 3, 3, NORTH},
+    {PART_TORCH,     5, 4, 3, UP},
+    {PART_CONDUCTOR, 6, 4, 3, NORTH},
+    {PART_TORCH,     7, 4, 3, EAST}
+};
+
+// SplitMix64, small and good enough to spread nodes around
+static uint64_t generate_random(uint64_t* state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static Range range_normalize(Range range)
+{
+    if (range.start > range.end)
+        return range_create(range.end, range.start, abs(range.step));
+    return range_create(range.start, range.end, abs(range.step));
+}
+
+static Region region_normalize(Region* region)
+{
+    return (Region){
+        range_normalize(region->x),
+        range_normalize(region->y),
+        range_normalize(region->z)
+    };
+}
+
+static int range_pick(Range range, uint64_t* random)
+{
+    unsigned int count = (range.end - range.start) / range.step + 1;
+    return range.start + (int)(generate_random(random) % count) * range.step;
+}
+
+static bool generate_type(World* world, const char* name, Type** type)
+{
+    *type = type_data_find_type(world->type_data, name);
+    if (*type != NULL)
+        return true;
+
+    repl_print_error("Unknown type '%s'\n", name);
+    return false;
+}
+
+static bool generate_field(Type* type, const char* name, unsigned int* index)
+{
+    Field* field = type_find_field(type, name, index);
+    if (field != NULL && field->type != FIELD_STRING)
+        return true;
+
+    repl_print_error("The type '%s' doesn't have the field '%s'\n", type->name, name);
+    return false;
+}
+
+static void generate_set(World* world, Location location, Type* type, unsigned int index, int value)
+{
+    Node node;
+    world_set_node(world, location, type, &node);
+    if (index != UINT_MAX)
+    {
+        world_hash_node(world, &node);
+        FIELD_SET(&node, index, integer, value);
+        world_hash_node(world, &node);
+    }
+}
+
+struct generate_fill_args {
+    Type* type;
+    unsigned int index;
+    int value;
+    int density;
+    uint64_t random;
+};
+
+static void generate_fill_callback(UNUSED Location location, Node* node, void* args)
+{
+    struct generate_fill_args* fill = args;
+    node->data->type = fill->type;
+
+    if (fill->density >= 0)
+        FIELD_SET(node, fill->index, integer, (int)(generate_random(&fill->random) % 100) < fill->density);
+    else if (fill->index != UINT_MAX)
+        FIELD_SET(node, fill->index, integer, fill->value);
+}
+
+// A wire in every location of the region with a torch pointing up every
+// `spacing` wires along x and z, the same as scripts/grid.sh used to build
+static bool generate_mesh(World* world, Region* region, GenerateOptions* options)
+{
+    Type* wire;
+    Type* torch;
+    unsigned int direction;
+    if (!generate_type(world, "WIRE", &wire) ||
+        !generate_type(world, "TORCH", &torch) ||
+        !generate_field(torch, "direction", &direction))
+        return false;
+
+    Region torches = region_normalize(region);
+    torches.x.step *= options->spacing;
+    torches.z.step *= options->spacing;
+
+    struct generate_fill_args args = {wire, UINT_MAX, 0, -1, 0};
+    world_set_region(world, region, generate_fill_callback, &args);
+
+    args = (struct generate_fill_args){torch, direction, UP, -1, 0};
+    world_set_region(world, &torches, generate_fill_callback, &args);
+    return true;
+}
+
+// Three torches and a wire that invert each other in a loop, so every node
+// changes on every tick.  Each one takes up two blocks along x and z.
+static bool generate_clocks(World* world, Region* region, UNUSED GenerateOptions* options)
+{
+    Type* wire;
+    Type* torch;
+    unsigned int direction;
+    if (!generate_type(world, "WIRE", &wire) ||
+        !generate_type(world, "TORCH", &torch) ||
+        !generate_field(torch, "direction", &direction))
+        return false;
+
+    Region origins = region_normalize(region);
+    for (int x = origins.x.start; x <= origins.x.end; x += origins.x.step)
+    for (int y = origins.y.start; y <= origins.y.end; y += origins.y.step)
+    for (int z = origins.z.start; z <= origins.z.end; z += origins.z.step)
+    {
+        generate_set(world, location_create(x, y, z), torch, direction, NORTH);
+        generate_set(world, location_create(x + 1, y, z), torch, direction, EAST);
+        generate_set(world, location_create(x + 1, y, z + 1), torch, direction, SOUTH);
+        generate_set(world, location_create(x, y, z + 1), wire, UINT_MAX, 0);
+    }
+
+    return true;
+}
+
+static bool generate_adder(World* world, Region* region, GenerateOptions* options)
+{
+    Type* conductor;
+    Type* torch;
+    Type* toggle;
+    unsigned int direction;
+    unsigned int toggle_direction;
+    unsigned int state;
+    if (!generate_type(world, "CONDUCTOR", &conductor) ||
+        !generate_type(world, "TORCH", &torch) ||
+        !generate_type(world, "SWITCH", &toggle) ||
+        !generate_field(torch, "direction", &direction) ||
+        !generate_field(toggle, "direction", &toggle_direction) ||
+        !generate_field(toggle, "state", &state))
+        return false;
+
+    Region origins = region_normalize(region);
+    for (int x = origins.x.start; x <= origins.x.end; x += origins.x.step)
+    for (int y = origins.y.start; y <= origins.y.end; y += origins.y.step)
+    for (int z = origins.z.start; z <= origins.z.end; z += origins.z.step)
+    for (int bit = 0; bit < options->bits; bit++)
+    {
+        for (unsigned int i = 0; i < sizeof(adder_parts) / sizeof(Part); i++)
+        {
+            Part* part = &adder_parts[i];
+            Location location = location_create(x + bit * ADDER_WIDTH + part->x, y + part->y, z + part->z);
+            Node node;
+
+            switch (part->kind)
+            {
+                case PART_CONDUCTOR:
+                    generate_set(world, location, conductor, UINT_MAX, 0);
+                    break;
+
+                case PART_TORCH:
+                    generate_set(world, location, torch, direction, part->direction);
+                    break;
+
+                case PART_SWITCH_A:
+                case PART_SWITCH_B: {
+                    int input = part->kind == PART_SWITCH_A ? options->a : options->b;
+                    world_set_node(world, location, toggle, &node);
+                    world_hash_node(world, &node);
+                    FIELD_SET(&node, toggle_direction, integer, part->direction);
+                    FIELD_SET(&node, state, integer, (input >> bit) & 1);
+                    world_hash_node(world, &node);
+                } break;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Up to `count` nodes at random locations in the region, fewer if the same
+// location comes up twice
+static bool generate_scatter(World* world, Region* region, GenerateOptions* options)
+{
+    Type* type;
+    if (!generate_type(world, options->type, &type))
+        return false;
+
+    Region area = region_normalize(region);
+    uint64_t random = options->seed;
+    for (int i = 0; i < options->count; i++)
+    {
+        Location location = location_create(
+            range_pick(area.x, &random),
+            range_pick(area.y, &random),
+            range_pick(area.z, &random)
+        );
+        generate_set(world, location, type, UINT_MAX, 0);
+    }
+
+    return true;
+}
+
+// Fills the region and sets `field` to 1 in `density` percent of it, for
+// starting conf/gameoflife.lua off with a random soup of live cells
+static bool generate_soup(World* world, Region* region, GenerateOptions* options)
+{
+    Type* type;
+    unsigned int index;
+    if (!generate_type(world, options->type, &type) ||
+        !generate_field(type, options->field, &index))
+        return false;
+
+    struct generate_fill_args args = {type, index, 0, options->density, options->seed};
+    world_set_region(world, region, generate_fill_callback, &args);
+    return true;
+}
+
+static Pattern patterns[] = {
+    {"MESH",    {"spacing"},                    generate_mesh},
+    {"CLOCKS",  {NULL},                         generate_clocks},
+    {"ADDER",   {"bits", "a", "b"},             generate_adder},
+    {"SCATTER", {"count", "type", "seed"},      generate_scatter},
+    {"SOUP",    {"type", "field", "density", "seed"}, generate_soup}
+};
+
+static Pattern* pattern_find(const char* name)
+{
+    for (unsigned int i = 0; i < sizeof(patterns) / sizeof(Pattern); i++)
+    {
+        if (strcasecmp(patterns[i].name, name) == 0)
+            return &patterns[i];
+    }
+    return NULL;
+}
+
+static bool pattern_has_option(Pattern* pattern, const char* name)
+{
+    for (unsigned int i = 0; i < 4 && pattern->options[i] != NULL; i++)
+    {
+        if (strcasecmp(pattern->options[i], name) == 0)
+            return true;
+    }
+    return false;
+}
+
+static bool option_integer(const char* value, int min, int max, int* result)
+{
+    char* end;
+    long parsed = strtol(value, &end, 10);
+    if (*value == '\0' || *end != '\0')
+    {
+        repl_print_error("'%s' is not an integer\n", value);
+        return false;
+    }
+
+    if (parsed < min || parsed > max)
+    {
+        repl_print_error("'%s' must be between %d and %d\n", value, min, max);
+        return false;
+    }
+
+    *result = parsed;
+    return true;
+}
+
+static bool options_parse(Pattern* pattern, Region* region, CommandArgs* args, GenerateOptions* options)
+{
+    int area = region_area(region);
+    *options = (GenerateOptions){10, 8, 0, 0, MAX(area / 100, 1), 50, 0, "WIRE", "alive"};
+    if (strcmp(pattern->name, "SOUP") == 0)
+        options->type = "CELL";
+
+    for (unsigned int i = 0; i < args->index; i++)
+    {
+        char* name = args->data[i].name;
+        char* value = args->data[i].value;
+        bool valid = true;
+
+        if (!pattern_has_option(pattern, name))
+        {
+            repl_print_error("Unknown option '%s' for %s\n", name, pattern->name);
+            return false;
+        }
+
+        if (strcasecmp(name, "spacing") == 0)
+            valid = option_integer(value, 1, INT_MAX, &options->spacing);
+        else if (strcasecmp(name, "bits") == 0)
+            valid = option_integer(value, 1, ADDER_MAX_BITS, &options->bits);
+        else if (strcasecmp(name, "a") == 0)
+            valid = option_integer(value, 0, INT_MAX, &options->a);
+        else if (strcasecmp(name, "b") == 0)
+            valid = option_integer(value, 0, INT_MAX, &options->b);
+        else if (strcasecmp(name, "count") == 0)
+            valid = option_integer(value, 0, INT_MAX, &options->count);
+        else if (strcasecmp(name, "density") == 0)
+            valid = option_integer(value, 0, 100, &options->density);
+        else if (strcasecmp(name, "seed") == 0)
+            valid = option_integer(value, 0, INT_MAX, &options->seed);
+        else if (strcasecmp(name, "type") == 0)
+            options->type = value;
+        else if (strcasecmp(name, "field") == 0)
+            options->field = value;
+
+        if (!valid)
+            return false;
+    }
+
+    return true;
+}
+
+// Prints an error and leaves the world untouched if the pattern, an option or
+// a type it needs doesn't exist
+bool generate_run(World* world, Region* region, const char* name, CommandArgs* args)
+{
+    Pattern* pattern = pattern_find(name);
+    if (pattern == NULL)
+    {
+        repl_print_error("Unknown pattern '%s'\n", name);
+        return false;
+    }
+
+    GenerateOptions options;
+    if (!options_parse(pattern, region, args, &options))
+        return false;
+
+    return pattern->run(world, region, &options);
+}
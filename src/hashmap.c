@@ -29,6 +29,7 @@
  */
 
 #include "hashmap.h"
+#include "memory.h"
 
 static Bucket bucket_empty(void)
 {
@@ -39,7 +40,7 @@ static Bucket* hashmap_add_next(Hashmap* hashmap, Bucket* bucket)
 {
     hashmap->overflow++;
     hashmap->count++;
-    Bucket* new_bucket = malloc(sizeof(Bucket));
+    Bucket* new_bucket = memory_malloc(MEMORY_HASHMAPS, sizeof(Bucket));
     CHECK_OOM(new_bucket);
     *new_bucket = bucket_empty();
     bucket->next = new_bucket;
@@ -55,7 +56,7 @@ Hashmap* hashmap_init(Hashmap* hashmap, unsigned int size)
     hashmap->overflow = 0;
     hashmap->resizes = 0;
     hashmap->max_depth = 0;
-    hashmap->data = calloc(1, size * sizeof(Bucket));
+    hashmap->data = memory_calloc(MEMORY_HASHMAPS, 1, size * sizeof(Bucket));
     CHECK_OOM(hashmap->data);
 
     return hashmap;
@@ -75,12 +76,26 @@ void hashmap_free(Hashmap* hashmap, void (*free_values)(void* value))
             Bucket* temp = current->next;
             if (free_values)
                 free_values(current->value);
-            free(current);
+            memory_free(MEMORY_HASHMAPS, current);
             current = temp;
         }
     }
 
-    free(hashmap->data);
+    memory_free(MEMORY_HASHMAPS, hashmap->data);
+}
+
+Hashmap* hashmap_copy(Hashmap* hashmap, Hashmap* source)
+{
+    hashmap_init(hashmap, source->size);
+    hashmap->min_size = source->min_size;
+
+    Location key;
+    void* value;
+    Cursor cursor = hashmap_get_iterator(source);
+    while (cursor_next(&cursor, &key, &value))
+        hashmap_get(hashmap, key, true)->value = value;
+
+    return hashmap;
 }
 
 void hashmap_resize(Hashmap* hashmap, unsigned int new_size)
@@ -145,7 +160,9 @@ Bucket* hashmap_get(Hashmap* hashmap, Location key, bool create)
         }
     }
 
-    if (hashmap->max_depth < depth)
+    // Lookups can come from several reader threads at once, so only
+    // writers update the stats
+    if (create && hashmap->max_depth < depth)
         hashmap->max_depth = depth;
 
     return bucket;
@@ -182,14 +199,14 @@ void* hashmap_remove(Hashmap* hashmap, Location key)
     if (last_bucket != NULL)
     {
         last_bucket->next = bucket->next;
-        free(bucket);
+        memory_free(MEMORY_HASHMAPS, bucket);
         hashmap->overflow--;
     }
     else if (bucket->next != NULL)
     {
         last_bucket = bucket->next;
         memcpy(bucket, bucket->next, sizeof(Bucket));
-        free(last_bucket);
+        memory_free(MEMORY_HASHMAPS, last_bucket);
         hashmap->overflow--;
     }
     else
@@ -70,6 +70,7 @@ typedef struct {
 
 Hashmap* hashmap_init(Hashmap* hashmap, unsigned int size);
 void hashmap_free(Hashmap* hashmap, void (*free_values)(void* value));
+Hashmap* hashmap_copy(Hashmap* hashmap, Hashmap* source);
 Bucket* hashmap_get(Hashmap* hashmap, Location key, bool create);
 void* hashmap_remove(Hashmap* hashmap, Location key);
 Cursor hashmap_get_iterator(Hashmap* map);
@@ -0,0 +1,646 @@
+/* journal.c - Write-ahead journal of mutating commands
+ *
+ * Copyright (C) 2014 Ryan Mendivil <ryan@nullreff.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redpile nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "journal.h"
+#include "redpile.h"
+#include "repl.h"
+#include "generate.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+
+// The journal is an append only log of every command that modifies the
+// world.  Records are buffered in memory and written out together (group
+// commit) once the buffer fills up, the oldest buffered record is older than
+// the sync interval or the repl runs out of input to process.
+//
+// On startup any existing journal is replayed straight through the world_*
+// functions, skipping the parser entirely, on top of the snapshot passed
+// with --load.  Saving a snapshot empties the journal.  A partially written record at
+// the end of the file (from a crash mid write) is discarded.
+//
+// Layout:
+//   magic   "RPJ1"
+//   record  [op:u8][length:u32][payload][checksum:u32]
+//
+// Payloads are made up of regions (nine int32s), integers (uint32) and
+// strings (uint32 length, the bytes and a null terminator).  Everything is
+// stored in host byte order since a journal is only read back by the
+// machine that wrote it.
+
+#define JOURNAL_MAGIC "RPJ1"
+#define JOURNAL_MAGIC_SIZE 4
+#define RECORD_HEADER_SIZE 5
+#define RECORD_CHECKSUM_SIZE 4
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+// Records kept in memory while writes to the journal keep failing
+#define JOURNAL_MAX_PENDING (64 * 1024 * 1024)
+
+typedef struct {
+    unsigned char* data;
+    size_t size;
+    size_t index;
+} JournalBuffer;
+
+static int journal_fd = -1;
+static char* journal_path = NULL;
+static JournalBuffer pending = {NULL, 0, 0};
+static size_t record_start;
+static long long oldest_pending;
+static unsigned int sync_interval;
+static size_t sync_size;
+static bool replaying = false;
+
+static long long get_time(void)
+{
+    struct timespec value;
+    clock_gettime(CLOCK_MONOTONIC, &value);
+    return ((long long)value.tv_sec) * 1000 + value.tv_nsec / 1000000;
+}
+
+static uint32_t journal_checksum(uint32_t hash, const unsigned char* data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static void journal_write(const void* data, size_t size)
+{
+    if (pending.index + size > pending.size)
+    {
+        while (pending.index + size > pending.size)
+            pending.size *= 2;
+
+        pending.data = realloc(pending.data, pending.size);
+        CHECK_OOM(pending.data);
+    }
+
+    memcpy(pending.data + pending.index, data, size);
+    pending.index += size;
+}
+
+static void journal_put_int(uint32_t value)
+{
+    journal_write(&value, sizeof(uint32_t));
+}
+
+static void journal_put_string(const char* string)
+{
+    uint32_t length = strlen(string);
+    journal_put_int(length);
+    journal_write(string, length + 1);
+}
+
+static void journal_put_region(Region* region)
+{
+    Range* ranges[] = {&region->x, &region->y, &region->z};
+    for (int i = 0; i < 3; i++)
+    {
+        journal_put_int(ranges[i]->start);
+        journal_put_int(ranges[i]->end);
+        journal_put_int(ranges[i]->step);
+    }
+}
+
+static bool journal_begin(JournalOp op)
+{
+    if (journal_fd == -1 || replaying)
+        return false;
+
+    if (pending.index == 0)
+        oldest_pending = get_time();
+
+    unsigned char header[RECORD_HEADER_SIZE] = {op};
+    record_start = pending.index;
+    journal_write(header, RECORD_HEADER_SIZE);
+    return true;
+}
+
+static void journal_end(void)
+{
+    uint32_t length = pending.index - record_start - RECORD_HEADER_SIZE;
+    memcpy(pending.data + record_start + 1, &length, sizeof(uint32_t));
+
+    uint32_t checksum = journal_checksum(FNV_OFFSET, pending.data + record_start, pending.index - record_start);
+    journal_put_int(checksum);
+
+    if (pending.index >= sync_size || get_time() - oldest_pending >= sync_interval)
+        journal_flush();
+}
+
+void journal_flush(void)
+{
+    if (journal_fd == -1 || pending.index == 0)
+        return;
+
+    size_t written = 0;
+    while (written < pending.index)
+    {
+        ssize_t result = write(journal_fd, pending.data + written, pending.index - written);
+        if (result == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            WARN("Trouble writing to the journal: %s\n", strerror(errno));
+            break;
+        }
+        written += result;
+    }
+
+    // Whatever reached the file is dropped so the next flush carries on
+    // from the middle of the record it stopped in
+    if (written < pending.index)
+    {
+        memmove(pending.data, pending.data + written, pending.index - written);
+        pending.index -= written;
+
+        if (pending.index > JOURNAL_MAX_PENDING)
+        {
+            WARN("The journal is %zu bytes behind, no longer journaling changes\n", pending.index);
+            close(journal_fd);
+            journal_fd = -1;
+            pending.index = 0;
+        }
+        return;
+    }
+
+    WARN_IF(fdatasync(journal_fd) == -1, "Trouble syncing the journal: %s\n", strerror(errno));
+    pending.index = 0;
+}
+
+// Called after the world has been saved to a snapshot.  Everything in the
+// journal is part of the snapshot now so it can start over.
+void journal_reset(void)
+{
+    if (journal_fd == -1)
+        return;
+
+    pending.index = 0;
+    if (ftruncate(journal_fd, 0) == -1)
+    {
+        WARN("Trouble truncating the journal: %s\n", strerror(errno));
+        return;
+    }
+
+    journal_write(JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE);
+    journal_flush();
+}
+
+// Returns the current end of the journal so the records before it can be
+// discarded once a background snapshot containing them has been written.
+long journal_mark(void)
+{
+    if (journal_fd == -1)
+        return -1;
+
+    journal_flush();
+    return lseek(journal_fd, 0, SEEK_END);
+}
+
+// Rewrites the journal with only the records after `offset`
+void journal_discard(long offset)
+{
+    if (journal_fd == -1 || offset <= JOURNAL_MAGIC_SIZE)
+        return;
+
+    journal_flush();
+
+    size_t temp_size = strlen(journal_path) + 5;
+    char* temp_path = malloc(temp_size);
+    CHECK_OOM(temp_path);
+    snprintf(temp_path, temp_size, "%s.tmp", journal_path);
+
+    FILE* in = fopen(journal_path, "rb");
+    FILE* out = fopen(temp_path, "wb");
+    bool failed = in == NULL || out == NULL || fseek(in, offset, SEEK_SET) != 0;
+
+    if (!failed)
+    {
+        char buffer[BUFSIZ];
+        size_t size;
+        fwrite(JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE, 1, out);
+        while ((size = fread(buffer, 1, BUFSIZ, in)) > 0)
+            fwrite(buffer, 1, size, out);
+
+        failed = ferror(in) || fflush(out) != 0 || ferror(out) || fsync(fileno(out)) != 0;
+    }
+
+    if (in != NULL)
+        fclose(in);
+    if (out != NULL)
+        failed = fclose(out) != 0 || failed;
+
+    if (failed || rename(temp_path, journal_path) != 0)
+    {
+        WARN("Trouble discarding saved records from the journal: %s\n", strerror(errno));
+        unlink(temp_path);
+    }
+    else
+    {
+        close(journal_fd);
+        journal_fd = open(journal_path, O_WRONLY | O_APPEND);
+        WARN_IF(journal_fd == -1, "Unable to reopen the journal '%s': %s\n", journal_path, strerror(errno));
+    }
+
+    free(temp_path);
+}
+
+bool journal_pending(void)
+{
+    return pending.index > 0;
+}
+
+static void journal_put_args(CommandArgs* args)
+{
+    journal_put_int(args->index);
+    for (unsigned int i = 0; i < args->index; i++)
+    {
+        journal_put_string(args->data[i].name);
+        journal_put_string(args->data[i].value);
+    }
+}
+
+void journal_node(Region* region, char* type, CommandArgs* fields)
+{
+    if (!journal_begin(JOURNAL_NODE))
+        return;
+
+    journal_put_region(region);
+    journal_put_string(type);
+    journal_put_args(fields);
+    journal_end();
+}
+
+void journal_field(Region* region, char* name, char* value)
+{
+    if (!journal_begin(JOURNAL_FIELD))
+        return;
+
+    journal_put_region(region);
+    journal_put_string(name);
+    journal_put_string(value);
+    journal_end();
+}
+
+void journal_delete(Region* region)
+{
+    if (!journal_begin(JOURNAL_DELETE))
+        return;
+
+    journal_put_region(region);
+    journal_end();
+}
+
+void journal_tick(unsigned int count)
+{
+    if (!journal_begin(JOURNAL_TICK))
+        return;
+
+    journal_put_int(count);
+    journal_end();
+}
+
+// Only the command is stored, replaying it builds the same world again
+void journal_generate(Region* region, char* pattern, CommandArgs* options)
+{
+    if (!journal_begin(JOURNAL_GENERATE))
+        return;
+
+    journal_put_region(region);
+    journal_put_string(pattern);
+    journal_put_args(options);
+    journal_end();
+}
+
+void journal_name(JournalOp op, char* name)
+{
+    if (!journal_begin(op))
+        return;
+
+    journal_put_string(name);
+    journal_end();
+}
+
+// Replay
+
+typedef struct {
+    unsigned char* data;
+    size_t size;
+    size_t index;
+    bool valid;
+} JournalReader;
+
+static uint32_t journal_get_int(JournalReader* reader)
+{
+    uint32_t value = 0;
+    if (reader->index + sizeof(uint32_t) > reader->size)
+    {
+        reader->valid = false;
+        return value;
+    }
+
+    memcpy(&value, reader->data + reader->index, sizeof(uint32_t));
+    reader->index += sizeof(uint32_t);
+    return value;
+}
+
+static char* journal_get_string(JournalReader* reader)
+{
+    uint32_t length = journal_get_int(reader);
+    if (!reader->valid || reader->index + length + 1 > reader->size)
+    {
+        reader->valid = false;
+        return "";
+    }
+
+    char* string = (char*)reader->data + reader->index;
+    reader->index += length + 1;
+    return string;
+}
+
+static void journal_get_region(JournalReader* reader, Region* region)
+{
+    Range* ranges[] = {&region->x, &region->y, &region->z};
+    for (int i = 0; i < 3; i++)
+    {
+        ranges[i]->start = (int)journal_get_int(reader);
+        ranges[i]->end = (int)journal_get_int(reader);
+        ranges[i]->step = (int)journal_get_int(reader);
+    }
+}
+
+static void journal_replay_field(Node* node, char* name, char* value)
+{
+    unsigned int index;
+    Field* field = type_find_field(node->data->type, name, &index);
+    if (field)
+        node_field_parse(node, field, index, value);
+}
+
+struct journal_node_args {
+    Type* type;
+    CommandArgs* fields;
+};
+
+static void journal_node_callback(UNUSED Location location, Node* node, void* args)
+{
+    struct journal_node_args* data = (struct journal_node_args*)args;
+    node->data->type = data->type;
+
+    for (unsigned int i = 0; i < data->fields->index; i++)
+        journal_replay_field(node, data->fields->data[i].name, data->fields->data[i].value);
+}
+
+static void journal_field_callback(UNUSED Location location, Node* node, void* args)
+{
+    CommandArg* arg = (CommandArg*)args;
+    if (!NODE_IS_EMPTY(node) && node->data->type)
+        journal_replay_field(node, arg->name, arg->value);
+}
+
+// Reads the name:value pairs written by journal_put_args
+static CommandArgs* journal_get_args(JournalReader* reader)
+{
+    uint32_t count = journal_get_int(reader);
+    if (!reader->valid || count > reader->size)
+        return NULL;
+
+    CommandArgs* args = command_args_allocate(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        char* name = journal_get_string(reader);
+        char* value = journal_get_string(reader);
+        command_args_append(args, name, value);
+    }
+    return args;
+}
+
+static void journal_replay_node(JournalReader* reader)
+{
+    Region region;
+    journal_get_region(reader, &region);
+    char* type_name = journal_get_string(reader);
+    CommandArgs* fields = journal_get_args(reader);
+    if (fields == NULL)
+        return;
+
+    Type* type = type_data_find_type(world->type_data, type_name);
+    if (reader->valid && type != NULL)
+    {
+        struct journal_node_args args = {type, fields};
+        world_set_region(world, &region, journal_node_callback, &args);
+    }
+
+    // The names and values point into the record so they aren't freed here
+    free(fields);
+}
+
+static void journal_replay_record(JournalOp op, JournalReader* reader)
+{
+    Region region;
+    switch (op)
+    {
+        case JOURNAL_NODE:
+            journal_replay_node(reader);
+            break;
+
+        case JOURNAL_FIELD: {
+            journal_get_region(reader, &region);
+            CommandArg arg;
+            arg.name = journal_get_string(reader);
+            arg.value = journal_get_string(reader);
+            if (reader->valid)
+                world_edit_region(world, &region, journal_field_callback, &arg);
+        } break;
+
+        case JOURNAL_DELETE:
+            journal_get_region(reader, &region);
+            if (reader->valid)
+                world_delete_region(world, &region);
+            break;
+
+        case JOURNAL_TICK: {
+            uint32_t count = journal_get_int(reader);
+            if (reader->valid)
+                tick_run(state, world, count, LOG_QUIET);
+        } break;
+
+        case JOURNAL_FORK:
+            command_fork(journal_get_string(reader));
+            break;
+
+        case JOURNAL_SWITCH:
+            command_switch(journal_get_string(reader));
+            break;
+
+        case JOURNAL_DROP:
+            command_drop(journal_get_string(reader));
+            break;
+
+        case JOURNAL_GENERATE: {
+            journal_get_region(reader, &region);
+            char* pattern = journal_get_string(reader);
+            CommandArgs* options = journal_get_args(reader);
+            if (options == NULL)
+                break;
+
+            if (reader->valid)
+                generate_run(world, &region, pattern, options);
+            free(options);
+        } break;
+    }
+}
+
+// Applies every complete record in the journal and returns the offset of the
+// end of the last one.
+static long journal_replay(FILE* file, const char* path)
+{
+    char magic[JOURNAL_MAGIC_SIZE];
+    if (fread(magic, 1, JOURNAL_MAGIC_SIZE, file) != JOURNAL_MAGIC_SIZE)
+        return 0;
+
+    ERROR_IF(memcmp(magic, JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE) != 0,
+             "The file '%s' is not a redpile journal\n", path);
+
+    // Lengths are checked against the rest of the file so a garbled record
+    // at the end is treated as the end instead of a huge allocation
+    struct stat info;
+    ERROR_IF(fstat(fileno(file), &info) == -1, "Unable to read the journal '%s': %s\n", path, strerror(errno));
+
+    JournalReader reader = {NULL, 0, 0, true};
+    size_t capacity = 0;
+    long valid = JOURNAL_MAGIC_SIZE;
+
+    replaying = true;
+    repl_mute(true);
+
+    unsigned char header[RECORD_HEADER_SIZE];
+    while (fread(header, 1, RECORD_HEADER_SIZE, file) == RECORD_HEADER_SIZE)
+    {
+        uint32_t length;
+        memcpy(&length, header + 1, sizeof(uint32_t));
+
+        long remaining = (long)info.st_size - ftell(file) - RECORD_CHECKSUM_SIZE;
+        if (remaining < 0 || length > (unsigned long)remaining)
+            break;
+
+        if (length > capacity)
+        {
+            capacity = length;
+            reader.data = realloc(reader.data, capacity);
+            CHECK_OOM(reader.data);
+        }
+
+        uint32_t checksum;
+        if (fread(reader.data, 1, length, file) != length ||
+            fread(&checksum, 1, sizeof(uint32_t), file) != sizeof(uint32_t))
+            break;
+
+        uint32_t expected = journal_checksum(FNV_OFFSET, header, RECORD_HEADER_SIZE);
+        if (journal_checksum(expected, reader.data, length) != checksum)
+            break;
+
+        reader.size = length;
+        reader.index = 0;
+        reader.valid = true;
+        journal_replay_record(header[0], &reader);
+        valid = ftell(file);
+    }
+
+    repl_mute(false);
+    replaying = false;
+    free(reader.data);
+
+    return valid;
+}
+
+void journal_open(const char* path, unsigned int interval, unsigned int buffer_size)
+{
+    sync_interval = interval;
+    sync_size = buffer_size;
+    journal_path = strdup(path);
+
+    pending.size = MAX(buffer_size, 64u);
+    pending.index = 0;
+    pending.data = malloc(pending.size);
+    CHECK_OOM(pending.data);
+
+    long valid = 0;
+    FILE* file = fopen(path, "rb");
+    if (file != NULL)
+    {
+        valid = journal_replay(file, path);
+
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fclose(file);
+
+        if (size > valid)
+        {
+            WARN("Discarding %ld bytes of incomplete records at the end of the journal\n", size - valid);
+            ERROR_IF(truncate(path, valid) == -1, "Unable to truncate the journal '%s': %s\n", path, strerror(errno));
+        }
+    }
+
+    journal_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    ERROR_IF(journal_fd == -1, "Unable to open the journal '%s': %s\n", path, strerror(errno));
+
+    if (valid == 0)
+    {
+        journal_write(JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE);
+        journal_flush();
+    }
+}
+
+void journal_close(void)
+{
+    journal_flush();
+
+    if (journal_fd != -1)
+        close(journal_fd);
+
+    free(pending.data);
+    free(journal_path);
+    journal_path = NULL;
+    pending.data = NULL;
+    pending.size = 0;
+    pending.index = 0;
+    journal_fd = -1;
+}
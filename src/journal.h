@@ -0,0 +1,62 @@
+/* journal.h - Write-ahead journal of mutating commands
+ *
+ * Copyright (C) 2014 Ryan Mendivil <ryan@nullreff.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redpile nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef REDPILE_JOURNAL_H
+#define REDPILE_JOURNAL_H
+
+#include "command.h"
+
+typedef enum {
+    JOURNAL_NODE,
+    JOURNAL_FIELD,
+    JOURNAL_DELETE,
+    JOURNAL_TICK,
+    JOURNAL_FORK,
+    JOURNAL_SWITCH,
+    JOURNAL_DROP,
+    JOURNAL_GENERATE
+} JournalOp;
+
+void journal_open(const char* path, unsigned int interval, unsigned int buffer_size);
+void journal_close(void);
+void journal_flush(void);
+void journal_reset(void);
+long journal_mark(void);
+void journal_discard(long offset);
+bool journal_pending(void);
+
+void journal_node(Region* region, char* type, CommandArgs* fields);
+void journal_field(Region* region, char* name, char* value);
+void journal_delete(Region* region);
+void journal_tick(unsigned int count);
+void journal_generate(Region* region, char* pattern, CommandArgs* options);
+void journal_name(JournalOp op, char* name);
+
+#endif
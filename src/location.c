@@ -104,6 +104,20 @@ Direction direction_move(Direction direction, Movement move)
     }
 }
 
+bool direction_parse(const char* string, Direction* found_dir)
+{
+    for (int i = 0; i < DIRECTIONS_COUNT; i++)
+    {
+        if (strcasecmp(string, Directions[i]) == 0)
+        {
+            *found_dir = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
 Location location_move(Location loc, Direction dir, int length)
 {
     switch (dir)
@@ -189,6 +203,20 @@ int region_area(Region* region)
            ((abs(region->z.start - region->z.end) + 1) / region->z.step);
 }
 
+static bool range_contains(Range range, int value)
+{
+    long long low = range.start > range.end ? range.end : range.start;
+    long long high = range.start > range.end ? range.start : range.end;
+    return value >= low && value <= high && (value - low) % abs(range.step) == 0;
+}
+
+bool region_contains(Region* region, Location location)
+{
+    return range_contains(region->x, location.x) &&
+           range_contains(region->y, location.y) &&
+           range_contains(region->z, location.z);
+}
+
 bool region_is_flat(Region* region)
 {
     return region->x.start == region->x.end ||
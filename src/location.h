@@ -82,6 +82,7 @@ Direction direction_right(Direction dir);
 Direction direction_left(Direction dir);
 Direction direction_move(Direction direction, Movement move);
 char direction_to_letter(Direction dir);
+bool direction_parse(const char* string, Direction* found_dir);
 
 #define location_empty() (Location){COORD_EMPTY, COORD_EMPTY, COORD_EMPTY}
 #define location_from_values(X,Y,Z) location_create(values[0], values[1], values[2])
@@ -98,6 +99,7 @@ Region* region_allocate(Range x, Range y, Range z);
 void region_randomize(Region* region, int size);
 int region_area(Region* region);
 bool region_is_flat(Region* region);
+bool region_contains(Region* region, Location location);
 
 #endif
 
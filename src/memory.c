@@ -0,0 +1,139 @@
+/* memory.c - Allocation accounting by subsystem
+ *
+ * Copyright (C) 2014 Ryan Mendivil <ryan@nullreff.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redpile nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "memory.h"
+#include "repl.h"
+#include <malloc.h>
+
+// Wraps the allocator for the structures that make up most of a running
+// server so STATUS MEMORY can say where the memory went.  Sizes come from
+// malloc_usable_size so they include the allocator's rounding, and since the
+// size is looked up again when freeing, a pointer only has to be freed with the
+// same category it was allocated with.
+//
+// Counters are shared by every world and fork.  Like the reference counts in
+// reader.c they're only touched from the main thread, which is the only one
+// that allocates or frees any of these.
+
+typedef struct {
+    size_t bytes;
+    size_t objects;
+    size_t peak;
+} MemoryCounter;
+
+static const char* category_names[MEMORY_CATEGORIES] = {
+    "trees", "nodes", "fields", "strings", "messages", "queues", "hashmaps", "lua"
+};
+
+static MemoryCounter counters[MEMORY_CATEGORIES];
+static MemoryCounter total;
+
+static void memory_count(MemoryCounter* counter, size_t added, size_t removed, int objects)
+{
+    counter->bytes += added - removed;
+    counter->objects += objects;
+    if (counter->bytes > counter->peak)
+        counter->peak = counter->bytes;
+}
+
+void memory_record(MemoryCategory category, size_t added, size_t removed, int objects)
+{
+    memory_count(&counters[category], added, removed, objects);
+    memory_count(&total, added, removed, objects);
+}
+
+void* memory_malloc(MemoryCategory category, size_t size)
+{
+    void* pointer = malloc(size);
+    if (pointer != NULL)
+        memory_record(category, malloc_usable_size(pointer), 0, 1);
+    return pointer;
+}
+
+void* memory_calloc(MemoryCategory category, size_t count, size_t size)
+{
+    void* pointer = calloc(count, size);
+    if (pointer != NULL)
+        memory_record(category, malloc_usable_size(pointer), 0, 1);
+    return pointer;
+}
+
+void* memory_realloc(MemoryCategory category, void* pointer, size_t size)
+{
+    // realloc frees the pointer and returns NULL for a size of 0
+    if (size == 0)
+    {
+        memory_free(category, pointer);
+        return NULL;
+    }
+
+    size_t old_size = malloc_usable_size(pointer);
+    void* resized = realloc(pointer, size);
+    if (resized != NULL)
+        memory_record(category, malloc_usable_size(resized), old_size, pointer == NULL ? 1 : 0);
+    return resized;
+}
+
+char* memory_strdup(MemoryCategory category, const char* string)
+{
+    char* copy = strdup(string);
+    if (copy != NULL)
+        memory_record(category, malloc_usable_size(copy), 0, 1);
+    return copy;
+}
+
+void memory_free(MemoryCategory category, void* pointer)
+{
+    if (pointer == NULL)
+        return;
+
+    memory_record(category, 0, malloc_usable_size(pointer), -1);
+    free(pointer);
+}
+
+// Bytes per node leaves out the Lua heap and the tick queues since neither
+// grows with the size of the world
+void memory_print_status(unsigned int nodes)
+{
+    size_t world_bytes = total.bytes - counters[MEMORY_LUA].bytes - counters[MEMORY_QUEUES].bytes;
+
+    repl_print("memory_bytes: %zu\n", total.bytes);
+    repl_print("memory_objects: %zu\n", total.objects);
+    repl_print("memory_peak: %zu\n", total.peak);
+    repl_print("memory_bytes_per_node: %.1f\n", nodes > 0 ? (double)world_bytes / nodes : 0.0);
+
+    for (unsigned int i = 0; i < MEMORY_CATEGORIES; i++)
+    {
+        MemoryCounter* counter = &counters[i];
+        repl_print("memory_%s_bytes: %zu\n", category_names[i], counter->bytes);
+        repl_print("memory_%s_objects: %zu\n", category_names[i], counter->objects);
+        repl_print("memory_%s_peak: %zu\n", category_names[i], counter->peak);
+    }
+}
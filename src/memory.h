@@ -0,0 +1,56 @@
+/* memory.h - Allocation accounting by subsystem
+ *
+ * Copyright (C) 2014 Ryan Mendivil <ryan@nullreff.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redpile nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef REDPILE_MEMORY_H
+#define REDPILE_MEMORY_H
+
+#include <stddef.h>
+
+typedef enum {
+    MEMORY_TREES,
+    MEMORY_NODES,
+    MEMORY_FIELDS,
+    MEMORY_STRINGS,
+    MEMORY_MESSAGES,
+    MEMORY_QUEUES,
+    MEMORY_HASHMAPS,
+    MEMORY_LUA,
+    MEMORY_CATEGORIES
+} MemoryCategory;
+
+void* memory_malloc(MemoryCategory category, size_t size);
+void* memory_calloc(MemoryCategory category, size_t count, size_t size);
+void* memory_realloc(MemoryCategory category, void* pointer, size_t size);
+char* memory_strdup(MemoryCategory category, const char* string);
+void memory_free(MemoryCategory category, void* pointer);
+void memory_record(MemoryCategory category, size_t added, size_t removed, int objects);
+void memory_print_status(unsigned int nodes);
+
+#endif
@@ -31,14 +31,20 @@
 #include <stdlib.h>
 #include "message.h"
 #include "repl.h"
+#include "memory.h"
 
 Messages* messages_allocate(unsigned int size)
 {
-    Messages* messages = malloc(MESSAGES_ALLOC_SIZE(size));
+    Messages* messages = memory_malloc(MEMORY_MESSAGES, MESSAGES_ALLOC_SIZE(size));
     messages->size = size;
     return messages;
 }
 
+void messages_free(Messages* messages)
+{
+    memory_free(MEMORY_MESSAGES, messages);
+}
+
 void messages_copy(Message* dest, Messages* source)
 {
     memcpy(dest, source->data, sizeof(Message) * source->size);
@@ -100,7 +106,7 @@ bool messages_equal(Messages* first, Messages* second)
 
 Messages* messages_resize(Messages* messages, unsigned int size)
 {
-    messages = realloc(messages, MESSAGES_ALLOC_SIZE(size));
+    messages = memory_realloc(MEMORY_MESSAGES, messages, MESSAGES_ALLOC_SIZE(size));
     CHECK_OOM(messages);
     messages->size = size;
     return messages;
@@ -138,7 +144,7 @@ Message* messages_find_source(Messages* messages, Location source)
 
 MessageStore* message_store_allocate(unsigned long long tick)
 {
-    MessageStore* store = malloc(sizeof(MessageStore));
+    MessageStore* store = memory_malloc(MEMORY_MESSAGES, sizeof(MessageStore));
     CHECK_OOM(store);
     store->messages = messages_allocate(0);
     store->tick = tick;
@@ -146,10 +152,25 @@ MessageStore* message_store_allocate(unsigned long long tick)
     return store;
 }
 
+MessageStore* message_store_copy(MessageStore* store)
+{
+    MessageStore* first = NULL;
+    MessageStore** next = &first;
+    for (; store != NULL; store = store->next)
+    {
+        MessageStore* copy = message_store_allocate(store->tick);
+        copy->messages = messages_resize(copy->messages, store->messages->size);
+        messages_copy(copy->messages->data, store->messages);
+        *next = copy;
+        next = &copy->next;
+    }
+    return first;
+}
+
 static void message_store_free_one(MessageStore* store)
 {
-    free(store->messages);
-    free(store);
+    messages_free(store->messages);
+    memory_free(MEMORY_MESSAGES, store);
 }
 
 void message_store_free(MessageStore* store)
@@ -64,6 +64,7 @@ typedef struct MessageStore {
 #define MESSAGES_ALLOC_SIZE(SIZE) (sizeof(Messages) + sizeof(Message) * (SIZE))
 
 Messages* messages_allocate(unsigned int size);
+void messages_free(Messages* messages);
 void messages_copy(Message* dest, Messages* source);
 Messages* messages_filter_copy(Messages* messages, unsigned int mask);
 Messages* messages_filter_copy(Messages* messages, unsigned int mask);
@@ -74,6 +75,7 @@ Message* messages_find_max(Messages* messages);
 Message* messages_find_source(Messages* messages, Location source);
 
 MessageStore* message_store_allocate(unsigned long long tick);
+MessageStore* message_store_copy(MessageStore* store);
 void message_store_free(MessageStore* store);
 Messages* message_store_find_instructions(MessageStore* store, unsigned long long tick);
 MessageStore* message_store_find(MessageStore* store, unsigned long long tick);
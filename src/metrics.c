@@ -0,0 +1,169 @@
+/* metrics.c - Per-tick statistics written to a file or socket
+ *
+ * Copyright (C) 2014 Ryan Mendivil <ryan@nullreff.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redpile nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "metrics.h"
+#include "repl.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// One line is written per tick in the InfluxDB line protocol, which
+// Telegraf, InfluxDB and most other time series tools read as is:
+//
+//   redpile_tick tick=12i,nodes=40i,...,hash="9e3779b97f4a7c15" 1760000000000000000
+//
+// Lines going to a file are buffered until the end of each TICK command so
+// long runs don't make a system call per tick.  Unix sockets get one write
+// (or datagram) per line, and block ticks when the reader falls behind the
+// same as a slow client would.
+
+static FILE* output = NULL;
+static char* output_path = NULL;
+
+static long long get_time(void)
+{
+    struct timespec value;
+    clock_gettime(CLOCK_REALTIME, &value);
+    return ((long long)value.tv_sec) * 1000000000LL + value.tv_nsec;
+}
+
+static FILE* metrics_connect(const char* path)
+{
+    struct sockaddr_un address;
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    int types[] = {SOCK_STREAM, SOCK_DGRAM};
+    for (unsigned int i = 0; i < 2; i++)
+    {
+        int fd = socket(AF_UNIX, types[i] | SOCK_CLOEXEC, 0);
+        if (fd == -1)
+            return NULL;
+
+        if (connect(fd, (struct sockaddr*)&address, sizeof(address)) == 0)
+        {
+            FILE* file = fdopen(fd, "w");
+            if (file != NULL)
+                setvbuf(file, NULL, _IOLBF, 0);
+            return file;
+        }
+
+        int error = errno;
+        close(fd);
+        errno = error;
+        if (error != EPROTOTYPE)
+            return NULL;
+    }
+
+    return NULL;
+}
+
+bool metrics_start(const char* path)
+{
+    if (output != NULL)
+    {
+        repl_print_error("Metrics are already being written to '%s'\n", output_path);
+        return false;
+    }
+
+    struct stat info;
+    if (stat(path, &info) == 0 && S_ISSOCK(info.st_mode))
+        output = metrics_connect(path);
+    else
+        output = fopen(path, "ae");
+
+    if (output == NULL)
+    {
+        repl_print_error("Unable to open '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+
+    output_path = strdup(path);
+    CHECK_OOM(output_path);
+    return true;
+}
+
+bool metrics_stop(void)
+{
+    if (output == NULL)
+    {
+        repl_print_error("Metrics aren't being written\n");
+        return false;
+    }
+
+    bool written = fclose(output) == 0;
+    if (!written)
+        repl_print_error("Unable to write '%s': %s\n", output_path, strerror(errno));
+
+    free(output_path);
+    output = NULL;
+    output_path = NULL;
+    return written;
+}
+
+bool metrics_enabled(void)
+{
+    return output != NULL;
+}
+
+void metrics_write(TickMetrics* tick)
+{
+    fprintf(output, "redpile_tick tick=%llui,nodes=%ui,passes=%ui,rerun=%ui,rerun_max=%ui,"
+            "created=%ui,removed=%ui,delivered=%ui,delayed=%ui,outputs=%ui,nanoseconds=%lldi,"
+            "hash=\"%016" PRIx64 "\" %lld\n",
+            tick->tick, tick->nodes, tick->passes, tick->rerun, tick->rerun_max,
+            tick->created, tick->removed, tick->delivered, tick->delayed, tick->outputs,
+            tick->nanoseconds, tick->hash, get_time());
+}
+
+// Stops writing metrics if the file or socket can't keep up
+void metrics_flush(void)
+{
+    if (output == NULL || (fflush(output) == 0 && !ferror(output)))
+        return;
+
+    repl_print_error("Unable to write '%s': %s, metrics stopped\n", output_path, strerror(errno));
+    fclose(output);
+    free(output_path);
+    output = NULL;
+    output_path = NULL;
+}
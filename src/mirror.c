@@ -0,0 +1,219 @@
+/* mirror.c - Read only copies of a field published in shared memory
+ *
+ * Copyright (C) 2014 Ryan Mendivil <ryan@nullreff.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redpile nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "mirror.h"
+#include "repl.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// A mirror is a file holding the value of one field for every location in
+// a region as a dense grid of signed bytes, rewritten in place at the end
+// of every tick so other processes can map it and read the world without
+// asking for it.  Values outside -128..127 are clamped and locations
+// without the field are 0.  The grid is ordered like FOR_REGION, with z
+// changing fastest, starting from the lowest corner of the region.
+//
+// Readers detect torn frames with the sequence number in the header, which
+// is odd while the grid is being written:
+//
+//     do {
+//         while ((start = header->sequence) & 1);
+//         copy the cells
+//     } while (header->sequence != start);
+
+static Mirror* mirrors = NULL;
+static unsigned int next_id = 1;
+
+static uint32_t mirror_axis_size(Range range)
+{
+    int low = range.start > range.end ? range.end : range.start;
+    int high = range.start > range.end ? range.start : range.end;
+    return ((long long)high - low) / abs(range.step) + 1;
+}
+
+static int8_t mirror_clamp(int value)
+{
+    return value < INT8_MIN ? INT8_MIN : value > INT8_MAX ? INT8_MAX : value;
+}
+
+struct mirror_fill_args {
+    const char* field;
+    int8_t* cell;
+    Type* type;
+    Field* found;
+    unsigned int index;
+};
+
+static void mirror_fill_callback(UNUSED Location location, Node* node, void* args)
+{
+    struct mirror_fill_args* fill = args;
+    int8_t value = 0;
+
+    if (!NODE_IS_EMPTY(node) && node->data->type != NULL)
+    {
+        // Nodes tend to come in runs of the same type
+        if (node->data->type != fill->type)
+        {
+            fill->type = node->data->type;
+            fill->found = type_find_field(fill->type, fill->field, &fill->index);
+        }
+
+        if (fill->found != NULL && node->data->fields != NULL)
+        {
+            FieldValue field = node->data->fields->data[fill->index];
+            if (fill->found->type == FIELD_INTEGER)
+                value = mirror_clamp(field.integer);
+            else if (fill->found->type == FIELD_DIRECTION)
+                value = field.direction;
+        }
+    }
+
+    *fill->cell++ = value;
+}
+
+static void mirror_write(Mirror* mirror, World* world)
+{
+    MirrorHeader* header = mirror->header;
+    struct mirror_fill_args args = {mirror->field, mirror->cells, NULL, NULL, 0};
+
+    __atomic_store_n(&header->sequence, header->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    header->tick = world->ticks;
+    world_get_region(world, &mirror->region, mirror_fill_callback, &args);
+
+    __atomic_store_n(&header->sequence, header->sequence + 1, __ATOMIC_RELEASE);
+}
+
+unsigned int mirror_add(World* world, Region* region, char* field, char* path)
+{
+    long long area = (long long)mirror_axis_size(region->x) * mirror_axis_size(region->y) * mirror_axis_size(region->z);
+    if (area > MIRROR_MAX_AREA)
+    {
+        repl_print_error("The region can't have more than %d locations\n", MIRROR_MAX_AREA);
+        return 0;
+    }
+
+    size_t length = MIRROR_HEADER_SIZE + area;
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    void* memory = MAP_FAILED;
+    if (fd != -1 && ftruncate(fd, length) == 0)
+        memory = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (memory == MAP_FAILED)
+    {
+        repl_print_error("Unable to write the mirror '%s': %s\n", path, strerror(errno));
+        if (fd != -1)
+        {
+            close(fd);
+            unlink(path);
+        }
+        return 0;
+    }
+    close(fd);
+
+    Mirror* mirror = malloc(sizeof(Mirror));
+    CHECK_OOM(mirror);
+
+    mirror->id = next_id++;
+    mirror->path = strdup(path);
+    mirror->field = strdup(field);
+    mirror->region = *region;
+    mirror->header = memory;
+    mirror->cells = (int8_t*)memory + MIRROR_HEADER_SIZE;
+    mirror->length = length;
+
+    MirrorHeader* header = mirror->header;
+    memcpy(header->magic, MIRROR_MAGIC, MIRROR_MAGIC_SIZE);
+    header->header_size = MIRROR_HEADER_SIZE;
+    header->origin[0] = region->x.start > region->x.end ? region->x.end : region->x.start;
+    header->origin[1] = region->y.start > region->y.end ? region->y.end : region->y.start;
+    header->origin[2] = region->z.start > region->z.end ? region->z.end : region->z.start;
+    header->step[0] = abs(region->x.step);
+    header->step[1] = abs(region->y.step);
+    header->step[2] = abs(region->z.step);
+    header->size[0] = mirror_axis_size(region->x);
+    header->size[1] = mirror_axis_size(region->y);
+    header->size[2] = mirror_axis_size(region->z);
+    mirror_write(mirror, world);
+
+    mirror->next = mirrors;
+    mirrors = mirror;
+    return mirror->id;
+}
+
+static void mirror_free(Mirror* mirror)
+{
+    munmap(mirror->header, mirror->length);
+    unlink(mirror->path);
+    free(mirror->path);
+    free(mirror->field);
+    free(mirror);
+}
+
+bool mirror_remove(unsigned int id)
+{
+    for (Mirror** mirror = &mirrors; *mirror != NULL; mirror = &(*mirror)->next)
+    {
+        if ((*mirror)->id == id)
+        {
+            Mirror* found = *mirror;
+            *mirror = found->next;
+            mirror_free(found);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void mirror_print_list(void)
+{
+    for (Mirror* mirror = mirrors; mirror != NULL; mirror = mirror->next)
+        repl_print("%u %s %s\n", mirror->id, mirror->field, mirror->path);
+}
+
+void mirror_update(World* world)
+{
+    for (Mirror* mirror = mirrors; mirror != NULL; mirror = mirror->next)
+        mirror_write(mirror, world);
+}
+
+void mirror_cleanup(void)
+{
+    while (mirrors != NULL)
+    {
+        Mirror* mirror = mirrors;
+        mirrors = mirror->next;
+        mirror_free(mirror);
+    }
+}
@@ -0,0 +1,71 @@
+/* mirror.h - Read only copies of a field published in shared memory
+ *
+ * Copyright (C) 2014 Ryan Mendivil <ryan@nullreff.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redpile nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef REDPILE_MIRROR_H
+#define REDPILE_MIRROR_H
+
+#include "world.h"
+#include <stdint.h>
+
+#define MIRROR_MAGIC "RPM1"
+#define MIRROR_MAGIC_SIZE 4
+#define MIRROR_HEADER_SIZE 64
+#define MIRROR_MAX_AREA (64 * 1024 * 1024)
+
+// Read by other processes, see mirror.c
+typedef struct {
+    char magic[MIRROR_MAGIC_SIZE];
+    uint32_t header_size;
+    uint32_t sequence;
+    uint32_t reserved;
+    uint64_t tick;
+    int32_t origin[3];
+    int32_t step[3];
+    uint32_t size[3];
+} MirrorHeader;
+
+typedef struct Mirror {
+    unsigned int id;
+    char* path;
+    char* field;
+    Region region;
+    MirrorHeader* header;
+    int8_t* cells;
+    size_t length;
+    struct Mirror* next;
+} Mirror;
+
+unsigned int mirror_add(World* world, Region* region, char* field, char* path);
+bool mirror_remove(unsigned int id);
+void mirror_print_list(void);
+void mirror_update(World* world);
+void mirror_cleanup(void);
+
+#endif
@@ -30,7 +30,7 @@
 
 #include "node.h"
 #include "repl.h"
-#include <limits.h>
+#include "memory.h"
 
 Node node_empty(void)
 {
@@ -39,7 +39,7 @@ Node node_empty(void)
 
 NodeData* node_data_allocate(Type* type)
 {
-    NodeData* data = calloc(1, sizeof(NodeData));
+    NodeData* data = memory_calloc(MEMORY_NODES, 1, sizeof(NodeData));
     CHECK_OOM(data);
     data->type = type;
     return data;
@@ -55,13 +55,35 @@ void node_data_free(NodeData* data)
         {
             Field* field = data->type->fields->data + i;
             if (field->type == FIELD_STRING)
-                free(data->fields->data[i].string);
+                memory_free(MEMORY_STRINGS, data->fields->data[i].string);
         }
-        free(data->fields);
+        memory_free(MEMORY_FIELDS, data->fields);
     }
-    free(data);
+    memory_free(MEMORY_NODES, data);
 }
 
+NodeData* node_data_copy(NodeData* data)
+{
+    NodeData* copy = node_data_allocate(data->type);
+    copy->store = message_store_copy(data->store);
+
+    if (data->fields != NULL)
+    {
+        size_t size = sizeof(FieldData) + (sizeof(FieldValue) * data->fields->count);
+        copy->fields = memory_malloc(MEMORY_FIELDS, size);
+        CHECK_OOM(copy->fields);
+        memcpy(copy->fields, data->fields, size);
+
+        for (unsigned int i = 0; i < data->type->fields->count; i++)
+        {
+            Field* field = data->type->fields->data + i;
+            if (field->type == FIELD_STRING && copy->fields->data[i].string != NULL)
+                copy->fields->data[i].string = memory_strdup(MEMORY_STRINGS, copy->fields->data[i].string);
+        }
+    }
+
+    return copy;
+}
 
 void node_initialize_fields(Node* node)
 {
@@ -69,29 +91,68 @@ void node_initialize_fields(Node* node)
         return;
 
     unsigned int field_count = node->data->type->fields->count;
-    FieldData* fields = calloc(1, sizeof(FieldData) + (sizeof(FieldValue) * field_count));
+    FieldData* fields = memory_calloc(MEMORY_FIELDS, 1, sizeof(FieldData) + (sizeof(FieldValue) * field_count));
     fields->count = field_count;
     node->data->fields = fields;
 }
 
-Messages* node_find_messages(Node* node, unsigned long long tick)
+static bool integer_parse(const char* string, int* found_int)
 {
-    NodeData* data = node->data;
-    MessageStore* store = data->store = message_store_discard_old(data->store, tick);
-    if (store == NULL)
-        return NULL;
+    char* parse_error = NULL;
+    int value = strtol(string, &parse_error, 10);
 
-    Messages* messages = message_store_find_instructions(store, tick);
-    if (messages == NULL)
-        return NULL;
+    if (!*parse_error)
+    {
+        *found_int = value;
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+// Sets a field from the string representation used by commands.
+// Returns false if the value isn't valid for the type of the field.
+bool node_field_parse(Node* node, Field* field, unsigned int index, const char* value)
+{
+    switch (field->type)
+    {
+        case FIELD_INTEGER: {
+            int result;
+            if (!integer_parse(value, &result))
+                return false;
 
-    return messages;
+            FIELD_SET(node, index, integer, result);
+        } break;
+
+        case FIELD_DIRECTION: {
+            Direction result;
+            if (!direction_parse(value, &result))
+                return false;
+
+            FIELD_SET(node, index, direction, result);
+        } break;
+
+        case FIELD_STRING:
+            FIELD_SET(node, index, string, memory_strdup(MEMORY_STRINGS, value));
+            break;
+    }
+
+    return true;
+}
+
+// Nodes may be shared between forks of a world so finding messages
+// can't modify the node.  Old stores are discarded in node_find_store.
+Messages* node_find_messages(Node* node, unsigned long long tick)
+{
+    return message_store_find_instructions(node->data->store, tick);
 }
 
-MessageStore* node_find_store(Node* node, unsigned long long tick)
+MessageStore* node_find_store(Node* node, unsigned long long tick, unsigned long long current_tick)
 {
     NodeData* data = node->data;
-    MessageStore* store = data->store;
+    MessageStore* store = data->store = message_store_discard_old(data->store, current_tick);
     if (store == NULL)
     {
         store = message_store_allocate(tick);
@@ -185,11 +246,12 @@ bool node_equals(Node* n1, Node* n2)
 
 NodeTree* node_tree_allocate(NodeTree* parent, unsigned int level, NodeData* data)
 {
-    NodeTree* tree = calloc(1, sizeof(NodeTree));
+    NodeTree* tree = memory_calloc(MEMORY_TREES, 1, sizeof(NodeTree));
     CHECK_OOM(tree);
     tree->parent = parent;
     tree->level = level;
     tree->data = data;
+    tree->refs = 1;
     return tree;
 }
 
@@ -203,40 +265,78 @@ void node_tree_free(NodeTree* tree)
                 node_tree_free(tree->children.branches[i]);
         }
     }
+    else
+    {
+        for (unsigned int i = 0; i < TREE_SIZE; i++)
+        {
+            if (tree->children.leaves[i] != NULL)
+                node_data_free(tree->children.leaves[i]);
+        }
+    }
+
+    memory_free(MEMORY_TREES, tree);
+}
 
-    free(tree);
+void node_tree_release(NodeTree* tree)
+{
+    assert(tree->refs > 0);
+    if (--tree->refs == 0)
+        node_tree_free(tree);
 }
 
-#define MOST_SIGNIFICANT_BIT(NUM) (NUM != 0 ? (sizeof(NUM) * CHAR_BIT) - __builtin_clz(NUM) : 0)
-NodeTree* node_tree_ensure_depth(NodeTree* tree, Location location)
+NodeTree* node_tree_copy(NodeTree* tree, NodeTree* parent)
 {
-    assert(tree->level != 0);
-
-    unsigned int x_abs = abs(location.x);
-    unsigned int y_abs = abs(location.y);
-    unsigned int z_abs = abs(location.z);
-    unsigned int max = x_abs > y_abs ? x_abs : y_abs;
-    max = max > z_abs ? max : z_abs;
-    unsigned int depth = MOST_SIGNIFICANT_BIT(max);
-    while (depth > tree->level)
+    NodeTree* copy = node_tree_allocate(parent, tree->level, tree->data);
+    for (unsigned int i = 0; i < TREE_SIZE; i++)
     {
-        NodeTree* children[TREE_SIZE];
-        memcpy(&children, tree->children.branches, sizeof(NodeTree*) * TREE_SIZE);
-        for (unsigned int i = 0; i < TREE_SIZE; i++)
+        if (tree->level != 0)
         {
-            NodeTree* new = node_tree_allocate(tree, tree->level, NULL);
-            new->children.branches[(TREE_SIZE - 1) - i] = children[i];
-            if (children[i] != NULL)
-                children[i]->parent = new;
-            tree->children.branches[i] = new;
+            if (tree->children.branches[i] != NULL)
+                copy->children.branches[i] = node_tree_copy(tree->children.branches[i], copy);
+        }
+        else
+        {
+            if (tree->children.leaves[i] != NULL)
+                copy->children.leaves[i] = node_data_copy(tree->children.leaves[i]);
         }
-        tree->level++;
     }
+    return copy;
+}
 
-    return tree;
+// Rather than growing a single octree outwards from the origin, the world is
+// split into chunks of CHUNK_WIDTH nodes along each axis.  Each chunk is
+// looked up by the high bits of a location (see world.c) and stores its nodes
+// in an octree of CHUNK_DEPTH levels.  A tree at level n covers the offsets
+// -(2^n - 1) through 2^n on each axis, so the low bits of a location are
+// shifted to fit that range exactly.  Lookups then take the same number of
+// steps no matter how far a node is from the origin.
+#define CHUNK_MASK (CHUNK_WIDTH - 1)
+#define CHUNK_SHIFT ((CHUNK_WIDTH / 2) - 1)
+Location node_chunk_key(Location location)
+{
+    return location_create(
+            location.x >> CHUNK_BITS,
+            location.y >> CHUNK_BITS,
+            location.z >> CHUNK_BITS);
+}
+
+Location node_chunk_offset(Location location)
+{
+    return location_create(
+            (location.x & CHUNK_MASK) - CHUNK_SHIFT,
+            (location.y & CHUNK_MASK) - CHUNK_SHIFT,
+            (location.z & CHUNK_MASK) - CHUNK_SHIFT);
 }
 
-void node_tree_get_recursive(NodeTree* tree, Location l, Node* node, bool create)
+Location node_chunk_location(Location key, Location offset)
+{
+    return location_create(
+            (key.x * CHUNK_WIDTH) + offset.x + CHUNK_SHIFT,
+            (key.y * CHUNK_WIDTH) + offset.y + CHUNK_SHIFT,
+            (key.z * CHUNK_WIDTH) + offset.z + CHUNK_SHIFT);
+}
+
+static void node_tree_get_recursive(NodeTree* tree, Location l, Node* node, bool create)
 {
     unsigned int offset = (l.x > 0 ? 1 : 0) + (l.y > 0 ? 2 : 0) + (l.z > 0 ? 4 : 0);
     if (tree->level != 0)
@@ -272,7 +372,7 @@ void node_tree_get_recursive(NodeTree* tree, Location l, Node* node, bool create
                 return;
             }
 
-            assert(!"Call into node_tree_get without first calling node_tree_ensure_depth");
+            assert(!"Call into node_tree_get with a location outside of the tree");
         }
 
         if (create && tree->children.leaves[offset] == NULL)
@@ -292,6 +392,17 @@ void node_tree_get(NodeTree* tree, Location location, Node* node, bool create)
     node->location = location;
 }
 
+bool node_tree_is_empty(NodeTree* tree)
+{
+    for (unsigned int i = 0; i < TREE_SIZE; i++)
+    {
+        // Branches and leaves share the same storage
+        if (tree->children.branches[i] != NULL)
+            return false;
+    }
+    return true;
+}
+
 static NodeTree* node_tree_remove_recursive(NodeTree* tree, Location l, Node* node)
 {
     if (tree == NULL)
@@ -306,8 +417,16 @@ static NodeTree* node_tree_remove_recursive(NodeTree* tree, Location l, Node* no
                 l.y > 0 ? l.y - shift : l.y + shift,
                 l.z > 0 ? l.z - shift : l.z + shift);
 
-        tree->children.branches[offset] = node_tree_remove_recursive(
-                tree->children.branches[offset], sub_location, node);
+        NodeTree* sub_tree = node_tree_remove_recursive(tree->children.branches[offset], sub_location, node);
+
+        // Branches left without any leaves are freed so empty chunks can
+        // be spotted from their top level
+        if (sub_tree != NULL && node_tree_is_empty(sub_tree))
+        {
+            node_tree_free(sub_tree);
+            sub_tree = NULL;
+        }
+        tree->children.branches[offset] = sub_tree;
     }
     else
     {
@@ -328,6 +447,44 @@ void node_tree_remove(NodeTree* tree, Location location, Node* node)
     node->location = location;
 }
 
+// Walks every leaf in the tree, the inverse of node_tree_get_recursive
+static void node_tree_each_recursive(NodeTree* tree, Location key, Location base,
+                                     void (*callback)(Node* node, void* args), void* args)
+{
+    int shift = tree->level != 0 ? 1 << (tree->level - 1) : 0;
+    for (unsigned int i = 0; i < TREE_SIZE; i++)
+    {
+        Location corner = location_create(i & 1, (i >> 1) & 1, (i >> 2) & 1);
+        if (tree->level != 0)
+        {
+            NodeTree* sub_tree = tree->children.branches[i];
+            if (sub_tree == NULL)
+                continue;
+
+            Location sub_base = location_create(
+                    corner.x ? base.x + shift : base.x - shift,
+                    corner.y ? base.y + shift : base.y - shift,
+                    corner.z ? base.z + shift : base.z - shift);
+            node_tree_each_recursive(sub_tree, key, sub_base, callback, args);
+        }
+        else
+        {
+            NodeData* data = tree->children.leaves[i];
+            if (data == NULL)
+                continue;
+
+            Location offset = location_create(base.x + corner.x, base.y + corner.y, base.z + corner.z);
+            Node node = (Node){node_chunk_location(key, offset), data};
+            callback(&node, args);
+        }
+    }
+}
+
+void node_tree_each(NodeTree* tree, Location key, void (*callback)(Node* node, void* args), void* args)
+{
+    node_tree_each_recursive(tree, key, location_create(0, 0, 0), callback, args);
+}
+
 NodeList* node_list_allocate(unsigned int count)
 {
     NodeList* nodes = malloc(sizeof(NodeList) + (sizeof(Node) * count));
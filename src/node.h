@@ -41,6 +41,12 @@
 #define TREE_WIDTH 2
 #define TREE_SIZE (TREE_WIDTH * TREE_WIDTH * TREE_WIDTH)
 
+// Nodes are split into chunks of CHUNK_WIDTH^3 that each get their own
+// fixed depth octree.  See node.c for more information.
+#define CHUNK_BITS 5
+#define CHUNK_WIDTH (1 << CHUNK_BITS)
+#define CHUNK_DEPTH (CHUNK_BITS - 1)
+
 typedef struct {
     unsigned int count;
     FieldValue data[];
@@ -57,6 +63,9 @@ typedef struct NodeTree {
     struct NodeTree* parent;
     unsigned int level;
     NodeData* data;
+
+    // Number of worlds sharing this tree, only used for chunks
+    unsigned int refs;
     union {
         struct NodeTree* branches[TREE_SIZE];
         NodeData* leaves[TREE_SIZE];
@@ -81,22 +90,31 @@ typedef struct NodeList {
 #define FIELD_SET(NODE,INDEX,TYPE,VALUE) (node_initialize_fields(NODE), NODE_FIELD(NODE,INDEX,TYPE) = VALUE)
 
 void node_data_free(NodeData* data);
+NodeData* node_data_copy(NodeData* data);
 
 Node node_empty(void);
 NodeData* node_data_allocate(Type* type);
 void node_initialize_fields(Node* node);
+bool node_field_parse(Node* node, Field* field, unsigned int index, const char* value);
 Messages* node_find_messages(Node* node, unsigned long long tick);
-MessageStore* node_find_store(Node* node, unsigned long long tick);
+MessageStore* node_find_store(Node* node, unsigned long long tick, unsigned long long current_tick);
 void node_print_field_value(Node* node, FieldType type, FieldValue value);
 void node_print_field(Field* field, FieldValue value);
 void node_print(Node* node);
 bool node_equals(Node* n1, Node* n2);
 
+Location node_chunk_key(Location location);
+Location node_chunk_offset(Location location);
+Location node_chunk_location(Location key, Location offset);
+
 NodeTree* node_tree_allocate(NodeTree* parent, unsigned int level, NodeData* data);
 void node_tree_free(NodeTree* tree);
-NodeTree* node_tree_ensure_depth(NodeTree* tree, Location location);
+void node_tree_release(NodeTree* tree);
+NodeTree* node_tree_copy(NodeTree* tree, NodeTree* parent);
 void node_tree_get(NodeTree* tree, Location location, Node* node, bool create);
 void node_tree_remove(NodeTree* tree, Location location, Node* node);
+bool node_tree_is_empty(NodeTree* tree);
+void node_tree_each(NodeTree* tree, Location key, void (*callback)(Node* node, void* args), void* args);
 
 NodeList* node_list_allocate(unsigned int count);
 void node_list_free(NodeList* nodes);
@@ -29,6 +29,9 @@
  */
 
 %error-verbose
+%define api.pure full
+%lex-param {yyscan_t scanner}
+%parse-param {yyscan_t scanner}
 %{
 #include <ctype.h>
 #include "parser.h"
@@ -36,14 +39,18 @@
 #define PARSE_ERROR(...) repl_print_error(__VA_ARGS__); YYABORT;
 #define PARSE_ERROR_IF(CONDITION, ...) if (CONDITION) { repl_print_error(__VA_ARGS__); YYABORT; }
 #define PARSE_ERROR_FREE(VAR, ...) repl_print_error(__VA_ARGS__); free(VAR); YYABORT;
-#define yyerror command_error
-
-// See lexer.l
-int yylex(void);
 %}
 
 %code requires {
+    // Each connection parses with its own scanner, see repl.c
+    #ifndef YY_TYPEDEF_YY_SCANNER_T
+    #define YY_TYPEDEF_YY_SCANNER_T
+    typedef void* yyscan_t;
+    #endif
+
     #include "command.h"
+    #include "profile.h"
+    #include "trace.h"
     #include "location.h"
     #include "node.h"
     #include "repl.h"
@@ -89,6 +96,34 @@ int yylex(void);
 %token TICKQ
 %token MESSAGE
 %token TYPE
+%token FORK
+%token SWITCH
+%token DROP
+%token SAVE
+%token COMPACT
+%token WATCH
+%token UNWATCH
+%token MIRROR
+%token UNMIRROR
+%token NEXT
+%token NODES
+%token FIELDS
+%token GENERATE
+%token PROFILE
+%token METRICS
+%token TRACE
+%token HASH
+
+%code {
+    // See lexer.l
+    int yylex(YYSTYPE* yylval_param, yyscan_t scanner);
+
+    static void yyerror(yyscan_t scanner, const char* message)
+    {
+        (void)scanner;
+        command_error(message);
+    }
+}
 
 %start input
 
@@ -128,11 +163,30 @@ tick_args: /* empty */ { $$ = 1; }
 
 command: PING                        { command_ping(); }
        | STATUS                      { command_status(); }
+       | STATUS STRING               { command_status_show($2); free($2); }
+       | HASH                        { command_hash(); }
+       | HASH STRING                 { command_hash_check($2); free($2); }
+       | PROFILE STRING STRING       { command_profile($2, $3, NULL, 0); free($2); free($3); }
+       | PROFILE STRING STRING STRING { command_profile($2, $3, $4, PROFILE_DEFAULT_INTERVAL); free($2); free($3); free($4); }
+       | PROFILE STRING STRING STRING INT { command_profile($2, $3, $4, $5); free($2); free($3); free($4); }
+       | METRICS STRING              { command_metrics($2, NULL); free($2); }
+       | METRICS STRING STRING       { command_metrics($2, $3); free($2); free($3); }
+       | TRACE STRING                { command_trace($2, NULL, TRACE_DEFAULT_EVENTS); free($2); }
+       | TRACE STRING INT            { command_trace($2, NULL, $3); free($2); }
+       | TRACE STRING STRING         { command_trace($2, $3, 0); free($2); free($3); }
        | NODE region                 { command_node_get($2); free($2); }
        | NODE region STRING set_args { command_node_set($2, $3, $4); free($2); free($3); command_args_free($4); }
        | FIELD region STRING         { command_field_get($2, $3); free($2); free($3); }
        | FIELD region STRING VALUE   { command_field_set($2, $3, $4); free($2); free($3); free($4); }
+       | NODE region STRING INT      { command_node_page($2, $3, $4, false); free($2); free($3); }
+       | FIELD region STRING STRING INT { command_field_page($2, $3, $4, $5, false); free($2); free($3); free($4); }
+       | NODES region                { command_nodes_get($2); free($2); }
+       | NODES region STRING INT     { command_node_page($2, $3, $4, true); free($2); free($3); }
+       | FIELDS region STRING        { command_fields_get($2, $3); free($2); free($3); }
+       | FIELDS region STRING STRING INT { command_field_page($2, $3, $4, $5, true); free($2); free($3); free($4); }
+       | NEXT INT                    { command_next($2); }
        | DELETE region               { command_delete($2); free($2); }
+       | GENERATE region STRING set_args { command_generate($2, $3, $4); free($2); free($3); command_args_free($4); }
        | PLOT region STRING          { command_plot($2, $3); free($2); free($3); }
        | TICK tick_args              { command_tick($2, LOG_NORMAL); }
        | TICKV tick_args             { command_tick($2, LOG_VERBOSE); }
@@ -140,6 +194,20 @@ command: PING                        { command_ping(); }
        | MESSAGE                     { command_message(); }
        | TYPE                        { command_type_list(); }
        | TYPE STRING                 { command_type_show($2); free($2); }
+       | FORK                        { command_fork_list(); }
+       | FORK STRING                 { command_fork($2); free($2); }
+       | SWITCH STRING               { command_switch($2); free($2); }
+       | DROP STRING                 { command_drop($2); free($2); }
+       | SAVE STRING                 { command_save($2); free($2); }
+       | SAVE STRING STRING          { command_save_mode($2, $3); free($2); free($3); }
+       | COMPACT STRING              { command_compact($2); free($2); }
+       | WATCH region                { command_watch($2, NULL); free($2); }
+       | WATCH region STRING         { command_watch($2, $3); free($2); free($3); }
+       | UNWATCH                     { command_unwatch_all(); }
+       | UNWATCH INT                 { command_unwatch($2); }
+       | MIRROR                      { command_mirror_list(); }
+       | MIRROR region STRING STRING { command_mirror($2, $3, $4); free($2); free($3); free($4); }
+       | UNMIRROR INT                { command_unmirror($2); }
        | STRING anything             { PARSE_ERROR_FREE($1, "Unknown command '%s'\n", $1); }
 ;
 %%
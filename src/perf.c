@@ -0,0 +1,168 @@
+/* perf.c - Hardware performance counters
+ *
+ * Copyright (C) 2014 Ryan Mendivil <ryan@nullreff.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redpile nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "perf.h"
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// Counters are opened one at a time rather than as a group so that a
+// machine missing some of them (virtual machines rarely expose cache events)
+// still reports the rest.  The kernel multiplexes them if there are more than
+// the hardware can count at once, so readings are scaled by how long each one
+// was actually running.
+
+#define CACHE_MISS(CACHE) ((CACHE) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+const char* perf_names[PERF_COUNTERS] = {
+    "cycles",
+    "instructions",
+    "l1d_misses",
+    "llc_misses",
+    "branch_misses"
+};
+
+static const struct {
+    unsigned int type;
+    unsigned long long config;
+} perf_events[PERF_COUNTERS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_L1D)},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_LL)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES}
+};
+
+static int perf_event_open(unsigned int type, unsigned long long config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+// Returns false when none of the counters could be opened, leaving the
+// reason in perf->error
+bool perf_open(Perf* perf)
+{
+    bool opened = false;
+    perf->error = 0;
+
+    for (unsigned int i = 0; i < PERF_COUNTERS; i++)
+    {
+        perf->fds[i] = perf_event_open(perf_events[i].type, perf_events[i].config);
+        if (perf->fds[i] == -1)
+        {
+            if (perf->error == 0)
+                perf->error = errno;
+        }
+        else
+        {
+            opened = true;
+        }
+    }
+
+    return opened;
+}
+
+void perf_close(Perf* perf)
+{
+    for (unsigned int i = 0; i < PERF_COUNTERS; i++)
+    {
+        if (perf->fds[i] != -1)
+            close(perf->fds[i]);
+        perf->fds[i] = -1;
+    }
+}
+
+bool perf_available(Perf* perf, PerfCounter counter)
+{
+    return perf->fds[counter] != -1;
+}
+
+void perf_read(Perf* perf, PerfSample* sample)
+{
+    for (unsigned int i = 0; i < PERF_COUNTERS; i++)
+    {
+        // Value, time enabled and time running
+        unsigned long long data[3];
+        sample->values[i] = 0;
+
+        if (perf->fds[i] == -1 || read(perf->fds[i], data, sizeof(data)) != sizeof(data))
+            continue;
+
+        sample->values[i] = data[2] > 0 && data[2] < data[1]
+            ? (unsigned long long)((double)data[0] * data[1] / data[2])
+            : data[0];
+    }
+}
+
+// Adds the counts between two readings to a running total
+void perf_sample_add(PerfSample* total, PerfSample* start, PerfSample* end)
+{
+    for (unsigned int i = 0; i < PERF_COUNTERS; i++)
+    {
+        if (end->values[i] > start->values[i])
+            total->values[i] += end->values[i] - start->values[i];
+    }
+}
+
+// Writes instructions per cycle followed by every counter divided by count,
+// which is usually the number of nodes processed
+void perf_format(Perf* perf, PerfSample* sample, double count, char* buffer, size_t size)
+{
+    int written = 0;
+    if (perf_available(perf, PERF_CYCLES) && perf_available(perf, PERF_INSTRUCTIONS))
+    {
+        double cycles = sample->values[PERF_CYCLES];
+        written = snprintf(buffer, size, "ipc %.2f", cycles > 0 ? sample->values[PERF_INSTRUCTIONS] / cycles : 0);
+    }
+
+    for (unsigned int i = 0; i < PERF_COUNTERS; i++)
+    {
+        if (!perf_available(perf, i) || (size_t)written >= size)
+            continue;
+
+        written += snprintf(buffer + written, size - written, "%s%s %.2f",
+                            written > 0 ? " " : "", perf_names[i],
+                            count > 0 ? sample->values[i] / count : 0);
+    }
+
+    if (written == 0)
+        snprintf(buffer, size, "unavailable");
+}
@@ -0,0 +1,304 @@
+/* profile.c - Sampling profiler for Lua behaviors
+ *
+ * Copyright (C) 2014 Ryan Mendivil <ryan@nullreff.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redpile nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "profile.h"
+#include "repl.h"
+#include "hashmap.h"
+#include <errno.h>
+#include <stdint.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+// PROFILE LUA samples the Lua stack of whichever behavior is running every
+// so often and writes out how many times each stack was seen, one per line
+// in the folded format flamegraph.pl and speedscope read:
+//
+//   power_wire@redstone.lua:96;adjacent_each;function@redstone.lua:98 12
+//
+// Walking the Lua stack isn't safe from a signal handler, so the SIGPROF
+// handler only installs a hook (which Lua allows) that goes off on the next
+// Lua instruction or return and takes the sample from there.  When the signal
+// lands inside a C binding like adjacent or send the binding's return is what
+// fires the hook, so it shows up as the last frame.  Samples taken outside of
+// behaviors are counted as [redpile].
+//
+// Identical stacks are counted as they come in, so a long profile only
+// takes memory for each distinct stack.  They're kept in a Hashmap keyed by
+// a hash of the stack spread over the three coordinates of a Location.
+
+#define PROFILE_MAX_FRAMES 64
+#define PROFILE_FRAME_SIZE 128
+
+typedef struct {
+    bool running;
+    ScriptState* state;
+    FILE* file;
+    char* path;
+
+    // Set around each behavior, read by the signal handler
+    volatile sig_atomic_t in_behavior;
+    const char* behavior;
+
+    volatile sig_atomic_t outside;
+    Hashmap stacks;
+    unsigned int count;
+} Profile;
+
+typedef struct {
+    unsigned int count;
+    char stack[];
+} ProfileStack;
+
+static Profile profile;
+
+// Spaces and semicolons separate frames and counts in the output
+static void profile_clean(char* frame)
+{
+    for (; *frame != '\0'; frame++)
+    {
+        if (*frame == ' ' || *frame == ';')
+            *frame = '_';
+    }
+}
+
+static void profile_frame(lua_State* state, lua_Debug* debug, bool root, char* buffer)
+{
+    lua_getinfo(state, "Snl", debug);
+
+    if (debug->what[0] == 'C')
+        snprintf(buffer, PROFILE_FRAME_SIZE, "%s", debug->name != NULL ? debug->name : "[C]");
+    else
+        snprintf(buffer, PROFILE_FRAME_SIZE, "%s@%s:%d",
+                 root ? profile.behavior : debug->name != NULL ? debug->name : "function",
+                 debug->short_src, debug->currentline);
+
+    profile_clean(buffer);
+}
+
+static Location profile_key(const char* stack)
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const char* c = stack; *c != '\0'; c++)
+        hash = (hash ^ (unsigned char)*c) * 0x100000001b3ULL;
+
+    return location_create((int)(hash >> 32), (int)hash, 0);
+}
+
+static void profile_add(const char* stack)
+{
+    profile.count++;
+
+    // Stacks that collide move along z until they find themselves or a gap
+    Location key = profile_key(stack);
+    for (;; key.z++)
+    {
+        Bucket* bucket = hashmap_get(&profile.stacks, key, true);
+        ProfileStack* found = bucket->value;
+        if (found == NULL)
+        {
+            size_t length = strlen(stack);
+            found = malloc(sizeof(ProfileStack) + length + 1);
+            CHECK_OOM(found);
+            found->count = 1;
+            memcpy(found->stack, stack, length + 1);
+            bucket->value = found;
+            return;
+        }
+
+        if (strcmp(found->stack, stack) == 0)
+        {
+            found->count++;
+            return;
+        }
+    }
+}
+
+static void profile_hook(lua_State* state, UNUSED lua_Debug* event)
+{
+    lua_sethook(state, NULL, 0, 0);
+    if (!profile.in_behavior)
+        return;
+
+    lua_Debug debug;
+    int depth = 0;
+    while (depth < PROFILE_MAX_FRAMES && lua_getstack(state, depth, &debug))
+        depth++;
+
+    // The deepest level is the behavior itself, called from script.c
+    char stack[PROFILE_MAX_FRAMES * PROFILE_FRAME_SIZE + 1];
+    char* end = stack;
+    for (int level = depth - 1; level >= 0; level--)
+    {
+        lua_getstack(state, level, &debug);
+        profile_frame(state, &debug, level == depth - 1, end);
+        end += strlen(end);
+        if (level != 0)
+            *end++ = ';';
+    }
+    *end = '\0';
+
+    profile_add(stack);
+}
+
+static void profile_signal(UNUSED int signal)
+{
+    if (profile.in_behavior)
+        lua_sethook(profile.state, profile_hook, LUA_MASKCOUNT | LUA_MASKRET, 1);
+    else
+        profile.outside++;
+}
+
+static bool profile_timer(unsigned int interval)
+{
+    struct timeval value = {interval / 1000000, interval % 1000000};
+    struct itimerval timer = {value, value};
+    return setitimer(ITIMER_PROF, &timer, NULL) == 0;
+}
+
+bool profile_lua_start(ScriptState* state, const char* path, unsigned int interval)
+{
+    if (profile.running)
+    {
+        repl_print_error("The Lua profiler is already running\n");
+        return false;
+    }
+
+    FILE* file = fopen(path, "w");
+    if (file == NULL)
+    {
+        repl_print_error("Unable to open '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = profile_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, NULL);
+
+    // The handler has to be in place before the first signal can arrive
+    if (!profile_timer(interval))
+    {
+        repl_print_error("Unable to start the profiling timer: %s\n", strerror(errno));
+        signal(SIGPROF, SIG_DFL);
+        fclose(file);
+        return false;
+    }
+
+    profile.state = state;
+    profile.file = file;
+    profile.path = strdup(path);
+    CHECK_OOM(profile.path);
+    profile.outside = 0;
+    profile.count = 0;
+    hashmap_init(&profile.stacks, 1024);
+
+    profile.running = true;
+    return true;
+}
+
+static int compare_stacks(const void* a, const void* b)
+{
+    return strcmp((*(ProfileStack**)a)->stack, (*(ProfileStack**)b)->stack);
+}
+
+// Writes each distinct stack once with the number of times it was seen,
+// sorted so the same profile always gives the same file
+bool profile_lua_stop(void)
+{
+    if (!profile.running)
+    {
+        repl_print_error("The Lua profiler isn't running\n");
+        return false;
+    }
+
+    profile_timer(0);
+    signal(SIGPROF, SIG_DFL);
+    lua_sethook(profile.state, NULL, 0, 0);
+    profile.running = false;
+
+    unsigned int size = profile.stacks.count;
+    ProfileStack** stacks = malloc(sizeof(ProfileStack*) * (size != 0 ? size : 1));
+    CHECK_OOM(stacks);
+
+    Location key;
+    ProfileStack* stack;
+    unsigned int index = 0;
+    Cursor cursor = hashmap_get_iterator(&profile.stacks);
+    while (cursor_next(&cursor, &key, (void**)&stack))
+        stacks[index++] = stack;
+
+    qsort(stacks, size, sizeof(ProfileStack*), compare_stacks);
+    for (unsigned int i = 0; i < size; i++)
+        fprintf(profile.file, "%s %u\n", stacks[i]->stack, stacks[i]->count);
+
+    if (profile.outside > 0)
+        fprintf(profile.file, "[redpile] %u\n", (unsigned int)profile.outside);
+
+    bool written = fclose(profile.file) == 0;
+    if (!written)
+        repl_print_error("Unable to write '%s': %s\n", profile.path, strerror(errno));
+    else
+        repl_print("%u samples written to %s\n", profile.count + (unsigned int)profile.outside, profile.path);
+
+    free(stacks);
+    hashmap_free(&profile.stacks, free);
+    free(profile.path);
+    profile.state = NULL;
+    profile.file = NULL;
+    profile.path = NULL;
+    profile.count = 0;
+
+    return written;
+}
+
+void profile_behavior_begin(const char* name)
+{
+    if (!profile.running)
+        return;
+
+    profile.behavior = name;
+    profile.in_behavior = true;
+}
+
+// A sample asked for after the last instruction of the behavior would
+// otherwise be taken in whichever behavior runs next
+void profile_behavior_end(void)
+{
+    if (!profile.running)
+        return;
+
+    profile.in_behavior = false;
+    lua_sethook(profile.state, NULL, 0, 0);
+}
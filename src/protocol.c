@@ -0,0 +1,576 @@
+/* protocol.c - Binary protocol for bulk node and field traffic
+ *
+ * Copyright (C) 2014 Ryan Mendivil <ryan@nullreff.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redpile nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "protocol.h"
+#include "command.h"
+#include "journal.h"
+#include "redpile.h"
+#include "repl.h"
+#include <endian.h>
+#include <stdint.h>
+
+// A length prefixed binary alternative to the text commands for clients
+// moving lots of nodes around.  Requests can be pipelined, replies are sent
+// back in the order requests were received.
+//
+// Handshake:
+//   client  "\0RPB" [version:u8]
+//   server  "\0RPB" [version:u8] (the version the server speaks)
+//
+// Frames (both directions):
+//   [length:u32][op:u8][payload]    length covers the op and payload
+//
+// Payloads are built from little endian integers, locations (three int32s)
+// and strings ([length:u32] followed by the bytes).  A reply carries the
+// op of its request, or PROTOCOL_ERROR with a message if it failed.
+//
+//   PING        -> (empty)
+//   TYPES       -> [count:u32][name:string]...
+//   NODE_GET    [count:u32][location]...  -> [count:u32][type:u16]...
+//   NODE_SET    [type:u16][count:u32][location]...  -> [count:u32]
+//   FIELD_GET   [name:string][count:u32][location]...  -> [count:u32][value:i32]...
+//   FIELD_SET   [name:string][count:u32]([location][value:i32])...  -> [count:u32]
+//   TICK        [count:u32]  -> [ticks:u64]
+//   REGION_GET  [start:location][end:location]  -> [count:u32]([location][type:u16])...
+//
+// REGION_GET leaves out nodes of the default type.  Types are indexes into
+// the list returned by TYPES.  Fields that aren't
+// set, or can't be represented as an integer, are returned as PROTOCOL_NIL.
+
+#define PROTOCOL_NIL INT32_MIN
+#define LOCATION_SIZE (3 * sizeof(int32_t))
+#define ERROR_SIZE 256
+
+typedef struct {
+    const unsigned char* data;
+    size_t size;
+    size_t index;
+    bool failed;
+} ProtocolReader;
+
+typedef struct {
+    unsigned char* data;
+    size_t size;
+    size_t index;
+} ProtocolBuffer;
+
+static ProtocolBuffer response = {NULL, 0, 0};
+static char error_message[ERROR_SIZE];
+static bool failed = false;
+
+static const unsigned char* protocol_get(ProtocolReader* reader, size_t size)
+{
+    if (reader->failed || reader->size - reader->index < size)
+    {
+        reader->failed = true;
+        return NULL;
+    }
+
+    const unsigned char* data = reader->data + reader->index;
+    reader->index += size;
+    return data;
+}
+
+static uint32_t protocol_get_u32(ProtocolReader* reader)
+{
+    const unsigned char* data = protocol_get(reader, sizeof(uint32_t));
+    if (data == NULL)
+        return 0;
+
+    uint32_t value;
+    memcpy(&value, data, sizeof(uint32_t));
+    return le32toh(value);
+}
+
+static uint16_t protocol_get_u16(ProtocolReader* reader)
+{
+    const unsigned char* data = protocol_get(reader, sizeof(uint16_t));
+    if (data == NULL)
+        return 0;
+
+    uint16_t value;
+    memcpy(&value, data, sizeof(uint16_t));
+    return le16toh(value);
+}
+
+static Location protocol_get_location(ProtocolReader* reader)
+{
+    int32_t x = protocol_get_u32(reader);
+    int32_t y = protocol_get_u32(reader);
+    int32_t z = protocol_get_u32(reader);
+    return location_create(x, y, z);
+}
+
+// Makes sure a count of fixed size items actually fits in the request
+// before anything is done with them
+static uint32_t protocol_get_count(ProtocolReader* reader, size_t item_size)
+{
+    uint32_t count = protocol_get_u32(reader);
+    if (reader->size - reader->index < count * (unsigned long long)item_size)
+        reader->failed = true;
+
+    return reader->failed ? 0 : count;
+}
+
+static char* protocol_get_string(ProtocolReader* reader)
+{
+    uint32_t length = protocol_get_u32(reader);
+    const unsigned char* data = protocol_get(reader, length);
+    if (data == NULL)
+        return NULL;
+
+    char* string = strndup((const char*)data, length);
+    CHECK_OOM(string);
+    return string;
+}
+
+static unsigned char* protocol_reserve(size_t size)
+{
+    if (response.index + size > response.size)
+    {
+        if (response.size == 0)
+            response.size = 4096;
+
+        while (response.index + size > response.size)
+            response.size *= 2;
+
+        response.data = realloc(response.data, response.size);
+        CHECK_OOM(response.data);
+    }
+
+    unsigned char* data = response.data + response.index;
+    response.index += size;
+    return data;
+}
+
+static void protocol_put_u8(uint8_t value)
+{
+    *protocol_reserve(sizeof(uint8_t)) = value;
+}
+
+static void protocol_put_u16(uint16_t value)
+{
+    value = htole16(value);
+    memcpy(protocol_reserve(sizeof(uint16_t)), &value, sizeof(uint16_t));
+}
+
+static void protocol_put_u32(uint32_t value)
+{
+    value = htole32(value);
+    memcpy(protocol_reserve(sizeof(uint32_t)), &value, sizeof(uint32_t));
+}
+
+static void protocol_put_u64(uint64_t value)
+{
+    value = htole64(value);
+    memcpy(protocol_reserve(sizeof(uint64_t)), &value, sizeof(uint64_t));
+}
+
+static void protocol_put_string(const char* string)
+{
+    uint32_t length = strlen(string);
+    protocol_put_u32(length);
+    memcpy(protocol_reserve(length), string, length);
+}
+
+static void protocol_put_location(Location location)
+{
+    protocol_put_u32(location.x);
+    protocol_put_u32(location.y);
+    protocol_put_u32(location.z);
+}
+
+static void protocol_set_u32(size_t index, uint32_t value)
+{
+    value = htole32(value);
+    memcpy(response.data + index, &value, sizeof(uint32_t));
+}
+
+static void protocol_fail(const char* format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    protocol_error(format, ap);
+    va_end(ap);
+}
+
+static uint16_t protocol_type_index(Type* type)
+{
+    uint16_t index = 0;
+    FOR_TYPES(found, world->type_data)
+    {
+        if (found == type)
+            return index;
+        index++;
+    }
+    return index;
+}
+
+static Type* protocol_node_type(Node* node)
+{
+    if (NODE_IS_EMPTY(node) || node->data->type == NULL)
+        return type_data_get_default_type(world->type_data);
+
+    return node->data->type;
+}
+
+// Nodes tend to come in runs of the same type, so remember the last lookup
+typedef struct {
+    Type* type;
+    uint16_t index;
+} TypeCache;
+
+static uint16_t protocol_cached_type_index(TypeCache* cache, Type* type)
+{
+    if (cache->type != type)
+    {
+        cache->type = type;
+        cache->index = protocol_type_index(type);
+    }
+    return cache->index;
+}
+
+static void protocol_types(void)
+{
+    protocol_put_u32(world->type_data->type_count);
+    FOR_TYPES(type, world->type_data)
+    {
+        protocol_put_string(type->name);
+    }
+}
+
+static void protocol_node_get(ProtocolReader* reader)
+{
+    uint32_t count = protocol_get_count(reader, LOCATION_SIZE);
+    TypeCache cache = {NULL, 0};
+
+    protocol_put_u32(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        Node node;
+        world_get_node(world, protocol_get_location(reader), &node);
+        protocol_put_u16(protocol_cached_type_index(&cache, protocol_node_type(&node)));
+    }
+}
+
+static void protocol_node_set_callback(UNUSED Location location, Node* node, void* args)
+{
+    node->data->type = (Type*)args;
+}
+
+static void protocol_node_set(ProtocolReader* reader)
+{
+    uint16_t index = protocol_get_u16(reader);
+    uint32_t count = protocol_get_count(reader, LOCATION_SIZE);
+    if (reader->failed)
+        return;
+
+    if (index >= world->type_data->type_count)
+    {
+        protocol_fail("Unknown type %d\n", index);
+        return;
+    }
+
+    Type* type = world->type_data->types;
+    for (uint16_t i = 0; i < index; i++)
+        type = type->next;
+
+    CommandArgs* fields = command_args_allocate(0);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        Location location = protocol_get_location(reader);
+        Region region = {
+            range_create(location.x, location.x, 1),
+            range_create(location.y, location.y, 1),
+            range_create(location.z, location.z, 1)
+        };
+
+        journal_node(&region, type->name, fields);
+        world_set_region(world, &region, protocol_node_set_callback, type);
+    }
+    command_args_free(fields);
+
+    protocol_put_u32(count);
+}
+
+static int32_t protocol_field_value(Node* node, const char* name)
+{
+    Field* field;
+    unsigned int index;
+    if (NODE_IS_EMPTY(node) || node->data->type == NULL ||
+        (field = type_find_field(node->data->type, name, &index)) == NULL)
+        return PROTOCOL_NIL;
+
+    switch (field->type)
+    {
+        case FIELD_INTEGER:
+            return FIELD_GET(node, index, integer);
+
+        case FIELD_DIRECTION:
+            return FIELD_GET(node, index, direction);
+
+        case FIELD_STRING:
+            break;
+    }
+
+    return PROTOCOL_NIL;
+}
+
+static void protocol_field_get(ProtocolReader* reader)
+{
+    char* name = protocol_get_string(reader);
+    uint32_t count = protocol_get_count(reader, LOCATION_SIZE);
+    if (reader->failed)
+    {
+        free(name);
+        return;
+    }
+
+    protocol_put_u32(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        Node node;
+        world_get_node(world, protocol_get_location(reader), &node);
+        protocol_put_u32(protocol_field_value(&node, name));
+    }
+
+    free(name);
+}
+
+struct protocol_field_set_args {
+    const char* name;
+    int32_t value;
+};
+
+static void protocol_field_set_callback(UNUSED Location location, Node* node, void* args)
+{
+    const char* name = ((struct protocol_field_set_args*)args)->name;
+    int32_t value = ((struct protocol_field_set_args*)args)->value;
+
+    Type* type = protocol_node_type(node);
+    unsigned int index;
+    Field* field = type_find_field(type, name, &index);
+    if (NODE_IS_EMPTY(node) || node->data == world->root || node->data->type == NULL || field == NULL)
+    {
+        protocol_fail("The type '%s' doesn't have the field '%s'\n", type->name, name);
+        return;
+    }
+
+    switch (field->type)
+    {
+        case FIELD_INTEGER:
+            FIELD_SET(node, index, integer, value);
+            break;
+
+        case FIELD_DIRECTION:
+            if (value < 0 || value >= DIRECTIONS_COUNT)
+                protocol_fail("'%d' is not a direction\n", value);
+            else
+                FIELD_SET(node, index, direction, (Direction)value);
+            break;
+
+        case FIELD_STRING:
+            protocol_fail("The field '%s' can't be set with an integer\n", name);
+            break;
+    }
+}
+
+static void protocol_field_set(ProtocolReader* reader)
+{
+    char* name = protocol_get_string(reader);
+    uint32_t count = protocol_get_count(reader, LOCATION_SIZE + sizeof(int32_t));
+    if (reader->failed)
+    {
+        free(name);
+        return;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        Location location = protocol_get_location(reader);
+        struct protocol_field_set_args args = {name, protocol_get_u32(reader)};
+        Region region = {
+            range_create(location.x, location.x, 1),
+            range_create(location.y, location.y, 1),
+            range_create(location.z, location.z, 1)
+        };
+
+        // The journal only knows the text representation of values
+        char value[16];
+        snprintf(value, sizeof(value), "%d", args.value);
+        journal_field(&region, name, value);
+
+        world_edit_region(world, &region, protocol_field_set_callback, &args);
+    }
+
+    free(name);
+    protocol_put_u32(count);
+}
+
+static void protocol_tick(ProtocolReader* reader)
+{
+    uint32_t count = protocol_get_u32(reader);
+    if (reader->failed)
+        return;
+
+    command_tick(count > INT_MAX ? INT_MAX : count, LOG_QUIET);
+    protocol_put_u64(world->ticks);
+}
+
+struct protocol_region_get_args {
+    TypeCache cache;
+    uint32_t count;
+};
+
+static void protocol_region_get_callback(Location location, Node* node, void* args)
+{
+    struct protocol_region_get_args* data = args;
+    Type* type = protocol_node_type(node);
+    if (type == type_data_get_default_type(world->type_data))
+        return;
+
+    protocol_put_location(location);
+    protocol_put_u16(protocol_cached_type_index(&data->cache, type));
+    data->count++;
+}
+
+static void protocol_region_get(ProtocolReader* reader)
+{
+    Location start = protocol_get_location(reader);
+    Location end = protocol_get_location(reader);
+    if (reader->failed)
+        return;
+
+    if (start.x > end.x) SWAP(start.x, end.x);
+    if (start.y > end.y) SWAP(start.y, end.y);
+    if (start.z > end.z) SWAP(start.z, end.z);
+
+    Region region = {
+        range_create(start.x, end.x, 1),
+        range_create(start.y, end.y, 1),
+        range_create(start.z, end.z, 1)
+    };
+
+    size_t count_index = response.index;
+    protocol_put_u32(0);
+
+    struct protocol_region_get_args args = {{NULL, 0}, 0};
+    world_get_region(world, &region, protocol_region_get_callback, &args);
+    protocol_set_u32(count_index, args.count);
+}
+
+static void protocol_run(uint8_t op, ProtocolReader* reader)
+{
+    response.index = 0;
+    failed = false;
+
+    protocol_put_u32(0);
+    protocol_put_u8(op);
+
+    switch (op)
+    {
+        case PROTOCOL_PING:       break;
+        case PROTOCOL_TYPES:      protocol_types(); break;
+        case PROTOCOL_NODE_GET:   protocol_node_get(reader); break;
+        case PROTOCOL_NODE_SET:   protocol_node_set(reader); break;
+        case PROTOCOL_FIELD_GET:  protocol_field_get(reader); break;
+        case PROTOCOL_FIELD_SET:  protocol_field_set(reader); break;
+        case PROTOCOL_TICK:       protocol_tick(reader); break;
+        case PROTOCOL_REGION_GET: protocol_region_get(reader); break;
+        default:                  protocol_fail("Unknown op %d\n", op); break;
+    }
+
+    if (reader->failed && !failed)
+        protocol_fail("Malformed request for op %d\n", op);
+
+    if (failed)
+    {
+        response.index = 0;
+        protocol_put_u32(0);
+        protocol_put_u8(PROTOCOL_ERROR);
+        protocol_put_string(error_message);
+    }
+
+    protocol_set_u32(0, response.index - sizeof(uint32_t));
+    repl_write(response.data, response.index);
+}
+
+// Runs every complete frame in the data.  Returns false if the data can't be
+// a valid frame and the connection should be dropped.  Otherwise `consumed`
+// is the number of bytes used and `needed` the number of bytes the next
+// frame takes in total.
+bool protocol_consume(const char* data, size_t size, size_t* consumed, size_t* needed)
+{
+    *consumed = 0;
+    *needed = sizeof(uint32_t);
+
+    while (size - *consumed >= sizeof(uint32_t))
+    {
+        ProtocolReader header = {(const unsigned char*)data + *consumed, size - *consumed, 0, false};
+        uint32_t length = protocol_get_u32(&header);
+        if (length == 0 || length > PROTOCOL_MAX_FRAME)
+            return false;
+
+        *needed = sizeof(uint32_t) + length;
+        if (size - *consumed < *needed)
+            return true;
+
+        uint8_t op = header.data[header.index];
+        ProtocolReader reader = {header.data + header.index + 1, length - 1, 0, false};
+        protocol_run(op, &reader);
+
+        *consumed += *needed;
+        *needed = sizeof(uint32_t);
+    }
+
+    return true;
+}
+
+// Only the first error is kept and replaces the reply to the request
+void protocol_error(const char* format, va_list ap)
+{
+    if (failed)
+        return;
+
+    vsnprintf(error_message, ERROR_SIZE, format, ap);
+
+    // Errors are written for the text protocol, drop the line break
+    size_t length = strlen(error_message);
+    if (length > 0 && error_message[length - 1] == '\n')
+        error_message[length - 1] = '\0';
+
+    failed = true;
+}
+
+void protocol_cleanup(void)
+{
+    free(response.data);
+    response = (ProtocolBuffer){NULL, 0, 0};
+}
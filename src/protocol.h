@@ -0,0 +1,60 @@
+/* protocol.h - Binary protocol for bulk node and field traffic
+ *
+ * Copyright (C) 2014 Ryan Mendivil <ryan@nullreff.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redpile nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef REDPILE_PROTOCOL_H
+#define REDPILE_PROTOCOL_H
+
+#include "common.h"
+#include <stdarg.h>
+
+// Connections that open with these bytes followed by a version byte speak
+// the binary protocol instead of text.  See protocol.c for the format.
+#define PROTOCOL_MAGIC "\0RPB"
+#define PROTOCOL_MAGIC_SIZE 4
+#define PROTOCOL_VERSION 1
+#define PROTOCOL_MAX_FRAME (64 * 1024 * 1024)
+
+typedef enum {
+    PROTOCOL_PING       = 0x00,
+    PROTOCOL_TYPES      = 0x01,
+    PROTOCOL_NODE_GET   = 0x02,
+    PROTOCOL_NODE_SET   = 0x03,
+    PROTOCOL_FIELD_GET  = 0x04,
+    PROTOCOL_FIELD_SET  = 0x05,
+    PROTOCOL_TICK       = 0x06,
+    PROTOCOL_REGION_GET = 0x07,
+    PROTOCOL_ERROR      = 0xFF
+} ProtocolOp;
+
+bool protocol_consume(const char* data, size_t size, size_t* consumed, size_t* needed);
+void protocol_error(const char* format, va_list ap);
+void protocol_cleanup(void);
+
+#endif
@@ -0,0 +1,338 @@
+/* query.c - Region reads split into pages with server side cursors
+ *
+ * Copyright (C) 2014 Ryan Mendivil <ryan@nullreff.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redpile nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "query.h"
+#include "repl.h"
+
+// A query remembers how far through its region it got instead of keeping
+// any of the world around, so an open cursor costs nothing until the
+// client asks for the next page.  Pages are only consistent with each
+// other while the world stays the same, so once anything changes the
+// cursor expires and the client has to start over.
+//
+// Sparse queries only return nodes that have a type other than the
+// default one, and pick whichever way of finding them touches the least:
+//
+//  * QUERY_DENSE looks up every location in the region, for regions with
+//    fewer locations than the world has nodes.
+//  * QUERY_CHUNKS walks the octree of every chunk the region overlaps,
+//    skipping chunks that don't exist, for regions covering fewer chunks
+//    than the world has nodes.
+//  * QUERY_INDEX goes through world->nodes and skips nodes outside the
+//    region, for everything else.
+//
+// Sparse results come back in whatever order the strategy finds them.
+
+static Query* queries = NULL;
+static unsigned int query_count = 0;
+static unsigned int next_id = 1;
+
+#define RANGE_LOW(R) ((R).start > (R).end ? (R).end : (R).start)
+#define RANGE_HIGH(R) ((R).start > (R).end ? (R).start : (R).end)
+
+static unsigned long long query_axis_size(Range range)
+{
+    return ((long long)RANGE_HIGH(range) - RANGE_LOW(range)) / abs(range.step) + 1;
+}
+
+static int query_axis_coord(Range range, unsigned long long index)
+{
+    return RANGE_LOW(range) + (long long)index * abs(range.step);
+}
+
+static unsigned long long query_axis_chunks(Range range)
+{
+    return (long long)(RANGE_HIGH(range) >> CHUNK_BITS) - (RANGE_LOW(range) >> CHUNK_BITS) + 1;
+}
+
+// Regions spanning most of the coordinate space would overflow
+static unsigned long long query_volume(unsigned long long x, unsigned long long y, unsigned long long z)
+{
+    unsigned long long result;
+    if (__builtin_mul_overflow(x, y, &result) || __builtin_mul_overflow(result, z, &result))
+        return ULLONG_MAX;
+    return result;
+}
+
+void query_init(Query* query, World* world, Region* region, char* field, unsigned int limit, bool sparse)
+{
+    query->id = 0;
+    query->region = *region;
+    query->field = field;
+    query->limit = limit;
+    query->sparse = sparse;
+    query->owner = NULL;
+    query->world = world;
+    query->version = world->version;
+    query->position = 0;
+    query->area = query_volume(query_axis_size(region->x), query_axis_size(region->y), query_axis_size(region->z));
+    query->chunks = query_volume(query_axis_chunks(region->x), query_axis_chunks(region->y), query_axis_chunks(region->z));
+    query->chunk_offset = 0;
+    query->index = hashmap_get_iterator(&world->nodes);
+
+    unsigned long long nodes = world->nodes.count;
+    if (!sparse || query->area <= nodes)
+        query->strategy = QUERY_DENSE;
+    else if (query->chunks <= nodes)
+        query->strategy = QUERY_CHUNKS;
+    else
+        query->strategy = QUERY_INDEX;
+}
+
+Query* query_allocate(World* world, Region* region, char* field, unsigned int limit, bool sparse, void* owner)
+{
+    if (query_count >= QUERY_MAX_CURSORS)
+    {
+        repl_print_error("There are too many open cursors, read the rest of one first\n");
+        return NULL;
+    }
+
+    Query* query = malloc(sizeof(Query));
+    CHECK_OOM(query);
+    query_init(query, world, region, field != NULL ? strdup(field) : NULL, limit, sparse);
+
+    // Zero is never used so it can mean a query is finished
+    query->id = next_id++;
+    if (next_id == 0)
+        next_id = 1;
+    query->owner = owner;
+
+    query->next = queries;
+    queries = query;
+    query_count++;
+    return query;
+}
+
+Query* query_find(World* world, unsigned int id, void* owner)
+{
+    for (Query* query = queries; query != NULL; query = query->next)
+    {
+        if (query->id != id || query->owner != owner)
+            continue;
+
+        if (query->world != world || query->version != world->version)
+        {
+            repl_print_error("The cursor %u has expired since the world changed\n", id);
+            query_free(query);
+            return NULL;
+        }
+
+        return query;
+    }
+
+    repl_print_error("Unknown cursor %u\n", id);
+    return NULL;
+}
+
+static bool query_is_set(Query* query, Node* node)
+{
+    return !NODE_IS_EMPTY(node) && node->data->type != NULL &&
+           node->data->type != type_data_get_default_type(query->world->type_data);
+}
+
+static void query_run_dense(Query* query, unsigned int limit, void (*callback)(Location l, Node* n, void* args), void* args)
+{
+    unsigned long long y_size = query_axis_size(query->region.y);
+    unsigned long long z_size = query_axis_size(query->region.z);
+
+    unsigned int count = 0;
+    for (; query->position < query->area && count < limit; query->position++)
+    {
+        unsigned long long index = query->position;
+        Location location = location_create(
+            query_axis_coord(query->region.x, index / (y_size * z_size)),
+            query_axis_coord(query->region.y, index / z_size % y_size),
+            query_axis_coord(query->region.z, index % z_size));
+
+        Node node;
+        world_get_node(query->world, location, &node);
+        if (query->sparse && !query_is_set(query, &node))
+            continue;
+
+        callback(location, &node, args);
+        count++;
+    }
+}
+
+struct query_chunk_args {
+    Query* query;
+    void (*callback)(Location l, Node* n, void* args);
+    void* args;
+    unsigned int skip;
+    unsigned int remaining;
+    bool more;
+};
+
+static void query_chunk_callback(Node* node, void* args)
+{
+    struct query_chunk_args* chunk = args;
+    if (!region_contains(&chunk->query->region, node->location) || !query_is_set(chunk->query, node))
+        return;
+
+    if (chunk->skip > 0)
+    {
+        chunk->skip--;
+    }
+    else if (chunk->remaining == 0)
+    {
+        chunk->more = true;
+    }
+    else
+    {
+        chunk->callback(node->location, node, chunk->args);
+        chunk->remaining--;
+    }
+}
+
+// Chunks are walked in the same order as locations are in dense reads,
+// and a page can end part way through one
+static void query_run_chunks(Query* query, unsigned int limit, void (*callback)(Location l, Node* n, void* args), void* args)
+{
+    unsigned long long y_size = query_axis_chunks(query->region.y);
+    unsigned long long z_size = query_axis_chunks(query->region.z);
+
+    struct query_chunk_args chunk = {query, callback, args, 0, limit, false};
+    while (query->position < query->chunks && chunk.remaining > 0)
+    {
+        unsigned long long index = query->position;
+        Location key = location_create(
+            (RANGE_LOW(query->region.x) >> CHUNK_BITS) + (int)(index / (y_size * z_size)),
+            (RANGE_LOW(query->region.y) >> CHUNK_BITS) + (int)(index / z_size % y_size),
+            (RANGE_LOW(query->region.z) >> CHUNK_BITS) + (int)(index % z_size));
+
+        unsigned int before = chunk.remaining;
+        chunk.skip = query->chunk_offset;
+        chunk.more = false;
+        world_each_chunk_node(query->world, key, query_chunk_callback, &chunk);
+
+        if (chunk.more)
+        {
+            query->chunk_offset += before - chunk.remaining;
+        }
+        else
+        {
+            query->position++;
+            query->chunk_offset = 0;
+        }
+    }
+
+    if (query->position == query->chunks)
+        query->position = query->area;
+}
+
+static void query_run_index(Query* query, unsigned int limit, void (*callback)(Location l, Node* n, void* args), void* args)
+{
+    unsigned int count = 0;
+    Node node;
+    while (count < limit)
+    {
+        if (!cursor_next(&query->index, &node.location, (void**)&node.data))
+        {
+            query->position = query->area;
+            break;
+        }
+
+        if (!region_contains(&query->region, node.location) || !query_is_set(query, &node))
+            continue;
+
+        callback(node.location, &node, args);
+        count++;
+    }
+}
+
+// Reads the next page of the query.  Returns true once the whole region
+// has been read.
+bool query_run(Query* query, void (*callback)(Location l, Node* n, void* args), void* args)
+{
+    switch (query->strategy)
+    {
+        case QUERY_DENSE:
+            query_run_dense(query, query->limit, callback, args);
+            break;
+
+        case QUERY_CHUNKS:
+            query_run_chunks(query, query->limit, callback, args);
+            break;
+
+        case QUERY_INDEX:
+            query_run_index(query, query->limit, callback, args);
+            break;
+    }
+
+    return query->position == query->area;
+}
+
+void query_free(Query* query)
+{
+    for (Query** link = &queries; *link != NULL; link = &(*link)->next)
+    {
+        if (*link == query)
+        {
+            *link = query->next;
+            break;
+        }
+    }
+
+    query_count--;
+    free(query->field);
+    free(query);
+}
+
+void query_remove_owner(void* owner)
+{
+    Query* query = queries;
+    while (query != NULL)
+    {
+        Query* next = query->next;
+        if (query->owner == owner)
+            query_free(query);
+        query = next;
+    }
+}
+
+// Called before a world is freed so a later world allocated at the same
+// address can't pick up its cursors
+void query_remove_world(World* world)
+{
+    Query* query = queries;
+    while (query != NULL)
+    {
+        Query* next = query->next;
+        if (query->world == world)
+            query_free(query);
+        query = next;
+    }
+}
+
+void query_cleanup(void)
+{
+    while (queries != NULL)
+        query_free(queries);
+}
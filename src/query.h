@@ -0,0 +1,82 @@
+/* query.h - Region reads split into pages with server side cursors
+ *
+ * Copyright (C) 2014 Ryan Mendivil <ryan@nullreff.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redpile nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef REDPILE_QUERY_H
+#define REDPILE_QUERY_H
+
+#include "world.h"
+#include "hashmap.h"
+
+#define QUERY_MAX_CURSORS 1024
+
+// How sparse reads find the nodes in their region, see query.c
+typedef enum {
+    QUERY_DENSE,
+    QUERY_CHUNKS,
+    QUERY_INDEX
+} QueryStrategy;
+
+typedef struct Query {
+    unsigned int id;
+    Region region;
+    char* field;
+    unsigned int limit;
+    bool sparse;
+    QueryStrategy strategy;
+    void* owner;
+
+    // The world and version the query was started on, any change to the
+    // world expires it
+    World* world;
+    unsigned long long version;
+
+    // The next location to read, counting in FOR_REGION order, or the next
+    // chunk and how many of its nodes have been read
+    unsigned long long position;
+    unsigned long long area;
+    unsigned long long chunks;
+    unsigned int chunk_offset;
+
+    // Where reads over world->nodes got to
+    Cursor index;
+
+    struct Query* next;
+} Query;
+
+void query_init(Query* query, World* world, Region* region, char* field, unsigned int limit, bool sparse);
+Query* query_allocate(World* world, Region* region, char* field, unsigned int limit, bool sparse, void* owner);
+Query* query_find(World* world, unsigned int id, void* owner);
+bool query_run(Query* query, void (*callback)(Location l, Node* n, void* args), void* args);
+void query_free(Query* query);
+void query_remove_owner(void* owner);
+void query_remove_world(World* world);
+void query_cleanup(void);
+
+#endif
@@ -30,6 +30,7 @@
 
 #include "queue.h"
 #include "repl.h"
+#include "memory.h"
 #include <inttypes.h>
 
 static bool queue_data_equals(QueueData* n1, QueueData* n2)
@@ -49,6 +50,11 @@ void queue_init(Queue* queue, bool track_targets, bool track_sources, unsigned i
     hashmap_init(&queue->sourcemap, track_sources ? size : 0);
 }
 
+static void queue_index_free(void* value)
+{
+    memory_free(MEMORY_QUEUES, value);
+}
+
 void queue_free(Queue* queue)
 {
     QueueNode* node = queue->nodes;
@@ -56,13 +62,13 @@ void queue_free(Queue* queue)
     {
         QueueNode* temp = node->next;
         if (node->data.type == SM_DATA)
-            free(node->data.value.string);
-        free(node);
+            memory_free(MEMORY_STRINGS, node->data.value.string);
+        memory_free(MEMORY_QUEUES, node);
         node = temp;
     }
 
-    hashmap_free(&queue->targetmap, free);
-    hashmap_free(&queue->sourcemap, free);
+    hashmap_free(&queue->targetmap, queue_index_free);
+    hashmap_free(&queue->sourcemap, queue_index_free);
 }
 
 void queue_push(Queue* queue, QueueNode* node)
@@ -74,7 +80,7 @@ void queue_push(Queue* queue, QueueNode* node)
         QueueNodeIndex* index;
         if (bucket->value == NULL)
         {
-            index = malloc(sizeof(QueueNodeIndex));
+            index = memory_malloc(MEMORY_QUEUES, sizeof(QueueNodeIndex));
             index->size = 0;
             index->node = NULL;
             bucket->value = index;
@@ -125,7 +131,7 @@ void queue_push(Queue* queue, QueueNode* node)
         Bucket* bucket = hashmap_get(&queue->sourcemap, node->data.source.location, true);
         if (bucket->value == NULL)
         {
-            QueueNodeList* source_list = malloc(sizeof(QueueNodeList) +  sizeof(QueueNode));
+            QueueNodeList* source_list = memory_malloc(MEMORY_QUEUES, sizeof(QueueNodeList) +  sizeof(QueueNode));
             CHECK_OOM(source_list);
             source_list->size = 1;
             source_list->nodes[0] = node;
@@ -137,7 +143,7 @@ void queue_push(Queue* queue, QueueNode* node)
             unsigned int new_size = source_list->size + 1;
 
             // TODO: Pre-allocate space instead of reallocating on each add
-            source_list = realloc(source_list, sizeof(QueueNodeList) + (sizeof(QueueNode) * new_size));
+            source_list = memory_realloc(MEMORY_QUEUES, source_list, sizeof(QueueNodeList) + (sizeof(QueueNode) * new_size));
             CHECK_OOM(source_list);
             source_list->size = new_size;
             source_list->nodes[new_size - 1] = node;
@@ -182,13 +188,13 @@ void queue_remove(Queue* queue, QueueNode* node)
     if (node->next != NULL)
         node->next->prev = node->prev;
 
-    free(node);
+    memory_free(MEMORY_QUEUES, node);
     queue->count--;
 }
 
 void queue_add_system(Queue* queue, unsigned int type, Node* source, unsigned int index, FieldValue value)
 {
-    QueueNode* node = malloc(sizeof(QueueNode));
+    QueueNode* node = memory_malloc(MEMORY_QUEUES, sizeof(QueueNode));
     node->data = (QueueData) {
         .source = *source,
         .target = node_empty(),
@@ -202,7 +208,7 @@ void queue_add_system(Queue* queue, unsigned int type, Node* source, unsigned in
 
 void queue_add_message(Queue* queue, unsigned int type, unsigned long long tick, Node* source, Node* target, FieldValue value)
 {
-    QueueNode* node = malloc(sizeof(QueueNode));
+    QueueNode* node = memory_malloc(MEMORY_QUEUES, sizeof(QueueNode));
     node->data = (QueueData) {
         .source = *source,
         .target = *target,
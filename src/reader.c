@@ -0,0 +1,271 @@
+/* reader.c - Read only queries answered off the main thread
+ *
+ * Copyright (C) 2014 Ryan Mendivil <ryan@nullreff.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redpile nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "reader.h"
+#include "command.h"
+#include "redpile.h"
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+// Large NODE and FIELD queries from network clients are answered by a pool
+// of reader threads so they don't hold up ticks or other clients.
+//
+// Readers never touch the live world.  Instead they get a view (see
+// world_view) that shares every chunk with it.  The main thread copies a
+// shared chunk before writing to it, so a view keeps showing the world as
+// it was when the query was made while the main thread carries on.  Views
+// are reused until the world changes and are freed once no query uses them.
+//
+// Reference counts on views and chunks are only touched from the main
+// thread.  Readers hand finished jobs back through a list guarded by a mutex
+// and wake up the main thread with an eventfd.
+
+typedef struct {
+    ReadJob* head;
+    ReadJob* tail;
+} JobQueue;
+
+static pthread_t* threads = NULL;
+static unsigned int thread_count = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static JobQueue waiting = {NULL, NULL};
+static JobQueue finished = {NULL, NULL};
+static bool stopping = false;
+static int event_fd = -1;
+static View* current_view = NULL;
+
+static void queue_push_job(JobQueue* queue, ReadJob* job)
+{
+    job->next = NULL;
+    if (queue->tail != NULL)
+        queue->tail->next = job;
+    else
+        queue->head = job;
+    queue->tail = job;
+}
+
+static ReadJob* queue_pop_job(JobQueue* queue)
+{
+    ReadJob* job = queue->head;
+    if (job != NULL)
+    {
+        queue->head = job->next;
+        if (queue->head == NULL)
+            queue->tail = NULL;
+    }
+    return job;
+}
+
+static void view_release(View* view)
+{
+    if (--view->users > 0 || view == current_view)
+        return;
+
+    world_free(view->world);
+    free(view);
+}
+
+// Reuses the last view as long as the world hasn't changed since
+static View* view_acquire(void)
+{
+    if (current_view != NULL &&
+        (current_view->source != world || current_view->version != world->version))
+    {
+        View* old = current_view;
+        current_view = NULL;
+        old->users++;
+        view_release(old);
+    }
+
+    if (current_view == NULL)
+    {
+        current_view = malloc(sizeof(View));
+        CHECK_OOM(current_view);
+        current_view->world = world_view(world);
+        current_view->source = world;
+        current_view->version = world->version;
+        current_view->users = 0;
+    }
+
+    current_view->users++;
+    return current_view;
+}
+
+static void reader_run(ReadJob* job)
+{
+    repl_capture(&job->output);
+    switch (job->type)
+    {
+        case READ_NODE:
+            command_node_read(job->view->world, &job->region);
+            break;
+
+        case READ_FIELD:
+            command_field_read(job->view->world, &job->region, job->field);
+            break;
+    }
+    repl_capture(NULL);
+}
+
+static void* reader_thread(UNUSED void* args)
+{
+    pthread_mutex_lock(&lock);
+    while (1)
+    {
+        ReadJob* job = queue_pop_job(&waiting);
+        if (job == NULL)
+        {
+            if (stopping)
+                break;
+
+            pthread_cond_wait(&wake, &lock);
+            continue;
+        }
+
+        pthread_mutex_unlock(&lock);
+        reader_run(job);
+        pthread_mutex_lock(&lock);
+
+        queue_push_job(&finished, job);
+
+        uint64_t one = 1;
+        ssize_t written = write(event_fd, &one, sizeof(uint64_t));
+        WARN_IF(written != sizeof(uint64_t), "Trouble waking the main thread: %s\n", strerror(errno));
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+// Returns a file descriptor that becomes readable once jobs are finished
+int reader_start(unsigned int count)
+{
+    event_fd = eventfd(0, EFD_NONBLOCK);
+    ERROR_IF(event_fd == -1, "Error creating reader event: %s\n", strerror(errno));
+
+    threads = malloc(sizeof(pthread_t) * count);
+    CHECK_OOM(threads);
+
+    // Signals are handled by the main thread
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &previous);
+
+    for (thread_count = 0; thread_count < count; thread_count++)
+    {
+        int result = pthread_create(&threads[thread_count], NULL, reader_thread, NULL);
+        ERROR_IF(result != 0, "Error starting reader thread: %s\n", strerror(result));
+    }
+
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    return event_fd;
+}
+
+bool reader_running(void)
+{
+    return thread_count > 0;
+}
+
+void reader_submit(ReadType type, Region* region, char* field, void* owner)
+{
+    ReadJob* job = malloc(sizeof(ReadJob));
+    CHECK_OOM(job);
+
+    job->type = type;
+    job->region = *region;
+    job->field = field != NULL ? strdup(field) : NULL;
+    job->view = view_acquire();
+    job->owner = owner;
+    job->output = (ReplCapture){NULL, 0, 0};
+
+    pthread_mutex_lock(&lock);
+    queue_push_job(&waiting, job);
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+}
+
+// Takes every finished job, in the order they finished
+ReadJob* reader_collect(void)
+{
+    uint64_t count;
+    if (read(event_fd, &count, sizeof(uint64_t)) == -1 && errno != EAGAIN)
+        WARN("Trouble reading reader event: %s\n", strerror(errno));
+
+    pthread_mutex_lock(&lock);
+    ReadJob* jobs = finished.head;
+    finished = (JobQueue){NULL, NULL};
+    pthread_mutex_unlock(&lock);
+
+    return jobs;
+}
+
+void reader_job_free(ReadJob* job)
+{
+    view_release(job->view);
+    free(job->output.data);
+    free(job->field);
+    free(job);
+}
+
+void reader_stop(void)
+{
+    if (thread_count == 0)
+        return;
+
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&wake);
+    pthread_mutex_unlock(&lock);
+
+    for (unsigned int i = 0; i < thread_count; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+    threads = NULL;
+    thread_count = 0;
+
+    ReadJob* job;
+    while ((job = queue_pop_job(&finished)) != NULL)
+        reader_job_free(job);
+
+    if (current_view != NULL)
+    {
+        View* view = current_view;
+        current_view = NULL;
+        view->users++;
+        view_release(view);
+    }
+
+    close(event_fd);
+    event_fd = -1;
+}
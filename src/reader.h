@@ -0,0 +1,69 @@
+/* reader.h - Read only queries answered off the main thread
+ *
+ * Copyright (C) 2014 Ryan Mendivil <ryan@nullreff.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redpile nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef REDPILE_READER_H
+#define REDPILE_READER_H
+
+#include "world.h"
+#include "repl.h"
+
+// Queries smaller than this are cheaper to answer on the main thread
+#define READER_MIN_AREA 4096
+
+typedef enum {
+    READ_NODE,
+    READ_FIELD
+} ReadType;
+
+typedef struct View {
+    World* world;
+    World* source;
+    unsigned long long version;
+    unsigned int users;
+} View;
+
+typedef struct ReadJob {
+    ReadType type;
+    Region region;
+    char* field;
+    View* view;
+    void* owner;
+    ReplCapture output;
+    struct ReadJob* next;
+} ReadJob;
+
+int reader_start(unsigned int threads);
+bool reader_running(void);
+void reader_submit(ReadType type, Region* region, char* field, void* owner);
+ReadJob* reader_collect(void);
+void reader_job_free(ReadJob* job);
+void reader_stop(void);
+
+#endif
@@ -0,0 +1,146 @@
+/* realtime.c - Ticks the world on its own at a fixed rate
+ *
+ * Copyright (C) 2014 Ryan Mendivil <ryan@nullreff.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redpile nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "realtime.h"
+#include "command.h"
+#include "repl.h"
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/timerfd.h>
+
+// With --tick-rate the world ticks on a timerfd instead of waiting for
+// TICK commands.  The repl watches the timer along with its clients so
+// commands are run between ticks.  Reading the timer tells how many ticks
+// have come due since the last read, anything past the first is backlog
+// from a tick or command that took too long.  That backlog is either run
+// as one batch (catchup) or dropped (skip).
+
+// Never try to catch up on more than a second of ticks at once
+#define MAX_CATCHUP(RATE) (RATE)
+
+typedef struct {
+    unsigned long long ticks;
+    unsigned long long skipped;
+    unsigned long long overruns;
+    unsigned long long total_us;
+    long long last_us;
+    long long max_us;
+    unsigned long long backlog;
+    unsigned long long max_backlog;
+} RealtimeStats;
+
+static int timer_fd = -1;
+static unsigned int tick_rate;
+static long long tick_budget;
+static RealtimeOverload tick_overload;
+static RealtimeStats stats;
+
+static long long get_time(void)
+{
+    struct timespec value;
+    clock_gettime(CLOCK_MONOTONIC, &value);
+    return ((long long)value.tv_sec) * 1000000 + value.tv_nsec / 1000;
+}
+
+// Returns a file descriptor that becomes readable whenever ticks are due
+int realtime_start(unsigned int rate, RealtimeOverload overload)
+{
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    ERROR_IF(timer_fd == -1, "Error creating tick timer: %s\n", strerror(errno));
+
+    long long period = 1000000000LL / rate;
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = period / 1000000000LL;
+    spec.it_interval.tv_nsec = period % 1000000000LL;
+    spec.it_value = spec.it_interval;
+
+    int result = timerfd_settime(timer_fd, 0, &spec, NULL);
+    ERROR_IF(result == -1, "Error starting tick timer: %s\n", strerror(errno));
+
+    tick_rate = rate;
+    tick_budget = 1000000 / rate;
+    tick_overload = overload;
+    memset(&stats, 0, sizeof(RealtimeStats));
+    return timer_fd;
+}
+
+void realtime_run(void)
+{
+    uint64_t due;
+    if (read(timer_fd, &due, sizeof(uint64_t)) != sizeof(uint64_t))
+        return;
+
+    stats.backlog = due - 1;
+    if (stats.max_backlog < stats.backlog)
+        stats.max_backlog = stats.backlog;
+
+    uint64_t count = tick_overload == OVERLOAD_SKIP ? 1 : due;
+    if (count > MAX_CATCHUP(tick_rate))
+        count = MAX_CATCHUP(tick_rate);
+    stats.skipped += due - count;
+
+    long long start = get_time();
+    command_tick(count, LOG_QUIET);
+    long long duration = get_time() - start;
+
+    stats.ticks += count;
+    stats.total_us += duration;
+    stats.last_us = duration / count;
+    if (stats.max_us < stats.last_us)
+        stats.max_us = stats.last_us;
+    if (stats.last_us > tick_budget)
+        stats.overruns += count;
+}
+
+void realtime_print_status(void)
+{
+    if (timer_fd == -1)
+        return;
+
+    repl_print("tick_rate: %u\n", tick_rate);
+    repl_print("tick_overload: %s\n", tick_overload == OVERLOAD_SKIP ? "skip" : "catchup");
+    repl_print("tick_budget_us: %lld\n", tick_budget);
+    repl_print("tick_last_us: %lld\n", stats.last_us);
+    repl_print("tick_avg_us: %llu\n", stats.ticks > 0 ? stats.total_us / stats.ticks : 0);
+    repl_print("tick_max_us: %lld\n", stats.max_us);
+    repl_print("tick_overruns: %llu\n", stats.overruns);
+    repl_print("tick_backlog: %llu\n", stats.backlog);
+    repl_print("tick_max_backlog: %llu\n", stats.max_backlog);
+    repl_print("tick_skipped: %llu\n", stats.skipped);
+}
+
+void realtime_stop(void)
+{
+    if (timer_fd != -1)
+        close(timer_fd);
+    timer_fd = -1;
+}
@@ -35,7 +35,15 @@
 #include "type.h"
 #include "common.h"
 #include "repl.h"
+#include "journal.h"
+#include "snapshot.h"
+#include "reader.h"
+#include "watch.h"
+#include "mirror.h"
+#include "query.h"
+#include "tick.h"
 #include <getopt.h>
+#include <strings.h>
 #include <signal.h>
 #include <ctype.h>
 
@@ -56,6 +64,8 @@ static void print_help()
            "Options:\n"
            "    -p <port>, --port <port>\n"
            "        Listen on the specified port for commands\n\n"
+           "    --socket <path>\n"
+           "        Listen on a Unix domain socket for commands, which can also use shared memory\n\n"
            "    -i, --interactive\n"
            "        Run in interactive mode with a prompt for reading commands\n\n"
            "    -w <size>, --world-size <size>\n"
@@ -65,7 +75,29 @@ static void print_help()
            "    -h, --help\n"
            "        Print this message\n\n"
            "    --benchmark <milliseconds>\n"
-           "        Run each benchmark for the time specified\n");
+           "        Run each benchmark for the time specified\n\n"
+           "    --benchmark-format <text|json>\n"
+           "        Print benchmark results as a table or as JSON\n\n"
+           "    --benchmark-baseline <file>\n"
+           "        Compare benchmark results to JSON saved from an earlier run\n\n"
+           "    --benchmark-threshold <percent>\n"
+           "        Fail when a benchmark is this much slower than the baseline (default 10)\n\n"
+           "    --load <snapshot>\n"
+           "        Load the world from a snapshot created with SAVE\n\n"
+           "    --journal <file>\n"
+           "        Replay and then append every change to the world to a journal\n\n"
+           "    --journal-interval <milliseconds>\n"
+           "        The longest a change waits before being synced to the journal\n\n"
+           "    --journal-buffer <bytes>\n"
+           "        The number of bytes to buffer before syncing the journal\n\n"
+           "    --tick-rate <ticks>\n"
+           "        Tick the world on its own this many times a second (requires --port or --socket)\n\n"
+           "    --tick-overload <catchup|skip>\n"
+           "        Whether to run or drop ticks that fell behind schedule\n\n"
+           "    --reader-threads <count>\n"
+           "        The number of threads answering large queries from clients (default 2)\n\n"
+           "    --perf-counters\n"
+           "        Count cycles, instructions and cache and branch misses for each phase of a tick, see STATUS\n");
 }
 
 static unsigned int parse_world_size(char* string)
@@ -91,6 +123,83 @@ static unsigned int parse_benchmark_size(char* string)
     return (unsigned int)value;
 }
 
+static BenchFormat parse_benchmark_format(char* string)
+{
+    if (strcasecmp(string, "text") == 0)
+        return BENCH_TEXT;
+    if (strcasecmp(string, "json") == 0)
+        return BENCH_JSON;
+
+    ERROR("You must pass either text or json as the benchmark format\n");
+}
+
+static unsigned int parse_benchmark_threshold(char* string)
+{
+    char* parse_error = NULL;
+    int value = strtol(string, &parse_error, 10);
+
+    ERROR_IF(*parse_error, "You must pass an integer as the benchmark threshold\n");
+    ERROR_IF(value < 0, "You must provide a benchmark threshold of zero or greater\n");
+
+    return (unsigned int)value;
+}
+
+static unsigned int parse_journal_interval(char* string)
+{
+    char* parse_error = NULL;
+    int value = strtol(string, &parse_error, 10);
+
+    ERROR_IF(*parse_error, "You must pass an integer as the journal interval\n");
+    ERROR_IF(value < 0, "You must provide a journal interval of zero or greater\n");
+
+    return (unsigned int)value;
+}
+
+static unsigned int parse_journal_buffer(char* string)
+{
+    char* parse_error = NULL;
+    int value = strtol(string, &parse_error, 10);
+
+    ERROR_IF(*parse_error, "You must pass an integer as the journal buffer size\n");
+    ERROR_IF(value < 0, "You must provide a journal buffer size of zero or greater\n");
+
+    return (unsigned int)value;
+}
+
+static unsigned int parse_tick_rate(char* string)
+{
+    char* parse_error = NULL;
+    int value = strtol(string, &parse_error, 10);
+
+    ERROR_IF(*parse_error, "You must pass an integer as the tick rate\n");
+    ERROR_IF(value <= 0, "You must provide a tick rate greater than zero\n");
+    ERROR_IF(value > 1000, "You must provide a tick rate less than or equal to 1000\n");
+
+    return (unsigned int)value;
+}
+
+static RealtimeOverload parse_tick_overload(char* string)
+{
+    if (strcasecmp(string, "catchup") == 0)
+        return OVERLOAD_CATCHUP;
+    if (strcasecmp(string, "skip") == 0)
+        return OVERLOAD_SKIP;
+
+    ERROR("You must pass either catchup or skip as the tick overload\n");
+}
+
+static unsigned int parse_reader_threads(char* string)
+{
+    char* parse_error = NULL;
+    int value = strtol(string, &parse_error, 10);
+
+    ERROR_IF(*parse_error, "You must pass an integer as the number of reader threads\n");
+    ERROR_IF(value < 0, "You must provide a number of reader threads of zero or greater\n");
+    ERROR_IF(value > 64, "You must provide a number of reader threads less than or equal to 64\n");
+
+    return (unsigned int)value;
+}
+
 static unsigned short parse_port_number(char* string)
 {
     char* parse_error = NULL;
@@ -111,17 +220,41 @@ static void load_config(int argc, char* argv[])
     config->world_size = 1;
     config->interactive = false;
     config->port = 0;
+    config->socket = NULL;
     config->benchmark = 0;
+    config->benchmark_format = BENCH_TEXT;
+    config->benchmark_baseline = NULL;
+    config->benchmark_threshold = 10;
+    config->load = NULL;
+    config->journal = NULL;
+    config->journal_interval = 1000;
+    config->journal_buffer = 64 * 1024;
+    config->tick_rate = 0;
+    config->tick_overload = OVERLOAD_CATCHUP;
+    config->reader_threads = 2;
+    config->perf_counters = false;
 
     static struct option long_options[] =
     {
-        {"world-size",  required_argument, NULL, 'w'},
-        {"interactive", no_argument,       NULL, 'i'},
-        {"port",        required_argument, NULL, 'p'},
-        {"version",     no_argument,       NULL, 'v'},
-        {"help",        no_argument,       NULL, 'h'},
-        {"benchmark",   required_argument, NULL, 'b'},
-        {NULL,          0,                 NULL,  0 }
+        {"world-size",          required_argument, NULL, 'w'},
+        {"interactive",         no_argument,       NULL, 'i'},
+        {"port",                required_argument, NULL, 'p'},
+        {"socket",              required_argument, NULL, 'u'},
+        {"version",             no_argument,       NULL, 'v'},
+        {"help",                no_argument,       NULL, 'h'},
+        {"benchmark",           required_argument, NULL, 'b'},
+        {"benchmark-format",    required_argument, NULL, 'f'},
+        {"benchmark-baseline",  required_argument, NULL, 'c'},
+        {"benchmark-threshold", required_argument, NULL, 't'},
+        {"load",                required_argument, NULL, 'l'},
+        {"journal",             required_argument, NULL, 'j'},
+        {"journal-interval",    required_argument, NULL, 'J'},
+        {"journal-buffer",      required_argument, NULL, 'B'},
+        {"tick-rate",           required_argument, NULL, 'r'},
+        {"tick-overload",       required_argument, NULL, 'o'},
+        {"reader-threads",      required_argument, NULL, 'R'},
+        {"perf-counters",       no_argument,       NULL, 'P'},
+        {NULL,                  0,                 NULL,  0 }
     };
 
     while (1)
@@ -133,6 +266,9 @@ static void load_config(int argc, char* argv[])
                 if (optind >= argc)
                     ERROR("You must provide a configuration file\n");
 
+                if (config->tick_rate > 0 && config->port == 0 && config->socket == NULL)
+                    ERROR("You must provide a port or socket to run with a tick rate\n");
+
                 config->file = argv[optind];
                 return;
 
@@ -148,10 +284,58 @@ static void load_config(int argc, char* argv[])
                 config->port = parse_port_number(optarg);
                 break;
 
+            case 'u':
+                config->socket = optarg;
+                break;
+
             case 'b':
                 config->benchmark = parse_benchmark_size(optarg);
                 break;
 
+            case 'f':
+                config->benchmark_format = parse_benchmark_format(optarg);
+                break;
+
+            case 'c':
+                config->benchmark_baseline = optarg;
+                break;
+
+            case 't':
+                config->benchmark_threshold = parse_benchmark_threshold(optarg);
+                break;
+
+            case 'l':
+                config->load = optarg;
+                break;
+
+            case 'j':
+                config->journal = optarg;
+                break;
+
+            case 'J':
+                config->journal_interval = parse_journal_interval(optarg);
+                break;
+
+            case 'B':
+                config->journal_buffer = parse_journal_buffer(optarg);
+                break;
+
+            case 'r':
+                config->tick_rate = parse_tick_rate(optarg);
+                break;
+
+            case 'o':
+                config->tick_overload = parse_tick_overload(optarg);
+                break;
+
+            case 'R':
+                config->reader_threads = parse_reader_threads(optarg);
+                break;
+
+            case 'P':
+                config->perf_counters = true;
+                break;
+
             case 'v':
                 print_version();
                 free(config);
@@ -181,9 +365,20 @@ static void signal_callback(int signal)
 // Referenced from common.h
 void redpile_cleanup(void)
 {
+    realtime_stop();
+    reader_stop();
+    tick_profile_stop();
+    watch_cleanup();
+    mirror_cleanup();
+    query_cleanup();
+    snapshot_cleanup();
+    journal_close();
+
     if (world != NULL)
         world_free(world);
 
+    command_cleanup();
+
     if (state != NULL)
         script_state_free(state);
 
@@ -211,12 +406,25 @@ int main(int argc, char* argv[])
 
     world = world_allocate(config->world_size, type_data);
 
+    if (config->load != NULL && !snapshot_load(world, config->load))
+    {
+        redpile_cleanup();
+        return EXIT_FAILURE;
+    }
+
+    if (config->journal != NULL)
+        journal_open(config->journal, config->journal_interval, config->journal_buffer);
+
+    if (config->perf_counters && !tick_profile_start())
+        WARN("Hardware counters are unavailable: %s\n", strerror(tick_profile_error()));
+
+    bool success = true;
     if (config->benchmark)
-        bench_run(config->benchmark);
+        success = bench_run(config->benchmark, config->benchmark_format, config->benchmark_baseline, config->benchmark_threshold);
     else
         repl_run();
 
     redpile_cleanup();
-    return EXIT_SUCCESS;
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
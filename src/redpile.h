@@ -33,6 +33,8 @@
 
 #include "script.h"
 #include "world.h"
+#include "realtime.h"
+#include "bench.h"
 
 #define REDPILE_VERSION "0.5.0"
 
@@ -40,7 +42,19 @@ typedef struct {
     int world_size;
     bool interactive;
     unsigned short port;
+    char* socket;
     unsigned int benchmark;
+    BenchFormat benchmark_format;
+    char* benchmark_baseline;
+    unsigned int benchmark_threshold;
+    char* load;
+    char* journal;
+    unsigned int journal_interval;
+    unsigned int journal_buffer;
+    unsigned int tick_rate;
+    RealtimeOverload tick_overload;
+    unsigned int reader_threads;
+    bool perf_counters;
     char* file;
 } RedpileConfig;
 
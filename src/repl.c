@@ -30,162 +30,963 @@
 
 #include "redpile.h"
 #include "repl.h"
+#include "journal.h"
+#include "snapshot.h"
+#include "protocol.h"
+#include "reader.h"
+#include "watch.h"
+#include "ring.h"
+#include "query.h"
+#include "parser.h"
 #include "linenoise.h"
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <sys/un.h>
+#include <sys/stat.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <poll.h>
+#include <signal.h>
 
-int listen_fd, comm_fd;
-struct sockaddr_in servaddr;
-bool muted = false;
+// See lexer.l
+int yylex_init(yyscan_t* scanner);
+int yylex_destroy(yyscan_t scanner);
+void lexer_parse(yyscan_t scanner, const char* data, size_t size);
 
-// See parser.y
-int yyparse(void);
-int yylex_destroy(void);
+#define INPUT_BUFF_SIZE 16384
+#define OUTPUT_BLOCK_SIZE (64 * 1024)
+#define OUTPUT_FLUSH_SIZE (1024 * 1024)
+#define OUTPUT_LIMIT (256 * 1024 * 1024)
+#define MAX_EVENTS 64
+#define MAX_IOVECS 64
 
-#define FORMAT_BUFF_SIZE 1000
-char* format_buff;
+// How often to retry writing to shared memory rings that are full
+#define RING_RETRY_MS 1
 
-static int repl_read_network(char* buff, int buffsize)
+// Output waiting to be written to a connection.  Blocks are chained so a
+// large response never has to be copied while it grows.
+typedef struct OutputBlock {
+    struct OutputBlock* next;
+    size_t size;
+    size_t start;
+    size_t end;
+    char data[];
+} OutputBlock;
+
+typedef enum {
+    CLIENT_NEW,
+    CLIENT_TEXT,
+    CLIENT_BINARY
+} ClientMode;
+
+// Every source of commands gets its own input buffer and scanner so that
+// partial lines from one connection never mix with another.  Commands are
+// only ever run one at a time from the main thread.
+typedef struct Client {
+    int fd;
+    ClientMode mode;
+    yyscan_t scanner;
+    char* input;
+    size_t input_size;
+    size_t input_capacity;
+    OutputBlock* output;
+    OutputBlock* output_tail;
+    size_t output_size;
+    Ring* ring;
+    bool local;
+    uint32_t events;
+    unsigned int suspended;
+    bool discard;
+    bool eof;
+    bool closed;
+    struct Client* next;
+} Client;
+
+static int listen_fd = -1;
+static int local_fd = -1;
+static const char* local_path = NULL;
+static int epoll_fd = -1;
+static Client* clients = NULL;
+static Client* console = NULL;
+static Client* current = NULL;
+static bool muted = false;
+static bool rings_full = false;
+static __thread ReplCapture* capture_target = NULL;
+
+// Mark the local socket, tick timer and reader threads in the event queue,
+// the TCP socket is NULL
+static char local_event;
+static char tick_event;
+static char read_event;
+
+static Client* client_allocate(int fd, ClientMode mode)
+{
+    Client* client = malloc(sizeof(Client));
+    CHECK_OOM(client);
+    client->input = malloc(INPUT_BUFF_SIZE);
+    CHECK_OOM(client->input);
+
+    client->fd = fd;
+    client->mode = mode;
+    client->input_size = 0;
+    client->input_capacity = INPUT_BUFF_SIZE;
+    client->output = NULL;
+    client->output_tail = NULL;
+    client->output_size = 0;
+    client->ring = NULL;
+    client->local = false;
+    client->events = EPOLLIN;
+    client->suspended = 0;
+    client->discard = false;
+    client->eof = false;
+    client->closed = false;
+    client->next = NULL;
+
+    ERROR_IF(yylex_init(&client->scanner) != 0, "Error creating scanner: %s\n", strerror(errno));
+    return client;
+}
+
+static void client_free(Client* client)
+{
+    watch_remove_owner(client);
+    query_remove_owner(client);
+
+    if (client->fd != STDIN_FILENO)
+        close(client->fd);
+
+    while (client->output != NULL)
+    {
+        OutputBlock* block = client->output;
+        client->output = block->next;
+        free(block);
+    }
+
+    if (client->ring != NULL)
+        ring_free(client->ring);
+
+    yylex_destroy(client->scanner);
+    free(client->input);
+    free(client);
+}
+
+static void client_parse(Client* client, const char* data, size_t size)
+{
+    current = client;
+    lexer_parse(client->scanner, data, size);
+    current = NULL;
+}
+
+static void client_write(Client* client, const void* data, size_t size);
+
+// Sets up a shared memory ring for a local client and passes it over the
+// socket along with the reply to its request
+static bool client_negotiate_ring(Client* client)
+{
+    if (client->input_size < RING_REQUEST_SIZE)
+        return false;
+
+    uint8_t version = client->input[RING_MAGIC_SIZE];
+    uint8_t protocol = client->input[RING_MAGIC_SIZE + 1];
+    uint32_t size;
+    memcpy(&size, client->input + RING_MAGIC_SIZE + 2, sizeof(size));
+    size = le32toh(size);
+
+    if (version != RING_VERSION || protocol > 1 || !ring_valid_size(size))
+    {
+        WARN("Invalid shared memory request from client, disconnecting it\n");
+        client->closed = true;
+        return false;
+    }
+
+    client->ring = ring_create(size);
+    if (client->ring == NULL)
+    {
+        client->closed = true;
+        return false;
+    }
+
+    // Nothing has been written to the client yet so this can't be out of
+    // order with the rest of its output
+    char reply[RING_MAGIC_SIZE + 1];
+    memcpy(reply, RING_MAGIC, RING_MAGIC_SIZE);
+    reply[RING_MAGIC_SIZE] = RING_VERSION;
+
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec vector = {reply, sizeof(reply)};
+    struct msghdr message = {
+        .msg_iov = &vector,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control)
+    };
+
+    struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(header), &client->ring->fd, sizeof(int));
+
+    if (sendmsg(client->fd, &message, 0) != sizeof(reply))
+    {
+        WARN("Trouble sending shared memory to client: %s\n", strerror(errno));
+        client->closed = true;
+        return false;
+    }
+
+    client->input_size -= RING_REQUEST_SIZE;
+    memmove(client->input, client->input + RING_REQUEST_SIZE, client->input_size);
+    client->mode = protocol == 1 ? CLIENT_BINARY : CLIENT_TEXT;
+    return true;
+}
+
+// A connection that opens with the protocol magic speaks the binary
+// protocol, anything else is text.  Local connections can also ask for a
+// shared memory ring.  Returns false until that's known.
+static bool client_negotiate(Client* client)
+{
+    if (client->input_size == 0)
+        return false;
+
+    if (client->input[0] != PROTOCOL_MAGIC[0])
+    {
+        client->mode = CLIENT_TEXT;
+        return true;
+    }
+
+    if (client->input_size < PROTOCOL_MAGIC_SIZE + 1)
+        return false;
+
+    if (client->local && memcmp(client->input, RING_MAGIC, RING_MAGIC_SIZE) == 0)
+        return client_negotiate_ring(client);
+
+    if (memcmp(client->input, PROTOCOL_MAGIC, PROTOCOL_MAGIC_SIZE) != 0)
+    {
+        client->mode = CLIENT_TEXT;
+        return true;
+    }
+
+    char reply[PROTOCOL_MAGIC_SIZE + 1];
+    memcpy(reply, PROTOCOL_MAGIC, PROTOCOL_MAGIC_SIZE);
+    reply[PROTOCOL_MAGIC_SIZE] = PROTOCOL_VERSION;
+    client_write(client, reply, sizeof(reply));
+
+    client->input_size -= sizeof(reply);
+    memmove(client->input, client->input + sizeof(reply), client->input_size);
+    client->mode = CLIENT_BINARY;
+    return true;
+}
+
+// Runs every complete frame buffered for a binary client and makes room
+// for the next one
+static void client_consume_frames(Client* client)
+{
+    size_t consumed;
+    size_t needed;
+
+    current = client;
+    bool valid = protocol_consume(client->input, client->input_size, &consumed, &needed);
+    current = NULL;
+
+    memmove(client->input, client->input + consumed, client->input_size - consumed);
+    client->input_size -= consumed;
+
+    if (!valid)
+    {
+        WARN("Invalid frame from client, disconnecting it\n");
+        client->closed = true;
+        return;
+    }
+
+    if (needed > client->input_capacity)
+    {
+        client->input = realloc(client->input, needed);
+        CHECK_OOM(client->input);
+        client->input_capacity = needed;
+    }
+}
+
+// Parses every complete line buffered for a client and keeps the partial
+// one at the end until the rest of it arrives
+static void client_consume(Client* client, bool eof)
+{
+    if (client->mode == CLIENT_NEW && !client_negotiate(client))
+        return;
+
+    if (client->mode == CLIENT_BINARY)
+    {
+        client_consume_frames(client);
+        return;
+    }
+
+    if (client->discard)
+    {
+        char* newline = memchr(client->input, '\n', client->input_size);
+        if (newline == NULL)
+        {
+            client->input_size = 0;
+            return;
+        }
+
+        size_t skip = newline - client->input + 1;
+        memmove(client->input, client->input + skip, client->input_size - skip);
+        client->input_size -= skip;
+        client->discard = false;
+    }
+
+    // The grammar ends every command with a line break, so one is added
+    // after the last line once the client is done sending
+    if (eof && client->input_size > 0 && client->input_size < client->input_capacity &&
+        client->input[client->input_size - 1] != '\n')
+        client->input[client->input_size++] = '\n';
+
+    // Lines are parsed one at a time since a command may suspend the client
+    size_t start = 0;
+    while (client->suspended == 0)
+    {
+        char* newline = memchr(client->input + start, '\n', client->input_size - start);
+        size_t end = newline != NULL ? (size_t)(newline - client->input) + 1 : start;
+        if (end == start)
+            break;
+
+        client_parse(client, client->input + start, end - start);
+        start = end;
+    }
+
+    if (start == 0 && client->suspended == 0 && client->input_size == client->input_capacity)
+    {
+        current = client;
+        repl_print_error("Line too long, the maximum is %d characters\n", INPUT_BUFF_SIZE);
+        current = NULL;
+
+        client->input_size = 0;
+        client->discard = true;
+        return;
+    }
+
+    memmove(client->input, client->input + start, client->input_size - start);
+    client->input_size -= start;
+}
+
+static void set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    ERROR_IF(flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1,
+             "Error configuring socket: %s\n", strerror(errno));
+}
+
+static void repl_accept(int server_fd)
+{
+    while (1)
+    {
+        int fd = accept(server_fd, (struct sockaddr*) NULL, NULL);
+        if (fd == -1)
+        {
+            WARN_IF(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR,
+                    "Trouble accepting connection: %s\n", strerror(errno));
+            return;
+        }
+
+        set_nonblocking(fd);
+        Client* client = client_allocate(fd, CLIENT_NEW);
+        client->local = server_fd == local_fd;
+
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = client};
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+        {
+            WARN("Trouble watching connection: %s\n", strerror(errno));
+            client_free(client);
+            continue;
+        }
+
+        client->next = clients;
+        clients = client;
+    }
+}
+
+// Reads once per wakeup so a chatty client can't starve the others
+static void repl_read_network(Client* client)
 {
-    ssize_t size = read(comm_fd, buff, buffsize);
+    if (client->closed || client->eof || client->input_size == client->input_capacity)
+        return;
+
+    ssize_t size = read(client->fd, client->input + client->input_size, client->input_capacity - client->input_size);
     if (size == -1)
     {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return;
+
         WARN("Trouble reading from socket: %s\n", strerror(errno));
-        return 0;
+        client->closed = true;
+    }
+    else if (size == 0)
+    {
+        // The last command doesn't need a newline after it, the client is
+        // closed once everything it sent has been answered
+        client->eof = true;
+        client_consume(client, true);
     }
     else
     {
-        return size;
+        client->input_size += size;
+        client_consume(client, false);
     }
 }
 
-static int repl_read_linenoise(char* buff, int buffsize)
+// Only wait for a connection to be writable while it has output queued, and
+// stop reading commands from it until it catches up or while it's waiting
+// on a reader thread.  Rings are retried on a timer instead.
+static void client_watch(Client* client)
 {
-    char* line = linenoise("> ");
-    if (line == NULL)
-        return 0;
+    uint32_t events;
+    if (client->output != NULL)
+        events = client->ring != NULL ? 0 : EPOLLOUT;
+    else
+        events = client->suspended > 0 ? 0 : EPOLLIN;
 
-    linenoiseHistoryAdd(line);
+    if (client->events == events)
+        return;
 
-    // Linenoise has a buffer size of 4096
-    // Flex has a default buffer size of at least 8192 on 32 bit
-    int size = strlen(line);
-    if (size + 2 > buffsize)
+    struct epoll_event event = {.events = events, .data.ptr = client};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->fd, &event) == -1)
     {
-        WARN("Line too long, truncating to %i\n", buffsize);
-        size = buffsize - 2;
+        WARN("Trouble watching connection: %s\n", strerror(errno));
+        client->closed = true;
     }
 
-    memcpy(buff, line, size);
+    client->events = events;
+}
 
-    // Linenoise strips out the line return
-    buff[size] = '\n';
+// Drops output that has been written from the front of the queue
+static void client_advance(Client* client, size_t written)
+{
+    client->output_size -= written;
+    while (client->output != NULL)
+    {
+        OutputBlock* block = client->output;
+        size_t remaining = block->end - block->start;
+        if (written < remaining)
+        {
+            block->start += written;
+            break;
+        }
 
-    free(line);
-    return size + 1;
+        written -= remaining;
+        client->output = block->next;
+        free(block);
+    }
+
+    if (client->output == NULL)
+        client->output_tail = NULL;
 }
 
-static int repl_read_stdin(char* buff, int buffsize)
+static void client_flush_socket(Client* client)
 {
-    ssize_t size = read(STDIN_FILENO, buff, buffsize);
-    if (size == -1)
+    while (client->output != NULL && !client->closed)
+    {
+        struct iovec vectors[MAX_IOVECS];
+        int count = 0;
+        for (OutputBlock* block = client->output; block != NULL && count < MAX_IOVECS; block = block->next)
+            vectors[count++] = (struct iovec){block->data + block->start, block->end - block->start};
+
+        ssize_t written = writev(client->fd, vectors, count);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+
+            WARN("Trouble writing to socket: %s\n", strerror(errno));
+            client->closed = true;
+            return;
+        }
+
+        client_advance(client, written);
+    }
+}
+
+static void client_flush_ring(Client* client)
+{
+    size_t total = 0;
+    while (client->output != NULL)
     {
-        WARN("Trouble reading from stdin: %s\n", strerror(errno));
-        return 0;
+        OutputBlock* block = client->output;
+        size_t remaining = block->end - block->start;
+        ssize_t written = ring_write(client->ring, block->data + block->start, remaining);
+        if (written == -1)
+        {
+            WARN("Client corrupted its shared memory, disconnecting it\n");
+            client->closed = true;
+            return;
+        }
+
+        total += written;
+        client_advance(client, written);
+        if ((size_t)written < remaining)
+            break;
     }
+
+    if (total > 0)
+        ring_notify(client->ring);
+}
+
+// Writes as much queued output as the socket or ring takes without blocking
+static void client_flush(Client* client)
+{
+    if (client->closed)
+        return;
+
+    if (client->ring != NULL)
+        client_flush_ring(client);
     else
+        client_flush_socket(client);
+
+    if (client->closed)
+        return;
+
+    if (client->output_size > OUTPUT_LIMIT)
     {
-        return size;
+        WARN("Client isn't reading its output, disconnecting it\n");
+        client->closed = true;
+        return;
     }
+
+    client_watch(client);
 }
 
-static void repl_print_network(const char* format, va_list ap)
+static OutputBlock* client_output_block(Client* client, size_t size)
 {
-    size_t count = vsnprintf(format_buff, FORMAT_BUFF_SIZE, format, ap);
-    ssize_t written = write(comm_fd, format_buff, count);
-    WARN_IF(written == -1, "Trouble writing to socket: %s\n", strerror(errno));
+    if (size < OUTPUT_BLOCK_SIZE)
+        size = OUTPUT_BLOCK_SIZE;
+
+    OutputBlock* block = malloc(sizeof(OutputBlock) + size);
+    CHECK_OOM(block);
+
+    block->next = NULL;
+    block->size = size;
+    block->start = 0;
+    block->end = 0;
+
+    if (client->output_tail != NULL)
+        client->output_tail->next = block;
+    else
+        client->output = block;
+
+    client->output_tail = block;
+    return block;
 }
 
-static void repl_print_stdout(const char* format, va_list ap)
+static void client_write(Client* client, const void* data, size_t size)
 {
-    vprintf(format, ap);
+    if (client->closed)
+        return;
+
+    OutputBlock* block = client->output_tail;
+    if (block == NULL || block->size - block->end < size)
+        block = client_output_block(client, size);
+
+    memcpy(block->data + block->end, data, size);
+    block->end += size;
+    client->output_size += size;
+
+    if (client->output_size >= OUTPUT_FLUSH_SIZE)
+        client_flush(client);
 }
 
-static void repl_print_stderr(const char* format, va_list ap)
+static void client_print(Client* client, const char* format, va_list ap)
 {
-    vfprintf(stderr, format, ap);
+    if (client->closed)
+        return;
+
+    OutputBlock* block = client->output_tail;
+    size_t space = block != NULL ? block->size - block->end : 0;
+
+    va_list copy;
+    va_copy(copy, ap);
+    int count = vsnprintf(block != NULL ? block->data + block->end : NULL, space, format, copy);
+    va_end(copy);
+
+    if (count <= 0)
+        return;
+
+    // Didn't fit, start a new block large enough to hold it
+    if ((size_t)count >= space)
+    {
+        block = client_output_block(client, count + 1);
+        vsnprintf(block->data, block->size, format, ap);
+    }
+
+    block->end += count;
+    client->output_size += count;
+
+    if (client->output_size >= OUTPUT_FLUSH_SIZE)
+        client_flush(client);
 }
 
-void repl_run(void)
+// Sends the output of the last batch of commands and forgets clients that
+// have gone away
+static void repl_flush_network(void)
+{
+    rings_full = false;
+
+    Client** link = &clients;
+    while (*link != NULL)
+    {
+        Client* client = *link;
+        if (!(client->events & EPOLLOUT))
+            client_flush(client);
+
+        if (client->ring != NULL && client->output != NULL)
+            rings_full = true;
+
+        if (client->eof && client->suspended == 0 && client->output == NULL)
+            client->closed = true;
+
+        // Clients waiting on a reader thread are freed once it's done
+        if (client->closed && client->suspended == 0)
+        {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+            *link = client->next;
+            client_free(client);
+        }
+        else
+        {
+            link = &client->next;
+        }
+    }
+}
+
+// Sends the answers from reader threads and carries on with the commands
+// their clients sent in the meantime
+static void repl_resume(void)
+{
+    ReadJob* job = reader_collect();
+    while (job != NULL)
+    {
+        ReadJob* next = job->next;
+        Client* client = job->owner;
+
+        client_write(client, job->output.data, job->output.size);
+        client->suspended--;
+        reader_job_free(job);
+
+        if (client->suspended == 0 && !client->closed)
+        {
+            client_consume(client, client->eof);
+            client_watch(client);
+        }
+
+        job = next;
+    }
+}
+
+static int repl_listen_tcp(unsigned short port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ERROR_IF(fd == -1, "Error creating socket: %s\n", strerror(errno));
+
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    set_nonblocking(fd);
+
+    struct sockaddr_in servaddr;
+    memset(&servaddr, 0, sizeof(servaddr));
+    servaddr.sin_family = AF_INET;
+    servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    servaddr.sin_port = htons(port);
+
+    int result;
+    result = bind(fd, (struct sockaddr *) &servaddr, sizeof(servaddr));
+    ERROR_IF(result == -1, "Error binding to socket: %s\n", strerror(errno));
+
+    result = listen(fd, SOMAXCONN);
+    ERROR_IF(result == -1, "Error opening socket: %s\n", strerror(errno));
+
+    printf("Listening on 0.0.0.0:%d\n", port);
+    return fd;
+}
+
+static int repl_listen_local(const char* path)
+{
+    struct sockaddr_un servaddr;
+    memset(&servaddr, 0, sizeof(servaddr));
+    servaddr.sun_family = AF_UNIX;
+    ERROR_IF(strlen(path) >= sizeof(servaddr.sun_path), "The socket path '%s' is too long\n", path);
+    strcpy(servaddr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    ERROR_IF(fd == -1, "Error creating socket: %s\n", strerror(errno));
+    set_nonblocking(fd);
+
+    // Left behind if the last server didn't shut down cleanly
+    struct stat info;
+    if (stat(path, &info) == 0 && S_ISSOCK(info.st_mode))
+        unlink(path);
+
+    int result;
+    result = bind(fd, (struct sockaddr *) &servaddr, sizeof(servaddr));
+    ERROR_IF(result == -1, "Error binding to socket: %s\n", strerror(errno));
+
+    result = listen(fd, SOMAXCONN);
+    ERROR_IF(result == -1, "Error opening socket: %s\n", strerror(errno));
+
+    printf("Listening on %s\n", path);
+    return fd;
+}
+
+static void repl_run_network(void)
 {
-    format_buff = malloc(sizeof(char) * FORMAT_BUFF_SIZE);
+    // Disconnected clients are noticed when writing to them fails
+    signal(SIGPIPE, SIG_IGN);
 
+    epoll_fd = epoll_create1(0);
+    ERROR_IF(epoll_fd == -1, "Error creating event queue: %s\n", strerror(errno));
+
+    int result;
     if (config->port > 0)
     {
-        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-        ERROR_IF(listen_fd == -1, "Error creating socket: %s\n", strerror(errno));
+        listen_fd = repl_listen_tcp(config->port);
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+        result = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+        ERROR_IF(result == -1, "Error watching socket: %s\n", strerror(errno));
+    }
+
+    if (config->socket != NULL)
+    {
+        local_fd = repl_listen_local(config->socket);
+        local_path = config->socket;
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = &local_event};
+        result = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, local_fd, &event);
+        ERROR_IF(result == -1, "Error watching socket: %s\n", strerror(errno));
+    }
+
+    if (config->tick_rate > 0)
+    {
+        struct epoll_event timer = {.events = EPOLLIN, .data.ptr = &tick_event};
+        result = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, realtime_start(config->tick_rate, config->tick_overload), &timer);
+        ERROR_IF(result == -1, "Error watching tick timer: %s\n", strerror(errno));
+    }
+
+    if (config->reader_threads > 0)
+    {
+        struct epoll_event readers = {.events = EPOLLIN, .data.ptr = &read_event};
+        result = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, reader_start(config->reader_threads), &readers);
+        ERROR_IF(result == -1, "Error watching reader threads: %s\n", strerror(errno));
+    }
 
-        memset(&servaddr, 0, sizeof(servaddr));
-        servaddr.sin_family = AF_INET;
-        servaddr.sin_addr.s_addr = htons(INADDR_ANY);
-        servaddr.sin_port = htons(config->port);
+    fflush(stdout);
 
-        int result;
-        result = bind(listen_fd, (struct sockaddr *) &servaddr, sizeof(servaddr));
-        ERROR_IF(result == -1, "Error binding to socket: %s\n", strerror(errno));
+    struct epoll_event events[MAX_EVENTS];
+    while (1)
+    {
+        snapshot_poll();
 
-        result = listen(listen_fd, 10);
-        ERROR_IF(result == -1, "Error opening socket: %s\n", strerror(errno));
+        // Buffered journal records are synced once every client is idle
+        int timeout = journal_pending() ? 0 : rings_full ? RING_RETRY_MS : -1;
+        int count = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+        if (count == -1 && errno == EINTR)
+            continue;
+        ERROR_IF(count == -1, "Error waiting for connections: %s\n", strerror(errno));
 
-        printf("Listening on 0.0.0.0:%d\n", config->port);
+        if (count == 0)
+            journal_flush();
 
-        while (1)
+        for (int i = 0; i < count; i++)
         {
-            comm_fd = accept(listen_fd, (struct sockaddr*) NULL, NULL);
-            WARN_IF(comm_fd == -1, "Trouble accepting connection: %s\n", strerror(errno));
+            void* source = events[i].data.ptr;
+            if (source == NULL)
+                repl_accept(listen_fd);
+            else if (source == &local_event)
+                repl_accept(local_fd);
+            else if (source == &tick_event)
+                realtime_run();
+            else if (source == &read_event)
+                repl_resume();
+            else if (((Client*)source)->events & EPOLLOUT)
+                client_flush(source);
+            else
+                repl_read_network(source);
+        }
 
-            do { result = yyparse(); } while (result != 0);
-            close(comm_fd);
-        };
+        repl_flush_network();
+    }
+}
+
+// Buffered journal records are synced once there's no more input to process
+// so a burst of commands is committed together.
+static void repl_sync_journal(int fd)
+{
+    if (!journal_pending())
+        return;
+
+    struct pollfd input = {fd, POLLIN, 0};
+    if (config->interactive || poll(&input, 1, 0) <= 0)
+        journal_flush();
+}
+
+static void repl_run_linenoise(void)
+{
+    while (1)
+    {
+        repl_sync_journal(STDIN_FILENO);
+        snapshot_poll();
+
+        char* line = linenoise("> ");
+        if (line == NULL)
+            return;
+
+        linenoiseHistoryAdd(line);
+
+        // Linenoise has a buffer size of 4096
+        size_t size = strlen(line);
+        if (size + 1 > INPUT_BUFF_SIZE)
+        {
+            WARN("Line too long, truncating to %i\n", INPUT_BUFF_SIZE);
+            size = INPUT_BUFF_SIZE - 1;
+        }
+
+        memcpy(console->input, line, size);
+
+        // Linenoise strips out the line return
+        console->input[size] = '\n';
+
+        free(line);
+        client_parse(console, console->input, size + 1);
+    }
+}
+
+static void repl_run_stdin(void)
+{
+    while (1)
+    {
+        repl_sync_journal(STDIN_FILENO);
+        snapshot_poll();
+
+        ssize_t size = read(STDIN_FILENO, console->input + console->input_size, INPUT_BUFF_SIZE - console->input_size);
+        if (size == -1 && errno == EINTR)
+            continue;
+
+        if (size == -1)
+        {
+            WARN("Trouble reading from stdin: %s\n", strerror(errno));
+            break;
+        }
+        else if (size == 0)
+        {
+            break;
+        }
+
+        console->input_size += size;
+        client_consume(console, false);
+    }
+
+    client_consume(console, true);
+}
+
+static void repl_print_stdout(const char* format, va_list ap)
+{
+    vprintf(format, ap);
+}
+
+static void repl_print_stderr(const char* format, va_list ap)
+{
+    vfprintf(stderr, format, ap);
+}
+
+void repl_run(void)
+{
+    if (config->port > 0 || config->socket != NULL)
+    {
+        repl_run_network();
     }
     else
     {
-        int result;
-        do { result = yyparse(); } while (result != 0);
+        console = client_allocate(STDIN_FILENO, CLIENT_TEXT);
+
+        if (config->interactive)
+            repl_run_linenoise();
+        else
+            repl_run_stdin();
     }
 }
 
 void repl_cleanup(void)
 {
-    free(format_buff);
-    close(listen_fd);
-    close(comm_fd);
-    yylex_destroy();
+    while (clients != NULL)
+    {
+        Client* client = clients;
+        clients = client->next;
+        client_free(client);
+    }
+
+    if (console != NULL)
+        client_free(console);
+    protocol_cleanup();
+    console = NULL;
+    current = NULL;
+
+    if (epoll_fd != -1)
+        close(epoll_fd);
+    if (listen_fd != -1)
+        close(listen_fd);
+    if (local_fd != -1)
+    {
+        close(local_fd);
+        unlink(local_path);
+    }
+    epoll_fd = listen_fd = local_fd = -1;
 }
 
-int repl_read(char *buff, int buffsize)
+void repl_write(const void* data, size_t size)
 {
-    if (config->port > 0)
-        return repl_read_network(buff, buffsize);
-    else if (config->interactive)
-        return repl_read_linenoise(buff, buffsize);
+    if (current != NULL && current != console)
+        client_write(current, data, size);
     else
-        return repl_read_stdin(buff, buffsize);
+        fwrite(data, 1, size, stdout);
+}
+
+static void repl_print_capture(const char* format, va_list ap)
+{
+    ReplCapture* capture = capture_target;
+
+    va_list copy;
+    va_copy(copy, ap);
+    int count = vsnprintf(capture->data + capture->size, capture->capacity - capture->size, format, copy);
+    va_end(copy);
+
+    if (count <= 0)
+        return;
+
+    if (capture->size + count >= capture->capacity)
+    {
+        while (capture->size + count >= capture->capacity)
+            capture->capacity = capture->capacity > 0 ? capture->capacity * 2 : OUTPUT_BLOCK_SIZE;
+
+        capture->data = realloc(capture->data, capture->capacity);
+        CHECK_OOM(capture->data);
+        vsnprintf(capture->data + capture->size, capture->capacity - capture->size, format, ap);
+    }
+
+    capture->size += count;
 }
 
 void repl_print(const char* format, ...)
 {
-    if (muted)
+    // Binary clients only get replies through repl_write
+    if (capture_target == NULL && (muted || (current != NULL && current->mode == CLIENT_BINARY)))
         return;
 
     va_list ap;
     va_start(ap, format);
-    if (config->port > 0)
-        repl_print_network(format, ap);
+    if (capture_target != NULL)
+        repl_print_capture(format, ap);
+    else if (current != NULL && current != console)
+        client_print(current, format, ap);
     else
         repl_print_stdout(format, ap);
     va_end(ap);
@@ -193,13 +994,17 @@ void repl_print(const char* format, ...)
 
 void repl_print_error(const char* format, ...)
 {
-    if (muted)
+    if (capture_target == NULL && muted)
         return;
 
     va_list ap;
     va_start(ap, format);
-    if (config->port > 0)
-        repl_print_network(format, ap);
+    if (capture_target != NULL)
+        repl_print_capture(format, ap);
+    else if (current != NULL && current->mode == CLIENT_BINARY)
+        protocol_error(format, ap);
+    else if (current != NULL && current != console)
+        client_print(current, format, ap);
     else
         repl_print_stderr(format, ap);
     va_end(ap);
@@ -210,3 +1015,35 @@ void repl_mute(bool on)
     muted = on;
 }
 
+// Holds off on running any more commands from the current client until the
+// output for the command being run is handed back.  Returns the client or
+// NULL if it can't wait.
+void* repl_suspend(void)
+{
+    if (current == NULL || current == console || current->mode != CLIENT_TEXT)
+        return NULL;
+
+    current->suspended++;
+    return current;
+}
+
+// The client running the current command, used to tell clients apart
+void* repl_client(void)
+{
+    return current;
+}
+
+// Sends output to another client until redirected back.  Returns the client
+// output was going to before.
+void* repl_redirect(void* client)
+{
+    Client* previous = current;
+    current = client;
+    return previous;
+}
+
+// Output from reader threads is collected rather than sent straight away
+void repl_capture(ReplCapture* capture)
+{
+    capture_target = capture;
+}
@@ -31,11 +31,24 @@
 #ifndef REDPILE_REPL_H
 #define REDPILE_REPL_H
 
+#include "common.h"
+
+// Output printed from a thread other than the main one is collected here
+typedef struct {
+    char* data;
+    size_t size;
+    size_t capacity;
+} ReplCapture;
+
 void repl_run(void);
 void repl_cleanup(void);
-int repl_read(char *buff, int buffsize);
+void repl_write(const void* data, size_t size);
 void repl_print(const char* format, ...);
 void repl_print_error(const char* format, ...);
 void repl_mute(bool on);
+void repl_capture(ReplCapture* capture);
+void* repl_suspend(void);
+void* repl_client(void);
+void* repl_redirect(void* client);
 
 #endif
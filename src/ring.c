@@ -0,0 +1,124 @@
+/* ring.c - Shared memory ring buffers for local clients
+ *
+ * Copyright (C) 2014 Ryan Mendivil <ryan@nullreff.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redpile nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Needed for memfd_create
+#define _GNU_SOURCE
+
+#include "ring.h"
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// A ring is a memfd handed to the client over its socket.  The server
+// copies output in at `head` and the client copies it out at `tail`, both
+// counting every byte ever written so they only wrap when indexing into
+// the data.  Once a batch of output has been written `sequence` is bumped
+// and any client waiting on it with FUTEX_WAIT is woken.
+//
+// When a client falls a whole ring behind the server stops reading its
+// commands until there's room again, the same as with a full socket.
+
+Ring* ring_create(uint32_t size)
+{
+    assert(ring_valid_size(size));
+
+    Ring* ring = malloc(sizeof(Ring));
+    CHECK_OOM(ring);
+
+    ring->fd = memfd_create("redpile-ring", MFD_CLOEXEC);
+    if (ring->fd == -1)
+    {
+        WARN("Trouble creating shared memory: %s\n", strerror(errno));
+        free(ring);
+        return NULL;
+    }
+
+    size_t length = RING_HEADER_SIZE + (size_t)size;
+    void* memory = MAP_FAILED;
+    if (ftruncate(ring->fd, length) == 0)
+        memory = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+
+    if (memory == MAP_FAILED)
+    {
+        WARN("Trouble mapping shared memory: %s\n", strerror(errno));
+        close(ring->fd);
+        free(ring);
+        return NULL;
+    }
+
+    ring->header = memory;
+    ring->data = (char*)memory + RING_HEADER_SIZE;
+    ring->header->size = size;
+    ring->size = size;
+    ring->head = 0;
+    return ring;
+}
+
+// Copies as much as fits without overwriting anything the client hasn't
+// read yet.  Returns the number of bytes copied, or -1 if the client has
+// moved `tail` somewhere it couldn't have read up to.
+ssize_t ring_write(Ring* ring, const void* data, size_t size)
+{
+    uint64_t head = ring->head;
+    uint64_t tail = __atomic_load_n(&ring->header->tail, __ATOMIC_ACQUIRE);
+    if (head - tail > ring->size)
+        return -1;
+
+    size_t space = ring->size - (size_t)(head - tail);
+    if (size > space)
+        size = space;
+
+    size_t offset = head & (ring->size - 1);
+    size_t first = ring->size - offset < size ? ring->size - offset : size;
+    memcpy(ring->data + offset, data, first);
+    memcpy(ring->data, (const char*)data + first, size - first);
+
+    ring->head = head + size;
+    __atomic_store_n(&ring->header->head, ring->head, __ATOMIC_RELEASE);
+    return size;
+}
+
+void ring_notify(Ring* ring)
+{
+    __atomic_add_fetch(&ring->header->sequence, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &ring->header->sequence, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+void ring_free(Ring* ring)
+{
+    __atomic_store_n(&ring->header->closed, 1, __ATOMIC_RELEASE);
+    ring_notify(ring);
+
+    munmap(ring->header, RING_HEADER_SIZE + (size_t)ring->size);
+    close(ring->fd);
+    free(ring);
+}
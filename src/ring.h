@@ -0,0 +1,81 @@
+/* ring.h - Shared memory ring buffers for local clients
+ *
+ * Copyright (C) 2014 Ryan Mendivil <ryan@nullreff.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redpile nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef REDPILE_RING_H
+#define REDPILE_RING_H
+
+#include "common.h"
+#include <stdint.h>
+#include <sys/types.h>
+
+// Clients connected through --socket can open with these bytes, a version
+// byte, a protocol byte (0 for text, 1 for binary) and a little endian
+// ring size to have their output written to shared memory.  See ring.c.
+#define RING_MAGIC "\0RPR"
+#define RING_MAGIC_SIZE 4
+#define RING_VERSION 1
+#define RING_REQUEST_SIZE (RING_MAGIC_SIZE + 6)
+#define RING_MIN_SIZE (64 * 1024)
+#define RING_MAX_SIZE (1024 * 1024 * 1024)
+
+#define ring_valid_size(SIZE) ((SIZE) >= RING_MIN_SIZE && (SIZE) <= RING_MAX_SIZE && IS_POWER_OF_TWO(SIZE))
+
+// The data starts on the page after the header
+#define RING_HEADER_SIZE 4096
+
+// Shared with clients, so the layout of this can't change without bumping
+// RING_VERSION.  `head` and `tail` are on their own cache lines since each
+// side only ever writes one of them.
+typedef struct {
+    uint32_t size;
+    uint32_t closed;
+    uint32_t sequence;
+    char pad1[52];
+    uint64_t head;
+    char pad2[56];
+    uint64_t tail;
+} RingHeader;
+
+// The server's own copy of the size and head, since the client can write
+// anything it likes to the header
+typedef struct {
+    RingHeader* header;
+    char* data;
+    int fd;
+    uint32_t size;
+    uint64_t head;
+} Ring;
+
+Ring* ring_create(uint32_t size);
+ssize_t ring_write(Ring* ring, const void* data, size_t size);
+void ring_notify(Ring* ring);
+void ring_free(Ring* ring);
+
+#endif
@@ -32,6 +32,8 @@
 #include "type.h"
 #include "common.h"
 #include "repl.h"
+#include "memory.h"
+#include "profile.h"
 
 #define LUA_ERROR(MESSAGE) lua_pushstring(state, MESSAGE); lua_error(state)
 #define LUA_ERROR_IF(CONDITION,MESSAGE) if (CONDITION) { LUA_ERROR(MESSAGE); }
@@ -467,7 +469,7 @@ static int script_node_data(ScriptState* state)
     Node* current = script_node_from_stack(state, 1);
 
     LUA_ERROR_IF(!lua_isstring(state, 2), "You must pass a message to data");
-    char* message = strdup(lua_tostring(state, 2));
+    char* message = memory_strdup(MEMORY_STRINGS, lua_tostring(state, 2));
 
     FieldValue value = { .string = message };
     queue_add_system(script_data->messages, SM_DATA, current, 0, value);
@@ -517,7 +519,7 @@ static int script_node_index_set(ScriptState* state)
         case FIELD_STRING: {
             LUA_ERROR_IF(!lua_isstring(state, 3),
                          "Attempting to assign a non string to a string field");
-            value.string = strdup(lua_tostring(state, 3));
+            value.string = memory_strdup(MEMORY_STRINGS, lua_tostring(state, 3));
         } break;
 
         default:
@@ -734,9 +736,39 @@ static void script_setup_data(ScriptState* state, ScriptData* data)
     luaL_setfuncs(state, message_funcs, 0);
 }
 
+// The same as the allocator and panic handler luaL_newstate sets up, except
+// the Lua heap is counted in STATUS MEMORY.  Lua passes the size of the block
+// being resized or freed so these are counted by the size asked for, the same
+// as collectgarbage('count').
+static void* script_allocate(UNUSED void* data, void* pointer, size_t old_size, size_t new_size)
+{
+    if (pointer == NULL)
+        old_size = 0;
+
+    if (new_size == 0)
+    {
+        free(pointer);
+        memory_record(MEMORY_LUA, 0, old_size, pointer != NULL ? -1 : 0);
+        return NULL;
+    }
+
+    void* resized = realloc(pointer, new_size);
+    if (resized != NULL)
+        memory_record(MEMORY_LUA, new_size, old_size, pointer == NULL ? 1 : 0);
+    return resized;
+}
+
+static int script_panic(ScriptState* state)
+{
+    fprintf(stderr, "PANIC: unprotected error in call to Lua API (%s)\n", lua_tostring(state, -1));
+    return 0;
+}
+
 ScriptState* script_state_allocate(void)
 {
-    lua_State* state = luaL_newstate();
+    lua_State* state = lua_newstate(script_allocate, NULL);
+    CHECK_OOM(state);
+    lua_atpanic(state, script_panic);
 
     luaL_openlibs(state);
 
@@ -825,7 +857,9 @@ bool script_state_run_behavior(ScriptState* state, Behavior* behavior, ScriptDat
     script_setup_data(state, data);
 
     script_data = data;
+    profile_behavior_begin(behavior->name);
     int error = lua_pcall(state, 2, 1, 0);
+    profile_behavior_end();
     script_data = NULL;
     node_list_free(node_list);
 
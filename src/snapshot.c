@@ -0,0 +1,735 @@
+/* snapshot.c - Full and incremental world snapshots
+ *
+ * Copyright (C) 2014 Ryan Mendivil <ryan@nullreff.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redpile nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "snapshot.h"
+#include "repl.h"
+#include "journal.h"
+#include "memory.h"
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <stdint.h>
+#include <limits.h>
+
+// A snapshot stores the chunks of a world so it can be loaded again later.
+// Base snapshots contain every chunk while incremental ones only contain the
+// chunks written to since the previous snapshot plus the path of that
+// snapshot (its parent).  Loading an incremental snapshot loads its parent
+// first, so taking one costs as much as the world changed rather than how big
+// it is.  COMPACT folds a chain of them back into a single base.
+//
+// Layout:
+//   magic   "RPS1"
+//   kind    u8, base or incremental
+//   ticks   u64
+//   parent  string, empty for base snapshots
+//   chunks  u32 count followed by each chunk:
+//     key     three int32s
+//     nodes   u32 count followed by each node:
+//       location  three int32s
+//       type      string
+//       fields    u32 count followed by each name and value (int32 or string)
+//       stores    u32 count followed by each message store:
+//         tick      u64
+//         messages  u32 count followed by each message:
+//           source  three int32s and a type name
+//           type    message type name
+//           value   int64
+//
+// Strings are a u32 length followed by the bytes with SNAPSHOT_NULL used as
+// the length of missing ones.  Fields and message types are stored by name
+// since their order depends on how Lua iterates the config.  Like the
+// journal, values are stored in host byte order.
+
+#define SNAPSHOT_MAGIC "RPS1"
+#define SNAPSHOT_MAGIC_SIZE 4
+#define SNAPSHOT_NULL UINT32_MAX
+#define SNAPSHOT_MAX_CHAIN 4096
+
+typedef enum {
+    SNAPSHOT_BASE,
+    SNAPSHOT_INCREMENTAL
+} SnapshotKind;
+
+typedef struct {
+    SnapshotKind kind;
+    unsigned long long ticks;
+    char* parent;
+} SnapshotHeader;
+
+typedef struct {
+    FILE* file;
+    bool valid;
+} SnapshotReader;
+
+typedef struct {
+    volatile unsigned int total;
+    volatile unsigned int written;
+} SnapshotProgress;
+
+typedef enum {
+    BACKGROUND_NONE,
+    BACKGROUND_RUNNING,
+    BACKGROUND_DONE,
+    BACKGROUND_FAILED
+} BackgroundState;
+
+static struct {
+    BackgroundState state;
+    pid_t pid;
+    World* world;
+    char* path;
+    long journal_offset;
+    SnapshotProgress* progress;
+    long long started;
+    long long finished;
+    long long pause;
+} background = {BACKGROUND_NONE, 0, NULL, NULL, -1, NULL, 0, 0, 0};
+
+static long long get_time(void)
+{
+    struct timespec value;
+    clock_gettime(CLOCK_MONOTONIC, &value);
+    return ((long long)value.tv_sec) * 1000000 + value.tv_nsec / 1000;
+}
+
+// Writing
+
+static void snapshot_write(FILE* file, const void* data, size_t size)
+{
+    fwrite(data, size, 1, file);
+}
+
+static void snapshot_put_int(FILE* file, uint32_t value)
+{
+    snapshot_write(file, &value, sizeof(uint32_t));
+}
+
+static void snapshot_put_long(FILE* file, uint64_t value)
+{
+    snapshot_write(file, &value, sizeof(uint64_t));
+}
+
+static void snapshot_put_string(FILE* file, const char* string)
+{
+    if (string == NULL)
+    {
+        snapshot_put_int(file, SNAPSHOT_NULL);
+        return;
+    }
+
+    uint32_t length = strlen(string);
+    snapshot_put_int(file, length);
+    snapshot_write(file, string, length);
+}
+
+static void snapshot_put_location(FILE* file, Location location)
+{
+    snapshot_put_int(file, location.x);
+    snapshot_put_int(file, location.y);
+    snapshot_put_int(file, location.z);
+}
+
+static const char* snapshot_message_type_name(World* world, unsigned int id)
+{
+    FOR_MESSAGE_TYPES(message_type, world->type_data)
+    {
+        if (message_type->id == id)
+            return message_type->name;
+    }
+
+    return NULL;
+}
+
+static void snapshot_put_store(FILE* file, World* world, MessageStore* store)
+{
+    snapshot_put_long(file, store->tick);
+    snapshot_put_int(file, store->messages->size);
+    for (unsigned int i = 0; i < store->messages->size; i++)
+    {
+        Message* message = store->messages->data + i;
+        snapshot_put_location(file, message->source.location);
+        snapshot_put_string(file, message->source.type != NULL ? message->source.type->name : NULL);
+        snapshot_put_string(file, snapshot_message_type_name(world, message->type));
+        snapshot_put_long(file, message->value);
+    }
+}
+
+typedef struct {
+    FILE* file;
+    World* world;
+} SnapshotWriter;
+
+static void snapshot_put_node(Node* node, void* args)
+{
+    FILE* file = ((SnapshotWriter*)args)->file;
+    World* world = ((SnapshotWriter*)args)->world;
+    NodeData* data = node->data;
+    if (data->type == NULL)
+        return;
+
+    snapshot_put_location(file, node->location);
+    snapshot_put_string(file, data->type->name);
+
+    unsigned int field_count = data->fields != NULL ? data->fields->count : 0;
+    snapshot_put_int(file, field_count);
+    for (unsigned int i = 0; i < field_count; i++)
+    {
+        Field* field = data->type->fields->data + i;
+        FieldValue value = data->fields->data[i];
+        snapshot_put_string(file, field->name);
+        switch (field->type)
+        {
+            case FIELD_INTEGER:
+                snapshot_put_int(file, value.integer);
+                break;
+
+            case FIELD_DIRECTION:
+                snapshot_put_int(file, value.direction);
+                break;
+
+            case FIELD_STRING:
+                snapshot_put_string(file, value.string);
+                break;
+        }
+    }
+
+    unsigned int store_count = 0;
+    for (MessageStore* store = data->store; store != NULL; store = store->next)
+        store_count++;
+
+    snapshot_put_int(file, store_count);
+    for (MessageStore* store = data->store; store != NULL; store = store->next)
+        snapshot_put_store(file, world, store);
+}
+
+static void snapshot_count_node(Node* node, void* args)
+{
+    if (node->data->type != NULL)
+        (*(unsigned int*)args)++;
+}
+
+static void snapshot_put_chunk(FILE* file, World* world, Location key)
+{
+    unsigned int count = 0;
+    world_each_chunk_node(world, key, snapshot_count_node, &count);
+
+    snapshot_put_location(file, key);
+    snapshot_put_int(file, count);
+    SnapshotWriter writer = {file, world};
+    world_each_chunk_node(world, key, snapshot_put_node, &writer);
+}
+
+// Reading
+
+static void snapshot_read(SnapshotReader* reader, void* data, size_t size)
+{
+    if (reader->valid && size > 0 && fread(data, size, 1, reader->file) != 1)
+        reader->valid = false;
+}
+
+static uint32_t snapshot_get_int(SnapshotReader* reader)
+{
+    uint32_t value = 0;
+    snapshot_read(reader, &value, sizeof(uint32_t));
+    return value;
+}
+
+static uint64_t snapshot_get_long(SnapshotReader* reader)
+{
+    uint64_t value = 0;
+    snapshot_read(reader, &value, sizeof(uint64_t));
+    return value;
+}
+
+static char* snapshot_get_string(SnapshotReader* reader)
+{
+    uint32_t length = snapshot_get_int(reader);
+    if (!reader->valid || length == SNAPSHOT_NULL)
+        return NULL;
+
+    char* string = malloc(length + 1);
+    CHECK_OOM(string);
+    snapshot_read(reader, string, length);
+    string[length] = '\0';
+    return string;
+}
+
+static Location snapshot_get_location(SnapshotReader* reader)
+{
+    int x = snapshot_get_int(reader);
+    int y = snapshot_get_int(reader);
+    int z = snapshot_get_int(reader);
+    return location_create(x, y, z);
+}
+
+static bool snapshot_get_header(SnapshotReader* reader, SnapshotHeader* header)
+{
+    char magic[SNAPSHOT_MAGIC_SIZE];
+    snapshot_read(reader, magic, SNAPSHOT_MAGIC_SIZE);
+    if (!reader->valid || memcmp(magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE) != 0)
+        return false;
+
+    unsigned char kind = SNAPSHOT_BASE;
+    snapshot_read(reader, &kind, 1);
+    header->kind = kind;
+    header->ticks = snapshot_get_long(reader);
+    header->parent = snapshot_get_string(reader);
+
+    return reader->valid && (kind == SNAPSHOT_BASE || (kind == SNAPSHOT_INCREMENTAL && header->parent != NULL));
+}
+
+static MessageStore* snapshot_get_store(SnapshotReader* reader, World* world)
+{
+    MessageStore* store = message_store_allocate(snapshot_get_long(reader));
+
+    uint32_t count = snapshot_get_int(reader);
+    if (!reader->valid)
+        return store;
+
+    store->messages = messages_resize(store->messages, count);
+    for (unsigned int i = 0; i < count && reader->valid; i++)
+    {
+        Message* message = store->messages->data + i;
+        message->source.location = snapshot_get_location(reader);
+
+        char* type_name = snapshot_get_string(reader);
+        message->source.type = type_name != NULL ? type_data_find_type(world->type_data, type_name) : NULL;
+        free(type_name);
+
+        char* message_name = snapshot_get_string(reader);
+        MessageType* message_type = message_name != NULL ? type_data_find_message_type(world->type_data, message_name) : NULL;
+        message->type = message_type != NULL ? message_type->id : 0;
+        free(message_name);
+
+        message->value = (int64_t)snapshot_get_long(reader);
+    }
+
+    return store;
+}
+
+static bool snapshot_get_node(SnapshotReader* reader, World* world, const char* path)
+{
+    Location location = snapshot_get_location(reader);
+    char* type_name = snapshot_get_string(reader);
+    if (type_name == NULL)
+    {
+        reader->valid = false;
+        return false;
+    }
+
+    Type* type = type_data_find_type(world->type_data, type_name);
+    if (type == NULL)
+    {
+        repl_print_error("The snapshot '%s' uses the unknown type '%s'\n", path, type_name);
+        free(type_name);
+        reader->valid = false;
+        return false;
+    }
+    free(type_name);
+
+    Node node;
+    world_set_node(world, location, type, &node);
+    world_hash_node(world, &node);
+
+    uint32_t field_count = snapshot_get_int(reader);
+    for (unsigned int i = 0; i < field_count && reader->valid; i++)
+    {
+        char* name = snapshot_get_string(reader);
+        unsigned int index;
+        Field* field = name != NULL ? type_find_field(type, name, &index) : NULL;
+        free(name);
+
+        if (field == NULL)
+        {
+            repl_print_error("The snapshot '%s' has different fields for the type '%s'\n", path, type->name);
+            reader->valid = false;
+            break;
+        }
+
+        switch (field->type)
+        {
+            case FIELD_INTEGER:
+                FIELD_SET(&node, index, integer, (int)snapshot_get_int(reader));
+                break;
+
+            case FIELD_DIRECTION:
+                FIELD_SET(&node, index, direction, (Direction)snapshot_get_int(reader));
+                break;
+
+            case FIELD_STRING: {
+                // Copied so the field is counted with the other strings
+                char* string = snapshot_get_string(reader);
+                memory_free(MEMORY_STRINGS, FIELD_GET(&node, index, string));
+                FIELD_SET(&node, index, string, string != NULL ? memory_strdup(MEMORY_STRINGS, string) : NULL);
+                free(string);
+            } break;
+        }
+    }
+    world_hash_node(world, &node);
+
+    message_store_free(node.data->store);
+    node.data->store = NULL;
+
+    MessageStore** next = &node.data->store;
+    uint32_t store_count = snapshot_get_int(reader);
+    for (unsigned int i = 0; i < store_count && reader->valid; i++)
+    {
+        *next = snapshot_get_store(reader, world);
+        next = &(*next)->next;
+    }
+
+    return reader->valid;
+}
+
+static bool snapshot_load_chain(World* world, const char* path, unsigned int depth)
+{
+    if (depth > SNAPSHOT_MAX_CHAIN)
+    {
+        repl_print_error("The snapshot '%s' is part of a chain that's too long or circular\n", path);
+        return false;
+    }
+
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        repl_print_error("Unable to read the snapshot '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+
+    SnapshotReader reader = {file, true};
+    SnapshotHeader header = {SNAPSHOT_BASE, 0, NULL};
+    bool result = false;
+
+    if (!snapshot_get_header(&reader, &header))
+    {
+        repl_print_error("The file '%s' is not a redpile snapshot\n", path);
+        free(header.parent);
+        fclose(file);
+        return false;
+    }
+
+    if (header.kind == SNAPSHOT_INCREMENTAL && !snapshot_load_chain(world, header.parent, depth + 1))
+        goto end;
+
+    uint32_t chunk_count = snapshot_get_int(&reader);
+    for (unsigned int i = 0; i < chunk_count && reader.valid; i++)
+    {
+        Location key = snapshot_get_location(&reader);
+        world_clear_chunk(world, key);
+
+        uint32_t node_count = snapshot_get_int(&reader);
+        for (unsigned int j = 0; j < node_count && reader.valid; j++)
+            snapshot_get_node(&reader, world, path);
+    }
+
+    if (!reader.valid)
+    {
+        repl_print_error("The snapshot '%s' is incomplete\n", path);
+        goto end;
+    }
+
+    world->ticks = header.ticks;
+    result = true;
+
+end:
+    free(header.parent);
+    fclose(file);
+    return result;
+}
+
+// Checks if `path` is the snapshot `start` or one of its parents.  Writing an
+// incremental snapshot over one of them would break the chain.
+static bool snapshot_in_chain(const char* start, const char* path)
+{
+    char target[PATH_MAX];
+    if (realpath(path, target) == NULL)
+        return false;
+
+    char* current = strdup(start);
+    bool found = false;
+    for (unsigned int depth = 0; current != NULL && depth < SNAPSHOT_MAX_CHAIN; depth++)
+    {
+        char resolved[PATH_MAX];
+        if (realpath(current, resolved) != NULL && strcmp(resolved, target) == 0)
+        {
+            found = true;
+            break;
+        }
+
+        FILE* file = fopen(current, "rb");
+        free(current);
+        current = NULL;
+        if (file == NULL)
+            break;
+
+        SnapshotReader reader = {file, true};
+        SnapshotHeader header = {SNAPSHOT_BASE, 0, NULL};
+        if (snapshot_get_header(&reader, &header) && header.kind == SNAPSHOT_INCREMENTAL)
+            current = header.parent;
+        else
+            free(header.parent);
+        fclose(file);
+    }
+
+    free(current);
+    return found;
+}
+
+static bool snapshot_write_file(World* world, const char* path, bool incremental, SnapshotProgress* progress)
+{
+    // Written to a temporary file first so a failed save never
+    // leaves a partial snapshot in place of a good one
+    size_t temp_size = strlen(path) + 5;
+    char* temp_path = malloc(temp_size);
+    CHECK_OOM(temp_path);
+    snprintf(temp_path, temp_size, "%s.tmp", path);
+
+    FILE* file = fopen(temp_path, "wb");
+    if (file == NULL)
+    {
+        repl_print_error("Unable to write the snapshot '%s': %s\n", path, strerror(errno));
+        free(temp_path);
+        return false;
+    }
+
+    unsigned char kind = incremental ? SNAPSHOT_INCREMENTAL : SNAPSHOT_BASE;
+    snapshot_write(file, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE);
+    snapshot_write(file, &kind, 1);
+    snapshot_put_long(file, world->ticks);
+    snapshot_put_string(file, incremental ? world->snapshot : "");
+
+    Hashmap* chunks = incremental ? &world->dirty : &world->chunks;
+    snapshot_put_int(file, chunks->count);
+
+    if (progress != NULL)
+        progress->total = chunks->count;
+
+    Location key;
+    void* value;
+    Cursor cursor = hashmap_get_iterator(chunks);
+    while (cursor_next(&cursor, &key, &value))
+    {
+        snapshot_put_chunk(file, world, key);
+        if (progress != NULL)
+            progress->written++;
+    }
+
+    bool failed = fflush(file) != 0 || ferror(file) || fsync(fileno(file)) != 0;
+    failed = fclose(file) != 0 || failed;
+    failed = failed || rename(temp_path, path) != 0;
+
+    if (failed)
+    {
+        repl_print_error("Unable to write the snapshot '%s': %s\n", path, strerror(errno));
+        unlink(temp_path);
+        free(temp_path);
+        return false;
+    }
+
+    free(temp_path);
+    return true;
+}
+
+bool snapshot_save(World* world, const char* path, bool incremental)
+{
+    if (background.state == BACKGROUND_RUNNING)
+    {
+        repl_print_error("Wait for the background save to finish first\n");
+        return false;
+    }
+
+    if (incremental && world->snapshot == NULL)
+    {
+        repl_print_error("There is no snapshot to build on, use SAVE first\n");
+        return false;
+    }
+
+    if (incremental && snapshot_in_chain(world->snapshot, path))
+    {
+        repl_print_error("The snapshot '%s' is needed by the one being saved\n", path);
+        return false;
+    }
+
+    if (!snapshot_write_file(world, path, incremental, NULL))
+        return false;
+
+    world_checkpoint(world, path);
+    return true;
+}
+
+// Background saves fork the process and write a base snapshot from the
+// child.  The OS shares memory pages between the two copy-on-write so the
+// child sees the world exactly as it was at the time of the fork while the
+// parent carries on.  The pause is only as long as fork() takes to copy the
+// page tables.  Progress is reported through a page of shared memory.
+bool snapshot_save_background(World* world, const char* path)
+{
+    if (background.state == BACKGROUND_RUNNING)
+    {
+        repl_print_error("A background save is already running\n");
+        return false;
+    }
+
+    if (background.progress == NULL)
+    {
+        background.progress = mmap(NULL, sizeof(SnapshotProgress), PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (background.progress == MAP_FAILED)
+        {
+            background.progress = NULL;
+            repl_print_error("Unable to start a background save: %s\n", strerror(errno));
+            return false;
+        }
+    }
+
+    background.progress->total = world->chunks.count;
+    background.progress->written = 0;
+
+    long long start = get_time();
+
+    // Flushed first so the child doesn't inherit (and write out) pending records
+    long journal_offset = journal_mark();
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        repl_print_error("Unable to start a background save: %s\n", strerror(errno));
+        return false;
+    }
+
+    if (pid == 0)
+    {
+        bool result = snapshot_write_file(world, path, false, background.progress);
+        _exit(result ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    world_checkpoint_begin(world);
+
+    free(background.path);
+    background.path = strdup(path);
+    background.state = BACKGROUND_RUNNING;
+    background.pid = pid;
+    background.world = world;
+    background.journal_offset = journal_offset;
+    background.started = start;
+    background.pause = get_time() - start;
+    return true;
+}
+
+static void snapshot_finish_background(bool saved)
+{
+    background.state = saved ? BACKGROUND_DONE : BACKGROUND_FAILED;
+    background.finished = get_time();
+
+    if (background.world != NULL)
+        world_checkpoint_end(background.world, background.path, saved);
+
+    if (saved)
+        journal_discard(background.journal_offset);
+
+    background.world = NULL;
+}
+
+// Checks if a background save has finished without waiting for it
+void snapshot_poll(void)
+{
+    if (background.state != BACKGROUND_RUNNING)
+        return;
+
+    int status;
+    pid_t result = waitpid(background.pid, &status, WNOHANG);
+    if (result == background.pid)
+        snapshot_finish_background(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+    else if (result == -1)
+        snapshot_finish_background(false);
+}
+
+// Called when a world is freed while it's being saved in the background
+void snapshot_forget(World* world)
+{
+    if (background.world == world)
+        background.world = NULL;
+}
+
+void snapshot_print_status(void)
+{
+    snapshot_poll();
+    if (background.state == BACKGROUND_NONE)
+        return;
+
+    const char* states[] = {"none", "running", "done", "failed"};
+    long long end = background.state == BACKGROUND_RUNNING ? get_time() : background.finished;
+
+    repl_print("save_state: %s\n", states[background.state]);
+    repl_print("save_chunks: %u/%u\n", background.progress->written, background.progress->total);
+    repl_print("save_time_ms: %lld\n", (end - background.started) / 1000);
+    repl_print("save_pause_us: %lld\n", background.pause);
+}
+
+void snapshot_cleanup(void)
+{
+    if (background.state == BACKGROUND_RUNNING)
+    {
+        int status;
+        if (waitpid(background.pid, &status, 0) == background.pid)
+            snapshot_finish_background(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+    }
+
+    if (background.progress != NULL)
+        munmap(background.progress, sizeof(SnapshotProgress));
+
+    free(background.path);
+    background.progress = NULL;
+    background.path = NULL;
+}
+
+bool snapshot_load(World* world, const char* path)
+{
+    if (!snapshot_load_chain(world, path, 0))
+        return false;
+
+    world_checkpoint(world, path);
+    return true;
+}
+
+// Loads the chain ending in `path` into a scratch world and writes it back
+// out as a single base snapshot
+bool snapshot_compact(World* world, const char* path)
+{
+    World* chain = world_allocate(world->nodes.min_size, world->type_data);
+    bool result = snapshot_load(chain, path) && snapshot_save(chain, path, false);
+    world_free(chain);
+    return result;
+}
@@ -30,6 +30,59 @@
 
 #include "tick.h"
 #include "repl.h"
+#include "watch.h"
+#include "mirror.h"
+#include "perf.h"
+#include "metrics.h"
+#include "trace.h"
+#include <time.h>
+
+// Counters for each phase of a tick, summed over every tick since
+// tick_profile_start.  They're reported per node processed in STATUS.
+typedef enum {
+    PHASE_BEHAVIORS,
+    PHASE_MESSAGES,
+    PHASE_PUBLISH,
+    PHASE_COUNT
+} TickPhase;
+
+static const char* phase_names[PHASE_COUNT] = {"behaviors", "messages", "publish"};
+
+static struct {
+    bool enabled;
+    bool available;
+    Perf perf;
+    PerfSample phases[PHASE_COUNT];
+    unsigned long long ticks;
+    unsigned long long nodes;
+} profile;
+
+// Counters for the tick being run, written out when METRICS is on.  They're
+// always counted since that's cheaper than checking whether they're needed.
+static TickMetrics metrics;
+
+static long long get_time(void)
+{
+    struct timespec value;
+    clock_gettime(CLOCK_MONOTONIC, &value);
+    return ((long long)value.tv_sec) * 1000000000LL + value.tv_nsec;
+}
+
+static void profile_begin(PerfSample* start)
+{
+    if (profile.available)
+        perf_read(&profile.perf, start);
+}
+
+static void profile_end(TickPhase phase, PerfSample* start)
+{
+    if (!profile.available)
+        return;
+
+    PerfSample end;
+    perf_read(&profile.perf, &end);
+    perf_sample_add(&profile.phases[phase], start, &end);
+}
 
 static Message message_create(QueueData* data)
 {
@@ -84,18 +137,24 @@ static bool process_node(ScriptState* state, World* world, Node* node, Queue* ou
         Behavior* behavior = data->type->behaviors->data[i];
         Messages* found = messages_filter_copy(input, behavior->mask);
         ScriptData data = (ScriptData){world, node, found, output};
+        TRACE_BEGIN(behavior->name, NULL, 0);
         bool success = script_state_run_behavior(state, behavior, &data);
-        free(found);
+        TRACE_END(behavior->name, NULL, 0);
+        messages_free(found);
         if (!success)
+        {
+            messages_free(input);
             return false;
+        }
     }
 
-    free(input);
+    messages_free(input);
     return true;
 }
 
 static void process_output(World* world, Node* node, Queue* messages, Queue* output, Hashmap* rerun)
 {
+    TRACE_BEGIN("process_output", "messages", output->count);
     hashmap_remove(rerun, node->location);
 
     if (world->max_outputs < output->count)
@@ -121,6 +180,7 @@ static void process_output(World* world, Node* node, Queue* messages, Queue* out
                     bucket->value = data->target.data;
                 }
                 queue_remove(messages, queue_node);
+                metrics.removed++;
             }
             else
             {
@@ -147,9 +207,11 @@ static void process_output(World* world, Node* node, Queue* messages, Queue* out
         QueueNode* temp = queue_node;
         queue_node = queue_node->next;
         queue_push(messages, temp);
+        metrics.created++;
     }
 
     output->nodes = NULL;
+    TRACE_END("process_output", NULL, 0);
 }
 
 static void run_messages(World* world, Queue* queue, LogLevel log_level)
@@ -160,23 +222,34 @@ static void run_messages(World* world, Queue* queue, LogLevel log_level)
 
         if (location_equals(data->target.location, location_empty()))
         {
-            if (world_run_data(world, data) && log_level != LOG_QUIET)
-                queue_data_print(data);
+            if (world_run_data(world, data))
+            {
+                metrics.outputs++;
+                if (log_level != LOG_QUIET)
+                    queue_data_print(data);
+            }
         }
         else
         {
-            MessageStore* store = node_find_store(&data->target, data->tick);
-
             unsigned int count = 0;
             QueueNode* iter = queue_node;
             while (iter != NULL &&
-                   iter->data.tick == store->tick &&
+                   iter->data.tick == data->tick &&
                    node_equals(&iter->data.target, &data->target))
             {
                 count++;
                 iter = iter->next;
             }
 
+            if (!world_own_node(world, &data->target))
+            {
+                for (unsigned int i = 1; i < count; i++)
+                    queue_node = queue_node->next;
+                continue;
+            }
+
+            MessageStore* store = node_find_store(&data->target, data->tick, world->ticks);
+
             unsigned int old_size = store->messages->size;
             store->messages = messages_resize(store->messages, old_size + count);
 
@@ -189,6 +262,10 @@ static void run_messages(World* world, Queue* queue, LogLevel log_level)
 
             if (world->max_queued < count)
                 world->max_queued = count;
+
+            metrics.delivered += count;
+            if (data->tick > world->ticks)
+                metrics.delayed += count;
         }
     }
 }
@@ -200,6 +277,15 @@ void tick_run(ScriptState* state, World* world, unsigned int count, LogLevel log
         if (log_level == LOG_VERBOSE)
             repl_print("=== Tick %llu ===\n", world->ticks);
 
+        PerfSample start;
+        profile_begin(&start);
+
+        TRACE_BEGIN("tick", "tick", world->ticks);
+
+        bool measure = metrics_enabled();
+        long long started = measure ? get_time() : 0;
+        memset(&metrics, 0, sizeof(metrics));
+
         Queue messages;
         queue_init(&messages, true, true, 1024);
 
@@ -208,12 +294,17 @@ void tick_run(ScriptState* state, World* world, unsigned int count, LogLevel log
         CHECK_OOM(rerun);
         hashmap_init(rerun, run->size);
 
+        bool failed = false;
         unsigned int iterations = 0;
         while (run->count > 0)
         {
             if (log_level == LOG_VERBOSE)
                 repl_print("--- Pass %d (%d nodes)---\n", iterations, run->count);
 
+            TRACE_BEGIN("pass", "nodes", run->count);
+            TRACE_BEGIN("nodes", NULL, 0);
+            unsigned int batch = 0;
+
             Cursor cursor = hashmap_get_iterator(run);
             Node node;
 
@@ -224,20 +315,42 @@ void tick_run(ScriptState* state, World* world, unsigned int count, LogLevel log
 
                 Queue output;
                 queue_init(&output, true, false, 1024);
-                bool status = process_node(state, world, &node, &output, &messages);
-                if (!status)
-                    return;
+                if (!process_node(state, world, &node, &output, &messages))
+                {
+                    queue_free(&output);
+                    TRACE_END("nodes", "nodes", batch);
+                    TRACE_END("pass", "rerun", rerun->count);
+                    failed = true;
+                    goto end;
+                }
+                profile.nodes++;
+                metrics.nodes++;
 
                 process_output(world, &node, &messages, &output, rerun);
                 queue_free(&output);
+
+                if (++batch == TRACE_BATCH_SIZE)
+                {
+                    TRACE_END("nodes", "nodes", batch);
+                    TRACE_BEGIN("nodes", NULL, 0);
+                    batch = 0;
+                }
             }
 
+            TRACE_END("nodes", "nodes", batch);
+            TRACE_END("pass", "rerun", rerun->count);
+
             if (run != &world->nodes)
             {
                 hashmap_free(run, NULL);
                 free(run);
             }
 
+            metrics.passes++;
+            if (rerun->count > metrics.rerun_max)
+                metrics.rerun_max = rerun->count;
+            metrics.rerun += rerun->count;
+
             run = rerun;
             rerun = malloc(sizeof(Hashmap));
             CHECK_OOM(rerun);
@@ -251,6 +364,7 @@ void tick_run(ScriptState* state, World* world, unsigned int count, LogLevel log
             iterations++;
         }
 
+end:
         if (run != &world->nodes)
         {
             hashmap_free(run, NULL);
@@ -259,6 +373,20 @@ void tick_run(ScriptState* state, World* world, unsigned int count, LogLevel log
         hashmap_free(rerun, NULL);
         free(rerun);
 
+        // A behavior that errored stops the tick before any of its
+        // messages are delivered, but what's been published still goes out
+        if (failed)
+        {
+            queue_free(&messages);
+            TRACE_END("tick", "nodes", metrics.nodes);
+            profile_end(PHASE_BEHAVIORS, &start);
+
+            profile_begin(&start);
+            mirror_update(world);
+            profile_end(PHASE_PUBLISH, &start);
+            break;
+        }
+
         if (log_level == LOG_VERBOSE)
         {
             repl_print("Messages:\n");
@@ -280,11 +408,92 @@ void tick_run(ScriptState* state, World* world, unsigned int count, LogLevel log
             repl_print("Output:\n");
         }
 
+        profile_end(PHASE_BEHAVIORS, &start);
+        profile_begin(&start);
+
+        TRACE_BEGIN("run_messages", "messages", messages.count);
         run_messages(world, &messages, log_level);
+        TRACE_END("run_messages", NULL, 0);
         
         queue_free(&messages);
         world_gc_nodes(world);
+
+        if (measure)
+        {
+            metrics.tick = world->ticks;
+            metrics.nanoseconds = get_time() - started;
+            metrics.hash = world->hash;
+            metrics_write(&metrics);
+        }
+
+        TRACE_END("tick", "nodes", metrics.nodes);
         world->ticks++;
+        profile.ticks++;
+
+        profile_end(PHASE_MESSAGES, &start);
+
+        // Mirrors get every tick, watches only the latest state of each node
+        profile_begin(&start);
+        mirror_update(world);
+        profile_end(PHASE_PUBLISH, &start);
+    }
+
+    PerfSample start;
+    profile_begin(&start);
+
+    watch_flush(world);
+    metrics_flush();
+
+    profile_end(PHASE_PUBLISH, &start);
+}
+
+// Starts counting cycles, instructions and cache and branch misses for each
+// phase of every tick run on this thread.  Ticks still run when the counters
+// aren't available, STATUS just says why.
+bool tick_profile_start(void)
+{
+    profile.enabled = true;
+    profile.available = perf_open(&profile.perf);
+    return profile.available;
+}
+
+int tick_profile_error(void)
+{
+    return profile.perf.error;
+}
+
+void tick_profile_print(void)
+{
+    if (!profile.enabled)
+        return;
+
+    if (!profile.available)
+    {
+        repl_print("perf: unavailable (%s)\n", strerror(profile.perf.error));
+        return;
+    }
+
+    repl_print("perf_ticks: %llu\n", profile.ticks);
+    repl_print("perf_nodes: %llu\n", profile.nodes);
+    for (unsigned int i = 0; i < PHASE_COUNT; i++)
+    {
+        char buffer[256];
+        perf_format(&profile.perf, &profile.phases[i], profile.nodes, buffer, sizeof(buffer));
+        repl_print("perf_%s: %s\n", phase_names[i], buffer);
     }
 }
 
+void tick_profile_stop(void)
+{
+    if (profile.available)
+        perf_close(&profile.perf);
+    profile.enabled = false;
+    profile.available = false;
+}
+
+// Nodes run by every tick so far, counting each pass a node is rerun in
+unsigned long long tick_nodes_processed(void)
+{
+    return profile.nodes;
+}
+
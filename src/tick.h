@@ -42,5 +42,10 @@ typedef enum {
 } LogLevel;
 
 void tick_run(ScriptState* state, World* world, unsigned int count, LogLevel log_level);
+bool tick_profile_start(void);
+int tick_profile_error(void);
+void tick_profile_print(void);
+void tick_profile_stop(void);
+unsigned long long tick_nodes_processed(void);
 
 #endif
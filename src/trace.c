@@ -0,0 +1,196 @@
+/* trace.c - Timeline of tick phases in the Chrome trace format
+ *
+ * Copyright (C) 2014 Ryan Mendivil <ryan@nullreff.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redpile nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "trace.h"
+#include "repl.h"
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+// While TRACE is on, tick_run records the beginning and end of each tick,
+// pass, batch of nodes, behavior, process_output and run_messages into a
+// ring that keeps the most recent events.  TRACE DUMP writes the ring in
+// the JSON format chrome://tracing and ui.perfetto.dev open, so a single
+// slow tick can be looked at on a timeline.
+//
+// Only the main thread runs ticks and commands, so recording an event is
+// a clock read and a store into the ring without any locking.
+
+typedef struct {
+    long long time;
+    const char* name;
+    const char* arg;
+    long long value;
+    char phase;
+} TraceEvent;
+
+bool trace_running = false;
+
+static struct {
+    TraceEvent* events;
+    unsigned long long count;
+    unsigned int mask;
+    long long start;
+} ring = {NULL, 0, 0, 0};
+
+static long long get_time(void)
+{
+    struct timespec value;
+    clock_gettime(CLOCK_MONOTONIC, &value);
+    return ((long long)value.tv_sec) * 1000000000LL + value.tv_nsec;
+}
+
+bool trace_start(unsigned int size)
+{
+    if (trace_running)
+    {
+        repl_print_error("Tracing is already on\n");
+        return false;
+    }
+
+    if (size == 0 || size > TRACE_MAX_EVENTS)
+    {
+        repl_print_error("The number of events must be between 1 and %d\n", TRACE_MAX_EVENTS);
+        return false;
+    }
+
+    unsigned int events = 1;
+    while (events < size)
+        events <<= 1;
+
+    free(ring.events);
+    ring.events = malloc(sizeof(TraceEvent) * events);
+    CHECK_OOM(ring.events);
+    ring.count = 0;
+    ring.mask = events - 1;
+    ring.start = get_time();
+
+    trace_running = true;
+    return true;
+}
+
+// Keeps the events around so they can still be dumped
+bool trace_stop(void)
+{
+    if (!trace_running)
+    {
+        repl_print_error("Tracing isn't on\n");
+        return false;
+    }
+
+    trace_running = false;
+    return true;
+}
+
+void trace_record(const char* name, char phase, const char* arg, long long value)
+{
+    TraceEvent* event = &ring.events[ring.count & ring.mask];
+    event->time = get_time();
+    event->name = name;
+    event->arg = arg;
+    event->value = value;
+    event->phase = phase;
+    ring.count++;
+}
+
+// Names come from the config file but shouldn't need escaping, anything
+// that would is left out rather than breaking the JSON
+static void trace_write_string(FILE* file, const char* string)
+{
+    fputc('"', file);
+    for (; *string != '\0'; string++)
+    {
+        if (*string != '"' && *string != '\\' && (unsigned char)*string >= ' ')
+            fputc(*string, file);
+    }
+    fputc('"', file);
+}
+
+bool trace_dump(const char* path)
+{
+    if (ring.events == NULL)
+    {
+        repl_print_error("Nothing has been traced\n");
+        return false;
+    }
+
+    FILE* file = fopen(path, "w");
+    if (file == NULL)
+    {
+        repl_print_error("Unable to open '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+
+    unsigned long long size = (unsigned long long)ring.mask + 1;
+    unsigned long long first = ring.count > size ? ring.count - size : 0;
+    pid_t pid = getpid();
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":1,\"args\":{\"name\":\"tick\"}}", pid);
+
+    // Events that ended after their beginning was overwritten are left out
+    unsigned long long written = 0;
+    unsigned int depth = 0;
+    for (unsigned long long i = first; i < ring.count; i++)
+    {
+        TraceEvent* event = &ring.events[i & ring.mask];
+        if (event->phase == 'E')
+        {
+            if (depth == 0)
+                continue;
+            depth--;
+        }
+        else
+        {
+            depth++;
+        }
+
+        long long time = event->time - ring.start;
+        fprintf(file, ",\n{\"name\":");
+        trace_write_string(file, event->name);
+        fprintf(file, ",\"ph\":\"%c\",\"ts\":%lld.%03lld,\"pid\":%d,\"tid\":1",
+                event->phase, time / 1000, time % 1000, pid);
+        if (event->arg != NULL)
+            fprintf(file, ",\"args\":{\"%s\":%lld}", event->arg, event->value);
+        fputc('}', file);
+        written++;
+    }
+
+    fprintf(file, "\n]}\n");
+
+    if (fclose(file) != 0)
+    {
+        repl_print_error("Unable to write '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+
+    repl_print("%llu events written to %s, %llu overwritten\n", written, path, first);
+    return true;
+}
@@ -0,0 +1,53 @@
+/* trace.h - Timeline of tick phases in the Chrome trace format
+ *
+ * Copyright (C) 2014 Ryan Mendivil <ryan@nullreff.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redpile nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef REDPILE_TRACE_H
+#define REDPILE_TRACE_H
+
+#include "common.h"
+
+// Events kept by default, the oldest are overwritten once it's full
+#define TRACE_DEFAULT_EVENTS (1 << 18)
+#define TRACE_MAX_EVENTS (1 << 26)
+
+// Nodes covered by each batch event inside a pass
+#define TRACE_BATCH_SIZE 256
+
+#define TRACE_BEGIN(NAME,ARG,VALUE) do { if (trace_running) trace_record(NAME, 'B', ARG, VALUE); } while(0)
+#define TRACE_END(NAME,ARG,VALUE) do { if (trace_running) trace_record(NAME, 'E', ARG, VALUE); } while(0)
+
+extern bool trace_running;
+
+bool trace_start(unsigned int size);
+bool trace_stop(void);
+bool trace_dump(const char* path);
+void trace_record(const char* name, char phase, const char* arg, long long value);
+
+#endif
@@ -91,6 +91,9 @@ typedef struct {
     Behavior* behaviors;
     MessageType* message_types;
     Type* default_type;
+
+    // Number of worlds (and forks) sharing these types
+    unsigned int worlds;
 } TypeData;
 
 #define FOR_TYPES(TYPE,DATA) for (Type* TYPE = (DATA)->types; TYPE != NULL; TYPE = TYPE->next)
@@ -0,0 +1,270 @@
+/* watch.c - Subscriptions to changes in a region of the world
+ *
+ * Copyright (C) 2014 Ryan Mendivil <ryan@nullreff.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redpile nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "watch.h"
+#include "command.h"
+#include "repl.h"
+
+typedef struct {
+    unsigned int count;
+    unsigned int capacity;
+    Watch* data[];
+} WatchList;
+
+static Watch* watches = NULL;
+static unsigned int next_id = 1;
+
+// Chunk key -> WatchList of every watch overlapping that chunk
+static Hashmap watch_index;
+static bool index_ready = false;
+
+// Watches too large to index
+static unsigned int wide_count = 0;
+
+#define RANGE_LOW(R) ((R).start > (R).end ? (R).end : (R).start)
+#define RANGE_HIGH(R) ((R).start > (R).end ? (R).start : (R).end)
+
+#define FOR_WATCH_CHUNKS(W)\
+    for (int x = RANGE_LOW((W)->region.x) >> CHUNK_BITS; x <= RANGE_HIGH((W)->region.x) >> CHUNK_BITS; x++)\
+    for (int y = RANGE_LOW((W)->region.y) >> CHUNK_BITS; y <= RANGE_HIGH((W)->region.y) >> CHUNK_BITS; y++)\
+    for (int z = RANGE_LOW((W)->region.z) >> CHUNK_BITS; z <= RANGE_HIGH((W)->region.z) >> CHUNK_BITS; z++)
+
+static long long watch_range_chunks(Range range)
+{
+    return (long long)(RANGE_HIGH(range) >> CHUNK_BITS) - (RANGE_LOW(range) >> CHUNK_BITS) + 1;
+}
+
+static void watch_index_add(Location key, Watch* watch)
+{
+    Bucket* bucket = hashmap_get(&watch_index, key, true);
+    WatchList* list = bucket->value;
+
+    if (list == NULL || list->count == list->capacity)
+    {
+        unsigned int capacity = list != NULL ? list->capacity * 2 : 4;
+        list = realloc(list, sizeof(WatchList) + capacity * sizeof(Watch*));
+        CHECK_OOM(list);
+
+        if (bucket->value == NULL)
+            list->count = 0;
+        list->capacity = capacity;
+        bucket->value = list;
+    }
+
+    list->data[list->count++] = watch;
+}
+
+static void watch_index_remove(Location key, Watch* watch)
+{
+    Bucket* bucket = hashmap_get(&watch_index, key, false);
+    if (bucket == NULL)
+        return;
+
+    WatchList* list = bucket->value;
+    for (unsigned int i = 0; i < list->count; i++)
+    {
+        if (list->data[i] == watch)
+        {
+            list->data[i] = list->data[--list->count];
+            break;
+        }
+    }
+
+    if (list->count == 0)
+        free(hashmap_remove(&watch_index, key));
+}
+
+static void watch_free(Watch* watch)
+{
+    if (watch->indexed)
+    {
+        FOR_WATCH_CHUNKS(watch)
+            watch_index_remove(location_create(x, y, z), watch);
+    }
+    else
+    {
+        wide_count--;
+    }
+
+    hashmap_free(&watch->changes, NULL);
+    free(watch->field);
+    free(watch);
+}
+
+unsigned int watch_add(Region* region, char* field, void* owner)
+{
+    if (!index_ready)
+    {
+        hashmap_init(&watch_index, 64);
+        index_ready = true;
+    }
+
+    Watch* watch = malloc(sizeof(Watch));
+    CHECK_OOM(watch);
+
+    watch->id = next_id++;
+    watch->region = *region;
+    watch->field = field != NULL ? strdup(field) : NULL;
+    watch->owner = owner;
+    hashmap_init(&watch->changes, 16);
+
+    long long chunks = watch_range_chunks(region->x) * watch_range_chunks(region->y) * watch_range_chunks(region->z);
+    watch->indexed = chunks <= WATCH_MAX_CHUNKS;
+    if (watch->indexed)
+    {
+        FOR_WATCH_CHUNKS(watch)
+            watch_index_add(location_create(x, y, z), watch);
+    }
+    else
+    {
+        wide_count++;
+    }
+
+    watch->next = watches;
+    watches = watch;
+    return watch->id;
+}
+
+bool watch_remove(unsigned int id, void* owner)
+{
+    for (Watch** watch = &watches; *watch != NULL; watch = &(*watch)->next)
+    {
+        if ((*watch)->id == id && (*watch)->owner == owner)
+        {
+            Watch* found = *watch;
+            *watch = found->next;
+            watch_free(found);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void watch_remove_owner(void* owner)
+{
+    Watch** watch = &watches;
+    while (*watch != NULL)
+    {
+        if ((*watch)->owner == owner)
+        {
+            Watch* found = *watch;
+            *watch = found->next;
+            watch_free(found);
+        }
+        else
+        {
+            watch = &(*watch)->next;
+        }
+    }
+}
+
+static void watch_mark(Watch* watch, Location location)
+{
+    if (region_contains(&watch->region, location))
+        hashmap_get(&watch->changes, location, true)->value = watch;
+}
+
+// Called for every change a tick makes, so this has to stay cheap when
+// nothing is being watched
+void watch_record(Location location)
+{
+    if (watches == NULL)
+        return;
+
+    Bucket* bucket = hashmap_get(&watch_index, node_chunk_key(location), false);
+    if (bucket != NULL)
+    {
+        WatchList* list = bucket->value;
+        for (unsigned int i = 0; i < list->count; i++)
+            watch_mark(list->data[i], location);
+    }
+
+    if (wide_count > 0)
+    {
+        for (Watch* watch = watches; watch != NULL; watch = watch->next)
+        {
+            if (!watch->indexed)
+                watch_mark(watch, location);
+        }
+    }
+}
+
+// Sends every watcher the current state of the locations that changed in
+// its region, in the same format NODE and FIELD use
+void watch_flush(World* world)
+{
+    for (Watch* watch = watches; watch != NULL; watch = watch->next)
+    {
+        if (watch->changes.count == 0)
+            continue;
+
+        void* previous = repl_redirect(watch->owner);
+
+        Location location;
+        void* value;
+        Cursor cursor = hashmap_get_iterator(&watch->changes);
+        while (cursor_next(&cursor, &location, &value))
+        {
+            Region region = {
+                range_create(location.x, location.x, 1),
+                range_create(location.y, location.y, 1),
+                range_create(location.z, location.z, 1)
+            };
+
+            repl_print("WATCH %u ", watch->id);
+            if (watch->field != NULL)
+                command_field_read(world, &region, watch->field);
+            else
+                command_node_read(world, &region);
+        }
+
+        repl_redirect(previous);
+
+        hashmap_free(&watch->changes, NULL);
+        hashmap_init(&watch->changes, 16);
+    }
+}
+
+void watch_cleanup(void)
+{
+    while (watches != NULL)
+    {
+        Watch* watch = watches;
+        watches = watch->next;
+        watch_free(watch);
+    }
+
+    if (index_ready)
+    {
+        hashmap_free(&watch_index, free);
+        index_ready = false;
+    }
+}
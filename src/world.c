@@ -31,6 +31,99 @@
 #include "world.h"
 #include "hashmap.h"
 #include "repl.h"
+#include "watch.h"
+
+// Hashes are built the same way as Zobrist hashes, where each possible piece
+// of state has its own random key and the world's hash is the XOR of the keys
+// of everything in it.  Instead of a table of keys, a key is made by mixing
+// the location, the name of the type and the name and value of a field, so
+// the same world always has the same hash, whichever order it was built in
+// and whichever engine ran it.  Fields set to 0 (or an unset string) don't
+// add a key, so nodes that haven't set their fields yet match ones that have
+// set them to 0.
+//
+// XOR undoes itself, so changing one value only takes removing its old key
+// and adding the new one instead of hashing the whole world again.
+static uint64_t world_hash_mix(uint64_t value)
+{
+    // The finalizer from SplitMix64
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+static uint64_t world_hash_string(const char* string)
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (; *string != '\0'; string++)
+        hash = (hash ^ (unsigned char)*string) * 0x100000001b3ULL;
+    return hash;
+}
+
+static uint64_t world_hash_key(Location location, Type* type)
+{
+    uint64_t key = world_hash_mix(((uint64_t)(uint32_t)location.x << 32) | (uint32_t)location.y);
+    key = world_hash_mix(key ^ (uint32_t)location.z);
+    return world_hash_mix(key ^ world_hash_string(type->name));
+}
+
+// Fields are keyed by name since their order comes from the config file
+static uint64_t world_hash_field(uint64_t key, Field* field, FieldValue value)
+{
+    uint64_t found;
+    switch (field->type)
+    {
+        case FIELD_INTEGER:   found = (uint32_t)value.integer; break;
+        case FIELD_DIRECTION: found = (uint32_t)value.direction; break;
+        case FIELD_STRING:    found = value.string != NULL ? world_hash_string(value.string) : 0; break;
+        default:              found = 0; break;
+    }
+
+    if (found == 0)
+        return 0;
+
+    return world_hash_mix(key ^ world_hash_string(field->name)) ^ world_hash_mix(found);
+}
+
+static uint64_t world_hash_node_key(World* world, Node* node)
+{
+    if (NODE_IS_EMPTY(node) || node->data == world->root || node->data->type == NULL)
+        return 0;
+
+    Type* type = node->data->type;
+    FieldData* fields = node->data->fields;
+    uint64_t key = world_hash_key(node->location, type);
+    uint64_t hash = key;
+
+    if (fields != NULL)
+    {
+        for (unsigned int i = 0; i < type->fields->count && i < fields->count; i++)
+            hash ^= world_hash_field(key, &type->fields->data[i], fields->data[i]);
+    }
+
+    return hash;
+}
+
+// Adds the node to the world's hash if it wasn't in it and removes it if it
+// was.  Anything that changes nodes without going through world_set_node,
+// world_set_region, world_edit_region, world_remove_node or world_run_data
+// calls this once before and once after the change.
+void world_hash_node(World* world, Node* node)
+{
+    world->hash ^= world_hash_node_key(world, node);
+}
+
+// Hashes every node from scratch, which should match world->hash
+uint64_t world_hash_compute(World* world)
+{
+    uint64_t hash = 0;
+    Cursor cursor = hashmap_get_iterator(&world->nodes);
+    Node node;
+    while (cursor_next(&cursor, &node.location, (void**)&node.data))
+        hash ^= world_hash_node_key(world, &node);
+    return hash;
+}
 
 static void world_node_move(World* world, Node* node, Direction direction)
 {
@@ -41,17 +134,97 @@ static void world_node_move(World* world, Node* node, Direction direction)
     world_set_node(world, new_location, type, NULL);
 }
 
+static void world_reindex_node(Node* node, void* args)
+{
+    World* world = args;
+    if (node->data->type == NULL)
+        return;
+
+    Bucket* bucket = hashmap_get(&world->nodes, node->location, false);
+    if (bucket != NULL)
+        bucket->value = node->data;
+}
+
+// Chunks are shared between forks of a world until one of them writes to it.
+// At that point the writer makes its own copy of the chunk and points its
+// node index at the copied data.
+static NodeTree* world_own_chunk(World* world, Bucket* bucket)
+{
+    NodeTree* tree = bucket->value;
+    if (tree->refs == 1)
+        return tree;
+
+    NodeTree* copy = node_tree_copy(tree, NULL);
+    node_tree_release(tree);
+    bucket->value = copy;
+    node_tree_each(copy, bucket->key, world_reindex_node, world);
+    return copy;
+}
+
+// Once a snapshot has been taken every chunk written to is remembered so the
+// next incremental snapshot only has to include those.
+static void world_mark_dirty(World* world, Location key)
+{
+    world->version++;
+
+    // Only the keys are used
+    if (world->snapshot != NULL)
+        hashmap_get(&world->dirty, key, true)->value = world;
+
+    if (world->saving != NULL)
+        hashmap_get(world->saving, key, true)->value = world;
+}
+
+static NodeTree* world_get_chunk(World* world, Location location, bool create, bool write)
+{
+    Location key = node_chunk_key(location);
+    Bucket* bucket = hashmap_get(&world->chunks, key, create);
+    if (bucket == NULL)
+        return NULL;
+
+    if (write)
+        world_mark_dirty(world, key);
+
+    if (bucket->value == NULL)
+    {
+        bucket->value = node_tree_allocate(NULL, CHUNK_DEPTH, NULL);
+        return bucket->value;
+    }
+
+    return write ? world_own_chunk(world, bucket) : bucket->value;
+}
+
+static void world_get_tree_node(World* world, Location location, Node* node, bool create, bool write)
+{
+    NodeTree* tree = world_get_chunk(world, location, create, write);
+    if (tree != NULL)
+        node_tree_get(tree, node_chunk_offset(location), node, create);
+    else
+        node->data = NULL;
+
+    if (node->data == NULL)
+        node->data = world->root;
+    node->location = location;
+}
+
 World* world_allocate(unsigned int size, TypeData* type_data)
 {
     World* world = malloc(sizeof(World));
     CHECK_OOM(world);
 
     world->root = node_data_allocate(type_data_get_default_type(type_data));
-    world->tree = node_tree_allocate(NULL, 1, world->root);
+    hashmap_init(&world->chunks, size);
     hashmap_init(&world->nodes, size);
     hashmap_init(&world->dead, size);
     world->total_nodes = 0;
+    world->forked = false;
+    world->version = 0;
+    world->hash = 0;
+    world->snapshot = NULL;
+    hashmap_init(&world->dirty, size);
+    world->saving = NULL;
     world->type_data = type_data;
+    type_data->worlds++;
 
     // Stats
     world->ticks = 0;
@@ -62,22 +235,74 @@ World* world_allocate(unsigned int size, TypeData* type_data)
     return world;
 }
 
+// Creates a copy of the world that shares all of its chunks.
+// See world_own_chunk for how the two are separated on write.
+static World* world_share(World* world, bool nodes)
+{
+    World* copy = malloc(sizeof(World));
+    CHECK_OOM(copy);
+    memcpy(copy, world, sizeof(World));
+
+    copy->root = node_data_allocate(world->root->type);
+    hashmap_copy(&copy->chunks, &world->chunks);
+    if (nodes)
+        hashmap_copy(&copy->nodes, &world->nodes);
+    else
+        hashmap_init(&copy->nodes, world->nodes.min_size);
+    hashmap_init(&copy->dead, world->dead.min_size);
+
+    // Snapshots taken from the original don't apply to the copy
+    copy->snapshot = NULL;
+    hashmap_init(&copy->dirty, world->dirty.min_size);
+    copy->saving = NULL;
+
+    Location key;
+    NodeTree* tree;
+    Cursor cursor = hashmap_get_iterator(&world->chunks);
+    while (cursor_next(&cursor, &key, (void**)&tree))
+        tree->refs++;
+
+    world->forked = true;
+    copy->forked = true;
+    copy->type_data->worlds++;
+
+    return copy;
+}
+
+World* world_fork(World* world)
+{
+    return world_share(world, true);
+}
+
+// A copy of the world's nodes that's only ever read from, possibly from
+// another thread.  Since it shares every chunk, the original copies a chunk
+// before changing it and the view is left as it was.  Views have to be
+// freed from the main thread.  See reader.c for more information.
+World* world_view(World* world)
+{
+    return world_share(world, false);
+}
+
 void world_free(World* world)
 {
     node_data_free(world->root);
-    node_tree_free(world->tree);
-    hashmap_free(&world->nodes, (void (*)(void*))node_data_free);
+    hashmap_free(&world->chunks, (void (*)(void*))node_tree_release);
+    hashmap_free(&world->nodes, NULL);
     hashmap_free(&world->dead, (void (*)(void*))node_data_free);
-    type_data_free(world->type_data);
+    hashmap_free(&world->dirty, NULL);
+    free(world->snapshot);
+    world_checkpoint_end(world, NULL, false);
+
+    if (--world->type_data->worlds == 0)
+        type_data_free(world->type_data);
+
     free(world);
 }
 
 void world_set_node(World* world, Location location, Type* type, Node* node)
 {
-    world->tree = node_tree_ensure_depth(world->tree, location);
-
     Node found;
-    node_tree_get(world->tree, location, &found, true);
+    world_get_tree_node(world, location, &found, true, true);
     assert(!NODE_IS_EMPTY(&found));
 
     if (found.data->type == NULL)
@@ -87,7 +312,9 @@ void world_set_node(World* world, Location location, Type* type, Node* node)
         world->total_nodes++;
     }
 
+    world_hash_node(world, &found);
     found.data->type = type;
+    world_hash_node(world, &found);
 
     if (node != NULL)
         *node = found;
@@ -95,20 +322,62 @@ void world_set_node(World* world, Location location, Type* type, Node* node)
 
 void world_get_node(World* world, Location location, Node* node)
 {
-    node_tree_get(world->tree, location, node, false);
+    world_get_tree_node(world, location, node, false, false);
+}
+
+// Refreshes a node found earlier so it can be modified.  Returns false if the
+// location no longer contains a node.
+bool world_own_node(World* world, Node* node)
+{
+    if (!world->forked)
+    {
+        world_mark_dirty(world, node_chunk_key(node->location));
+        return true;
+    }
+
+    world_get_tree_node(world, node->location, node, false, true);
+    return node->data != world->root;
 }
 
 void world_remove_node(World* world, Location location)
 {
-    Node node;
-    node_tree_remove(world->tree, location, &node);
+    Node node = node_empty();
+    NodeTree* tree = world_get_chunk(world, location, false, true);
+    if (tree != NULL)
+        node_tree_remove(tree, node_chunk_offset(location), &node);
+    node.location = location;
+
     if (node.data != NULL)
+    {
+        world_hash_node(world, &node);
+
+        // Messages queued this tick may still point at the node so it's
+        // only freed once the tick is over, see world_gc_nodes
+        Bucket* bucket = hashmap_get(&world->dead, location, true);
+        bucket->value = node.data;
         world->total_nodes--;
+    }
     hashmap_remove(&world->nodes, node.location);
 }
 
+// Drops the chunk once its last node has been removed
+static void world_drop_empty_chunk(World* world, Location key)
+{
+    Bucket* bucket = hashmap_get(&world->chunks, key, false);
+    if (bucket == NULL || bucket->value == NULL || !node_tree_is_empty(bucket->value))
+        return;
+
+    node_tree_release(hashmap_remove(&world->chunks, key));
+}
+
 void world_gc_nodes(World* world)
 {
+    Location location;
+    void* data;
+    Cursor cursor = hashmap_get_iterator(&world->dead);
+    while (cursor_next(&cursor, &location, &data))
+        world_drop_empty_chunk(world, node_chunk_key(location));
+
     unsigned int size = world->dead.size;
     hashmap_free(&world->dead, (void (*)(void*))node_data_free);
     hashmap_init(&world->dead, size);
@@ -117,7 +386,7 @@ void world_gc_nodes(World* world)
 void world_get_adjacent_node(World* world, Node* current_node, Direction dir, Node* node)
 {
     Location location = location_move(current_node->location, dir, 1);
-    node_tree_get(world->tree, location, node, false);
+    world_get_tree_node(world, location, node, false, false);
     assert(!NODE_IS_EMPTY(node));
 }
 
@@ -146,23 +415,32 @@ void world_get_region(World* world, Region* region, void (*callback)(Location l,
     }
 }
 
-void world_set_region(World* world, Region* region, void (*callback)(Location l, Node* n, void* args), void* args)
+void world_edit_region(World* world, Region* region, void (*callback)(Location l, Node* n, void* args), void* args)
 {
-    Location max_range = location_create(
-            MAX(abs(region->x.start), abs(region->x.end)),
-            MAX(abs(region->y.start), abs(region->y.end)),
-            MAX(abs(region->z.start), abs(region->z.end)));
-    world->tree = node_tree_ensure_depth(world->tree, max_range);
+    FOR_REGION(region)
+    {
+        Location location = location_create(x, y, z);
+        Node node;
+        world_get_tree_node(world, location, &node, false, true);
+        world_hash_node(world, &node);
+        callback(location, &node, args);
+        world_hash_node(world, &node);
+    }
+}
 
+void world_set_region(World* world, Region* region, void (*callback)(Location l, Node* n, void* args), void* args)
+{
     FOR_REGION(region)
     {
         Location location = location_create(x, y, z);
         Node node;
-        node_tree_get(world->tree, location, &node, true);
+        world_get_tree_node(world, location, &node, true, true);
         assert(!NODE_IS_EMPTY(&node));
         Type* oldType = node.data->type;
 
+        world_hash_node(world, &node);
         callback(location, &node, args);
+        world_hash_node(world, &node);
 
         if (oldType == NULL && node.data->type != NULL)
         {
@@ -180,6 +458,76 @@ void world_delete_region(World* world, Region* region)
         Location location = location_create(x, y, z);
         world_remove_node(world, location);
     }
+    world_gc_nodes(world);
+}
+
+void world_each_chunk_node(World* world, Location key, void (*callback)(Node* node, void* args), void* args)
+{
+    Bucket* bucket = hashmap_get(&world->chunks, key, false);
+    if (bucket != NULL)
+        node_tree_each(bucket->value, key, callback, args);
+}
+
+static void world_collect_node(Node* node, void* args)
+{
+    if (node->data->type != NULL)
+        node_list_add(args, node);
+}
+
+void world_clear_chunk(World* world, Location key)
+{
+    NodeList* nodes = node_list_allocate(CHUNK_WIDTH * CHUNK_WIDTH);
+    world_each_chunk_node(world, key, world_collect_node, nodes);
+
+    Node* node;
+    for (unsigned int i = 0; (node = node_list_index(nodes, i)) != NULL; i++)
+        world_remove_node(world, node->location);
+
+    node_list_free(nodes);
+    world_gc_nodes(world);
+}
+
+// Marks the current state of the world as saved in the snapshot at `path`
+void world_checkpoint(World* world, const char* path)
+{
+    free(world->snapshot);
+    world->snapshot = strdup(path);
+
+    unsigned int size = world->dirty.min_size;
+    hashmap_free(&world->dirty, NULL);
+    hashmap_init(&world->dirty, size);
+}
+
+// Background snapshots capture the world at the time they start but finish
+// later.  Changes made in between are tracked separately so they become the
+// dirty chunks once the snapshot has been written.
+void world_checkpoint_begin(World* world)
+{
+    world_checkpoint_end(world, NULL, false);
+    Hashmap* saving = malloc(sizeof(Hashmap));
+    CHECK_OOM(saving);
+    world->saving = hashmap_init(saving, world->dirty.min_size);
+}
+
+void world_checkpoint_end(World* world, const char* path, bool saved)
+{
+    if (world->saving == NULL)
+        return;
+
+    if (saved)
+    {
+        free(world->snapshot);
+        world->snapshot = strdup(path);
+        hashmap_free(&world->dirty, NULL);
+        world->dirty = *world->saving;
+    }
+    else
+    {
+        hashmap_free(world->saving, NULL);
+    }
+
+    free(world->saving);
+    world->saving = NULL;
 }
 
 WorldStats world_get_stats(World* world)
@@ -187,7 +535,9 @@ WorldStats world_get_stats(World* world)
     return (WorldStats){
         world->ticks,
         world->total_nodes,
-        world->tree->level,
+        CHUNK_DEPTH,
+        world->chunks.count,
+        world->dirty.count,
         world->nodes.size,
         world->max_inputs,
         world->max_outputs,
@@ -201,6 +551,8 @@ void world_stats_print(WorldStats stats)
     STAT_PRINT(stats, ticks, llu);
     STAT_PRINT(stats, nodes, u);
     STAT_PRINT(stats, tree_depth, u);
+    STAT_PRINT(stats, tree_chunks, u);
+    STAT_PRINT(stats, dirty_chunks, u);
     STAT_PRINT(stats, hashmap_size, u);
     STAT_PRINT(stats, message_max_inputs, u);
     STAT_PRINT(stats, message_max_outputs, u);
@@ -212,8 +564,16 @@ bool world_run_data(World* world, QueueData* data)
     switch (data->type)
     {
         case SM_FIELD: {
+            if (!world_own_node(world, &data->source))
+                return false;
+
             unsigned int field_index = data->index;
-            switch (data->source.data->type->fields->data[field_index].type)
+            Field* field = &data->source.data->type->fields->data[field_index];
+            FieldValue old_value = {0};
+            if (data->source.data->fields != NULL)
+                old_value = data->source.data->fields->data[field_index];
+
+            switch (field->type)
             {
                 case FIELD_INTEGER:
                     if (data->value.integer == FIELD_GET(&data->source, field_index, integer))
@@ -233,16 +593,28 @@ bool world_run_data(World* world, QueueData* data)
                     FIELD_SET(&data->source, field_index, string, data->value.string);
                     break;
             }
+
+            uint64_t key = world_hash_key(data->source.location, data->source.data->type);
+            world->hash ^= world_hash_field(key, field, old_value) ^
+                           world_hash_field(key, field, data->source.data->fields->data[field_index]);
+            watch_record(data->source.location);
         } break;
 
         case SM_MOVE:
             if (!hashmap_get(&world->dead, data->source.location, false))
+            {
+                watch_record(data->source.location);
+                watch_record(location_move(data->source.location, data->value.direction, 1));
                 world_node_move(world, &data->source, data->value.direction);
+            }
             break;
 
         case SM_REMOVE:
             if (!hashmap_get(&world->dead, data->source.location, false))
+            {
+                watch_record(data->source.location);
                 world_remove_node(world, data->source.location);
+            }
             break;
 
         case SM_DATA:
@@ -262,8 +634,7 @@ void world_print_messages(World* world)
     Cursor cursor = hashmap_get_iterator(&world->nodes);
     while (cursor_next(&cursor, &node.location, (void**)&node.data))
     {
-        MessageStore* store = node.data->store;
-        while (store != NULL)
+        for (MessageStore* store = node.data->store; store != NULL; store = store->next)
         {
             if (store->tick < world->ticks)
                 continue;
@@ -290,8 +661,6 @@ void world_print_messages(World* world)
                     }
                 }
             }
-
-            store = store->next;
         }
     }
 }
@@ -36,15 +36,34 @@
 #include "common.h"
 #include "message.h"
 #include "queue.h"
+#include <stdint.h>
 
 typedef struct {
-    // All nodes are stored in an octree
-    // See node.c for more information.
-    NodeTree* tree;
+    // All nodes are stored in fixed depth octrees
+    // indexed by chunk.  See node.c for more information.
+    Hashmap chunks;
     Hashmap nodes;
     Hashmap dead;
     NodeData* root;
 
+    // Set once chunks may be shared with a fork
+    bool forked;
+
+    // Bumped every time a chunk is written to
+    unsigned long long version;
+
+    // XOR of the keys of every node and field value in the world,
+    // see world_hash_node for more information.
+    uint64_t hash;
+
+    // Path of the last snapshot taken and the chunks changed
+    // since then.  See snapshot.c for more information.
+    char* snapshot;
+    Hashmap dirty;
+
+    // Chunks changed while a background snapshot is being written
+    Hashmap* saving;
+
     // Type and behavior information
     // see type.c for more information.
     TypeData* type_data;
@@ -61,6 +80,8 @@ typedef struct {
     unsigned long long ticks;
     unsigned int nodes;
     unsigned int tree_depth;
+    unsigned int tree_chunks;
+    unsigned int dirty_chunks;
     unsigned int hashmap_size;
     unsigned int message_max_inputs;
     unsigned int message_max_outputs;
@@ -68,18 +89,29 @@ typedef struct {
 } WorldStats;
 
 World* world_allocate(unsigned int size, TypeData* type_data);
+World* world_fork(World* world);
+World* world_view(World* world);
 void world_free(World* world);
 void world_set_node(World* world, Location location, Type* type, Node* node);
 void world_get_node(World* world, Location location, Node* node);
+bool world_own_node(World* world, Node* node);
 void world_remove_node(World* world, Location location);
 void world_gc_nodes(World* world);
 void world_get_adjacent_node(World* world, Node* current_node, Direction dir, Node* node);
 void world_get_region(World* world, Region* region, void (*callback)(Location l, Node* n, void* args), void* args);
+void world_edit_region(World* world, Region* region, void (*callback)(Location l, Node* n, void* args), void* args);
 void world_set_region(World* world, Region* region, void (*callback)(Location l, Node* n, void* args), void* args);
 void world_delete_region(World* world, Region* region);
+void world_each_chunk_node(World* world, Location key, void (*callback)(Node* node, void* args), void* args);
+void world_clear_chunk(World* world, Location key);
+void world_checkpoint(World* world, const char* path);
+void world_checkpoint_begin(World* world);
+void world_checkpoint_end(World* world, const char* path, bool saved);
 WorldStats world_get_stats(World* world);
 void world_stats_print(WorldStats world);
 bool world_run_data(World* world, QueueData* data);
+void world_hash_node(World* world, Node* node);
+uint64_t world_hash_compute(World* world);
 void world_print_messages(World* world);
 void world_print_types(World* world);
 void world_print_type(World* world, const char* name);
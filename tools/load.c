@@ -0,0 +1,628 @@
+/* load.c - Load generator for a redpile server
+ *
+ * Copyright (C) 2014 Ryan Mendivil <ryan@nullreff.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redpile nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Opens a number of connections to a server started with --port and sends
+// commands from each one, either replayed from a trace file or picked at
+// random from a mix of NODE, FIELD and TICK.  Every command is followed by a
+// PING and its latency is the time until the PONG comes back, so each
+// connection has one command in flight at a time.
+//
+// With a target rate, commands are scheduled at even intervals and latency is
+// measured from when a command should have been sent.  A server that falls
+// behind then shows up in the percentiles instead of just slowing the rate.
+//
+//     redpile-load -p <port> [options] [trace]
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define MAX_KINDS 32
+#define MAX_NAME 16
+#define BUFFER_SIZE (64 * 1024)
+
+typedef enum {
+    MIX_GET,
+    MIX_SET,
+    MIX_FIELD,
+    MIX_TICK,
+    MIX_COUNT
+} MixKind;
+
+static const char* mix_names[MIX_COUNT] = {"get", "set", "field", "tick"};
+
+// Latencies in nanoseconds for one kind of command
+typedef struct {
+    char name[MAX_NAME];
+    long long* latencies;
+    unsigned int count;
+    unsigned int capacity;
+} Samples;
+
+typedef struct {
+    unsigned int id;
+    pthread_t thread;
+    int fd;
+    Samples kinds[MAX_KINDS];
+    unsigned int kind_count;
+    char* buffer;
+    size_t buffered;
+
+    // rand() takes a lock shared by every thread, which would end up in
+    // the latencies, so each connection has its own seed
+    unsigned int seed;
+} Connection;
+
+static struct {
+    const char* host;
+    unsigned short port;
+    unsigned int connections;
+    double rate;
+    double duration;
+    unsigned long long count;
+    unsigned int mix[MIX_COUNT];
+    unsigned int mix_total;
+    int area;
+    const char* type;
+    const char* field;
+    bool json;
+    char** trace;
+    unsigned int trace_count;
+} options = {"127.0.0.1", 0, 4, 0, 0, 0, {40, 20, 30, 10}, 100, 64, "WIRE", "power", false, NULL, 0};
+
+static unsigned long long sent = 0;
+static long long start_time;
+static long long end_time;
+
+static void fail(const char* message)
+{
+    fprintf(stderr, "%s: %s\n", message, strerror(errno));
+    exit(EXIT_FAILURE);
+}
+
+static long long get_time(void)
+{
+    struct timespec value;
+    clock_gettime(CLOCK_MONOTONIC, &value);
+    return ((long long)value.tv_sec) * 1000 * 1000 * 1000 + value.tv_nsec;
+}
+
+static void sleep_until(long long time)
+{
+    struct timespec value = {time / (1000 * 1000 * 1000), time % (1000 * 1000 * 1000)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &value, NULL) == EINTR);
+}
+
+static int connect_server(void)
+{
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(options.port);
+    if (inet_pton(AF_INET, options.host, &address.sin_addr) != 1)
+    {
+        fprintf(stderr, "Invalid address '%s'\n", options.host);
+        exit(EXIT_FAILURE);
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr*)&address, sizeof(address)) == -1)
+        fail("Error connecting");
+
+    int flag = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    return fd;
+}
+
+static void send_all(int fd, const char* buffer, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = write(fd, buffer, size);
+        if (written == -1)
+            fail("Error writing to socket");
+        buffer += written;
+        size -= written;
+    }
+}
+
+// Reads until the PONG that ends a reply.
+// Anything after it is kept for the next reply.
+static void read_reply(Connection* connection)
+{
+    while (1)
+    {
+        char* line = connection->buffer;
+        char* end;
+        while ((end = memchr(line, '\n', connection->buffered - (line - connection->buffer))) != NULL)
+        {
+            *end = '\0';
+            bool pong = strcmp(line, "PONG") == 0;
+            line = end + 1;
+
+            if (pong)
+            {
+                connection->buffered -= line - connection->buffer;
+                memmove(connection->buffer, line, connection->buffered);
+                return;
+            }
+        }
+
+        // Only the unfinished line needs to be kept
+        connection->buffered -= line - connection->buffer;
+        memmove(connection->buffer, line, connection->buffered);
+        if (connection->buffered == BUFFER_SIZE)
+            connection->buffered = 0;
+
+        ssize_t received = read(connection->fd, connection->buffer + connection->buffered,
+                                BUFFER_SIZE - connection->buffered);
+        if (received == 0)
+        {
+            fprintf(stderr, "The server closed the connection\n");
+            exit(EXIT_FAILURE);
+        }
+        if (received == -1)
+            fail("Error reading from socket");
+        connection->buffered += received;
+    }
+}
+
+// Replayed commands are grouped by their first word
+static void command_name(const char* command, char* name)
+{
+    unsigned int length = 0;
+    while (command[length] != '\0' && !isspace(command[length]) && length < MAX_NAME - 1)
+    {
+        name[length] = toupper(command[length]);
+        length++;
+    }
+    name[length] = '\0';
+}
+
+static Samples* samples_find(Connection* connection, const char* name)
+{
+    for (unsigned int i = 0; i < connection->kind_count; i++)
+    {
+        if (strcmp(connection->kinds[i].name, name) == 0)
+            return &connection->kinds[i];
+    }
+
+    // Everything past the limit is lumped together
+    if (connection->kind_count == MAX_KINDS)
+        return &connection->kinds[MAX_KINDS - 1];
+
+    Samples* samples = &connection->kinds[connection->kind_count++];
+    strcpy(samples->name, name);
+    return samples;
+}
+
+static void samples_add(Samples* samples, long long latency)
+{
+    if (samples->count == samples->capacity)
+    {
+        samples->capacity = samples->capacity > 0 ? samples->capacity * 2 : 1024;
+        samples->latencies = realloc(samples->latencies, sizeof(long long) * samples->capacity);
+        if (samples->latencies == NULL)
+            fail("Out of memory");
+    }
+    samples->latencies[samples->count++] = latency;
+}
+
+// Generated commands are grouped by the kind picked from the mix, since
+// reads and writes both start with NODE
+static MixKind command_generate(Connection* connection, char* buffer, size_t size)
+{
+    unsigned int pick = rand_r(&connection->seed) % options.mix_total;
+    MixKind kind = 0;
+    while (pick >= options.mix[kind])
+        pick -= options.mix[kind++];
+
+    int x = rand_r(&connection->seed) % options.area;
+    int z = rand_r(&connection->seed) % options.area;
+    switch (kind)
+    {
+        case MIX_GET:   snprintf(buffer, size, "NODE %d,0,%d\n", x, z); break;
+        case MIX_SET:   snprintf(buffer, size, "NODE %d,0,%d %s\n", x, z, options.type); break;
+        case MIX_FIELD: snprintf(buffer, size, "FIELD %d,0,%d %s\n", x, z, options.field); break;
+        default:        snprintf(buffer, size, "TICKQ\n"); break;
+    }
+    return kind;
+}
+
+static bool command_next(unsigned long long* index)
+{
+    *index = __atomic_fetch_add(&sent, 1, __ATOMIC_RELAXED);
+    return options.count == 0 || *index < options.count;
+}
+
+static void* connection_run(void* args)
+{
+    Connection* connection = args;
+    unsigned int position = connection->id;
+    double interval = options.rate > 0 ? 1e9 * options.connections / options.rate : 0;
+
+    // Spread the connections out over the first interval
+    long long scheduled = start_time + (long long)(interval * connection->id / options.connections);
+
+    unsigned long long index;
+    while (command_next(&index))
+    {
+        if (interval > 0)
+        {
+            sleep_until(scheduled);
+        }
+        else
+        {
+            scheduled = get_time();
+        }
+
+        if (end_time > 0 && scheduled >= end_time)
+            break;
+
+        char generated[256];
+        char name[MAX_NAME];
+        const char* command = generated;
+        if (options.trace != NULL)
+        {
+            command = options.trace[position++ % options.trace_count];
+            command_name(command, name);
+        }
+        else
+        {
+            strcpy(name, mix_names[command_generate(connection, generated, sizeof(generated))]);
+        }
+
+        send_all(connection->fd, command, strlen(command));
+        if (strncasecmp(command, "ping", 4) != 0 || isalnum(command[4]))
+            send_all(connection->fd, "PING\n", 5);
+        read_reply(connection);
+
+        samples_add(samples_find(connection, name), get_time() - scheduled);
+        scheduled += (long long)interval;
+    }
+
+    return NULL;
+}
+
+static void trace_load(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+        fail("Error opening trace");
+
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    unsigned int allocated = 0;
+    while ((length = getline(&line, &capacity, file)) != -1)
+    {
+        char* start = line;
+        while (isspace(*start))
+            start++;
+        if (*start == '\0' || *start == '#')
+            continue;
+
+        if (options.trace_count == allocated)
+        {
+            allocated = allocated > 0 ? allocated * 2 : 64;
+            options.trace = realloc(options.trace, sizeof(char*) * allocated);
+            if (options.trace == NULL)
+                fail("Out of memory");
+        }
+
+        // Every command has to end with a line break for the PING after it
+        options.trace[options.trace_count] = malloc(strlen(start) + 2);
+        if (options.trace[options.trace_count] == NULL)
+            fail("Out of memory");
+        strcpy(options.trace[options.trace_count], start);
+        if (start[strlen(start) - 1] != '\n')
+            strcat(options.trace[options.trace_count], "\n");
+        options.trace_count++;
+    }
+
+    free(line);
+    fclose(file);
+
+    if (options.trace_count == 0)
+    {
+        fprintf(stderr, "The trace '%s' doesn't contain any commands\n", path);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void mix_parse(char* string)
+{
+    for (unsigned int i = 0; i < MIX_COUNT; i++)
+        options.mix[i] = 0;
+    options.mix_total = 0;
+
+    for (char* part = strtok(string, ","); part != NULL; part = strtok(NULL, ","))
+    {
+        char* equals = strchr(part, '=');
+        unsigned int i = 0;
+        if (equals != NULL)
+        {
+            *equals = '\0';
+            while (i < MIX_COUNT && strcasecmp(part, mix_names[i]) != 0)
+                i++;
+        }
+
+        if (equals == NULL || i == MIX_COUNT)
+        {
+            fprintf(stderr, "The mix must look like get=40,set=20,field=30,tick=10\n");
+            exit(EXIT_FAILURE);
+        }
+
+        options.mix[i] = strtoul(equals + 1, NULL, 10);
+        options.mix_total += options.mix[i];
+    }
+
+    if (options.mix_total == 0)
+    {
+        fprintf(stderr, "The mix must include at least one command\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static double parse_number(const char* string, const char* name, double min)
+{
+    char* parse_error = NULL;
+    double value = strtod(string, &parse_error);
+    if (*parse_error || value < min)
+    {
+        fprintf(stderr, "You must provide a %s of at least %g\n", name, min);
+        exit(EXIT_FAILURE);
+    }
+    return value;
+}
+
+static int compare_latencies(const void* a, const void* b)
+{
+    long long first = *(const long long*)a;
+    long long second = *(const long long*)b;
+    return (first > second) - (first < second);
+}
+
+// Nearest rank percentile of sorted latencies, in microseconds
+static double percentile(Samples* samples, double percent)
+{
+    unsigned long long rank = (unsigned long long)(samples->count * percent / 100 + 0.999999);
+    return samples->latencies[rank > 0 ? rank - 1 : 0] / 1000.0;
+}
+
+// Combines the samples of every connection by command
+static unsigned int samples_merge(Connection* connections, Samples* merged)
+{
+    unsigned int count = 0;
+    for (unsigned int i = 0; i < options.connections; i++)
+    {
+        for (unsigned int j = 0; j < connections[i].kind_count; j++)
+        {
+            Samples* source = &connections[i].kinds[j];
+            unsigned int k = 0;
+            while (k < count && strcmp(merged[k].name, source->name) != 0)
+                k++;
+            if (k == count)
+            {
+                if (count == MAX_KINDS)
+                    continue;
+                merged[count++] = (Samples){{0}, NULL, 0, 0};
+                strcpy(merged[k].name, source->name);
+            }
+
+            for (unsigned int l = 0; l < source->count; l++)
+                samples_add(&merged[k], source->latencies[l]);
+            free(source->latencies);
+        }
+    }
+
+    for (unsigned int i = 0; i < count; i++)
+        qsort(merged[i].latencies, merged[i].count, sizeof(long long), compare_latencies);
+
+    return count;
+}
+
+static void print_results(Samples* merged, unsigned int count, double elapsed)
+{
+    unsigned long long total = 0;
+    for (unsigned int i = 0; i < count; i++)
+        total += merged[i].count;
+
+    if (options.json)
+    {
+        printf("{\n  \"connections\": %u,\n  \"seconds\": %.3f,\n  \"commands\": %llu,\n"
+               "  \"throughput\": %.1f,\n  \"unit\": \"us\",\n  \"commands_by_type\": [",
+               options.connections, elapsed, total, total / elapsed);
+        for (unsigned int i = 0; i < count; i++)
+        {
+            Samples* samples = &merged[i];
+            printf("%s\n    {\"name\": \"%s\", \"count\": %u, \"throughput\": %.1f, "
+                   "\"p50\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f}",
+                   i > 0 ? "," : "", samples->name, samples->count, samples->count / elapsed,
+                   percentile(samples, 50), percentile(samples, 99), percentile(samples, 99.9),
+                   samples->latencies[samples->count - 1] / 1000.0);
+        }
+        printf("\n  ]\n}\n");
+        return;
+    }
+
+    printf("%llu commands over %u connections in %.2fs, %.1f commands/sec\n",
+           total, options.connections, elapsed, total / elapsed);
+    printf("%-16s %10s %12s %10s %10s %10s %10s\n", "command", "count", "per sec", "p50 us", "p99 us", "p999 us", "max us");
+    for (unsigned int i = 0; i < count; i++)
+    {
+        Samples* samples = &merged[i];
+        printf("%-16s %10u %12.1f %10.1f %10.1f %10.1f %10.1f\n",
+               samples->name, samples->count, samples->count / elapsed,
+               percentile(samples, 50), percentile(samples, 99), percentile(samples, 99.9),
+               samples->latencies[samples->count - 1] / 1000.0);
+    }
+}
+
+static void print_help(void)
+{
+    printf("Usage: redpile-load -p <port> [options] [trace]\n"
+           "Options:\n"
+           "    -h <host>, --host <host>\n"
+           "        The IPv4 address of the server (default 127.0.0.1)\n\n"
+           "    -p <port>, --port <port>\n"
+           "        The port the server is listening on\n\n"
+           "    -c <count>, --connections <count>\n"
+           "        The number of connections to open (default 4)\n\n"
+           "    -r <commands>, --rate <commands>\n"
+           "        Commands per second to send across all connections (default as fast as possible)\n\n"
+           "    -d <seconds>, --duration <seconds>\n"
+           "        How long to run for (default 10 unless --count is given)\n\n"
+           "    -n <commands>, --count <commands>\n"
+           "        Stop after sending this many commands\n\n"
+           "    -m <mix>, --mix <mix>\n"
+           "        Weights for random commands (default get=40,set=20,field=30,tick=10)\n\n"
+           "    -a <size>, --area <size>\n"
+           "        Random commands use locations in a square this wide (default 64)\n\n"
+           "    --type <name>, --field <name>\n"
+           "        The type set and field read by random commands (default WIRE and power)\n\n"
+           "    --json\n"
+           "        Print the results as JSON\n\n"
+           "Commands are replayed from the trace, one per line, if one is given.\n");
+}
+
+int main(int argc, char* argv[])
+{
+    static struct option long_options[] =
+    {
+        {"host",        required_argument, NULL, 'h'},
+        {"port",        required_argument, NULL, 'p'},
+        {"connections", required_argument, NULL, 'c'},
+        {"rate",        required_argument, NULL, 'r'},
+        {"duration",    required_argument, NULL, 'd'},
+        {"count",       required_argument, NULL, 'n'},
+        {"mix",         required_argument, NULL, 'm'},
+        {"area",        required_argument, NULL, 'a'},
+        {"type",        required_argument, NULL, 't'},
+        {"field",       required_argument, NULL, 'f'},
+        {"json",        no_argument,       NULL, 'j'},
+        {"help",        no_argument,       NULL, 'H'},
+        {NULL,          0,                 NULL,  0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h:p:c:r:d:n:m:a:", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+            case 'h': options.host = optarg; break;
+            case 'p': options.port = parse_number(optarg, "port", 1); break;
+            case 'c': options.connections = parse_number(optarg, "number of connections", 1); break;
+            case 'r': options.rate = parse_number(optarg, "rate", 0); break;
+            case 'd': options.duration = parse_number(optarg, "duration", 0); break;
+            case 'n': options.count = parse_number(optarg, "count", 1); break;
+            case 'm': mix_parse(optarg); break;
+            case 'a': options.area = parse_number(optarg, "area", 1); break;
+            case 't': options.type = optarg; break;
+            case 'f': options.field = optarg; break;
+            case 'j': options.json = true; break;
+            case 'H': print_help(); return EXIT_SUCCESS;
+            default: return EXIT_FAILURE;
+        }
+    }
+
+    if (options.port == 0)
+    {
+        fprintf(stderr, "You must provide the port of the server with --port\n");
+        return EXIT_FAILURE;
+    }
+
+    if (optind < argc)
+        trace_load(argv[optind]);
+
+    if (options.duration == 0 && options.count == 0)
+        options.duration = 10;
+
+    unsigned int seed = time(NULL);
+    Connection* connections = calloc(options.connections, sizeof(Connection));
+    if (connections == NULL)
+        fail("Out of memory");
+
+    for (unsigned int i = 0; i < options.connections; i++)
+    {
+        connections[i].id = i;
+        connections[i].seed = seed + i;
+        connections[i].fd = connect_server();
+        connections[i].buffer = malloc(BUFFER_SIZE);
+        if (connections[i].buffer == NULL)
+            fail("Out of memory");
+    }
+
+    start_time = get_time();
+    end_time = options.duration > 0 ? start_time + (long long)(options.duration * 1e9) : 0;
+
+    for (unsigned int i = 0; i < options.connections; i++)
+    {
+        errno = pthread_create(&connections[i].thread, NULL, connection_run, &connections[i]);
+        if (errno != 0)
+            fail("Error starting connection");
+    }
+
+    for (unsigned int i = 0; i < options.connections; i++)
+        pthread_join(connections[i].thread, NULL);
+    double elapsed = (get_time() - start_time) / 1e9;
+
+    Samples merged[MAX_KINDS];
+    unsigned int count = samples_merge(connections, merged);
+    print_results(merged, count, elapsed);
+
+    for (unsigned int i = 0; i < count; i++)
+        free(merged[i].latencies);
+    for (unsigned int i = 0; i < options.connections; i++)
+    {
+        close(connections[i].fd);
+        free(connections[i].buffer);
+    }
+    free(connections);
+    for (unsigned int i = 0; i < options.trace_count; i++)
+        free(options.trace[i]);
+    free(options.trace);
+
+    return EXIT_SUCCESS;
+}
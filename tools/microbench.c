@@ -0,0 +1,670 @@
+/* microbench.c - Benchmarks for the core data structures on their own
+ *
+ * Copyright (C) 2014 Ryan Mendivil <ryan@nullreff.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redpile nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Times the hashmap, chunk octree, message queue and message store without a
+// world or Lua state so storage changes can be compared in isolation.  Each
+// benchmark runs its own setup, times only the operations being measured and
+// reports the median time per operation along with how much heap the
+// structure was holding once it was built.
+
+#include "hashmap.h"
+#include "node.h"
+#include "queue.h"
+#include "message.h"
+#include <getopt.h>
+#include <malloc.h>
+#include <math.h>
+#include <time.h>
+
+#define DEFAULT_TIME 200
+#define DEFAULT_COUNT 65536
+#define MIN_TRIALS 5
+#define RANDOM_RANGE (1 << 20)
+#define QUEUE_FANOUT 4
+#define STORE_NODES 1024
+#define CHUNK_NODES (CHUNK_WIDTH * CHUNK_WIDTH * CHUNK_WIDTH)
+
+typedef enum {
+    ORDER_SEQUENTIAL,
+    ORDER_MORTON,
+    ORDER_RANDOM
+} KeyOrder;
+
+static const char* order_names[] = {"sequential", "morton", "random"};
+
+// Filled in by each trial
+typedef struct {
+    long long time;
+    unsigned int operations;
+    size_t memory;
+    char detail[64];
+} Trial;
+
+typedef struct {
+    const char* name;
+    bool chunk;
+    KeyOrder order;
+    void (*run)(Location* keys, unsigned int count, Trial* trial);
+} Microbench;
+
+// The modules linked in here print through the repl, which isn't needed
+void repl_print(const char* format, ...)
+{
+    (void)format;
+}
+
+void redpile_cleanup(void)
+{
+}
+
+static long long get_time(void)
+{
+    struct timespec value;
+    clock_gettime(CLOCK_MONOTONIC, &value);
+    return ((long long)value.tv_sec) * 1000 * 1000 * 1000 + value.tv_nsec;
+}
+
+static size_t heap_used(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+static unsigned int morton_compact(unsigned int value)
+{
+    unsigned int result = 0;
+    for (unsigned int bit = 0; bit < 10; bit++)
+        result |= ((value >> (bit * 3)) & 1) << bit;
+    return result;
+}
+
+static Location key_create(KeyOrder order, unsigned int index, unsigned int width)
+{
+    switch (order)
+    {
+        case ORDER_SEQUENTIAL:
+            return location_create(index % width, (index / width) % width, index / (width * width));
+        case ORDER_MORTON:
+            return location_create(morton_compact(index), morton_compact(index >> 1), morton_compact(index >> 2));
+        default:
+            return location_create(rand() % RANDOM_RANGE, rand() % RANDOM_RANGE, rand() % RANDOM_RANGE);
+    }
+}
+
+// Keys either fill a cube in raster order, fill it along a Z-order curve or
+// are scattered at random.  Keys for the octree fill a single chunk and are
+// converted with node_chunk_offset, random ones being a shuffle of the chunk.
+static Location* keys_allocate(KeyOrder order, unsigned int count, bool chunk)
+{
+    Location* keys = malloc(sizeof(Location) * count);
+    CHECK_OOM(keys);
+
+    unsigned int width = chunk ? CHUNK_WIDTH : (unsigned int)ceil(cbrt(count));
+    for (unsigned int i = 0; i < count; i++)
+    {
+        if (chunk)
+            keys[i] = node_chunk_offset(key_create(order == ORDER_RANDOM ? ORDER_SEQUENTIAL : order, i, width));
+        else
+            keys[i] = key_create(order, i, width);
+    }
+
+    if (chunk && order == ORDER_RANDOM)
+    {
+        for (unsigned int i = count - 1; i > 0; i--)
+        {
+            unsigned int j = rand() % (i + 1);
+            Location temp = keys[i];
+            keys[i] = keys[j];
+            keys[j] = temp;
+        }
+    }
+
+    return keys;
+}
+
+static void hashmap_fill(Hashmap* hashmap, Location* keys, unsigned int count)
+{
+    hashmap_init(hashmap, 1);
+    for (unsigned int i = 0; i < count; i++)
+        hashmap_get(hashmap, keys[i], true)->value = keys + i;
+}
+
+static void hashmap_detail(Hashmap* hashmap, Trial* trial)
+{
+    snprintf(trial->detail, sizeof(trial->detail), "size %u overflow %u depth %u resizes %u",
+             hashmap->size, hashmap->overflow, hashmap->max_depth, hashmap->resizes);
+}
+
+static void run_hashmap_insert(Location* keys, unsigned int count, Trial* trial)
+{
+    Hashmap hashmap;
+    size_t before = heap_used();
+
+    long long start = get_time();
+    hashmap_fill(&hashmap, keys, count);
+    trial->time = get_time() - start;
+
+    trial->operations = count;
+    trial->memory = heap_used() - before;
+    hashmap_detail(&hashmap, trial);
+    hashmap_free(&hashmap, NULL);
+}
+
+static void run_hashmap_get(Location* keys, unsigned int count, Trial* trial)
+{
+    Hashmap hashmap;
+    size_t before = heap_used();
+    hashmap_fill(&hashmap, keys, count);
+    trial->memory = heap_used() - before;
+
+    unsigned int found = 0;
+    long long start = get_time();
+    for (unsigned int i = 0; i < count; i++)
+        found += hashmap_get(&hashmap, keys[i], false) != NULL;
+    trial->time = get_time() - start;
+
+    assert(found == count);
+    trial->operations = count;
+    hashmap_detail(&hashmap, trial);
+    hashmap_free(&hashmap, NULL);
+}
+
+static void run_hashmap_miss(Location* keys, unsigned int count, Trial* trial)
+{
+    Hashmap hashmap;
+    size_t before = heap_used();
+    hashmap_fill(&hashmap, keys, count);
+    trial->memory = heap_used() - before;
+
+    unsigned int found = 0;
+    long long start = get_time();
+    for (unsigned int i = 0; i < count; i++)
+        found += hashmap_get(&hashmap, location_create(keys[i].x, -keys[i].y - 1, keys[i].z), false) != NULL;
+    trial->time = get_time() - start;
+
+    assert(found == 0);
+    trial->operations = count;
+    hashmap_detail(&hashmap, trial);
+    hashmap_free(&hashmap, NULL);
+}
+
+static void run_hashmap_remove(Location* keys, unsigned int count, Trial* trial)
+{
+    Hashmap hashmap;
+    size_t before = heap_used();
+    hashmap_fill(&hashmap, keys, count);
+    trial->memory = heap_used() - before;
+
+    long long start = get_time();
+    for (unsigned int i = 0; i < count; i++)
+        hashmap_remove(&hashmap, keys[i]);
+    trial->time = get_time() - start;
+
+    trial->operations = count;
+    hashmap_detail(&hashmap, trial);
+    hashmap_free(&hashmap, NULL);
+}
+
+// Fills and drains the map a few times, resizing all the way up and down
+static void run_hashmap_storm(Location* keys, unsigned int count, Trial* trial)
+{
+    Hashmap hashmap;
+    hashmap_init(&hashmap, 1);
+    size_t before = heap_used();
+
+    long long start = get_time();
+    for (unsigned int round = 0; round < 4; round++)
+    {
+        for (unsigned int i = 0; i < count; i++)
+            hashmap_get(&hashmap, keys[i], true)->value = keys + i;
+        if (round == 0)
+            trial->memory = heap_used() - before;
+        for (unsigned int i = 0; i < count; i++)
+            hashmap_remove(&hashmap, keys[i]);
+    }
+    trial->time = get_time() - start;
+
+    trial->operations = count * 8;
+    hashmap_detail(&hashmap, trial);
+    hashmap_free(&hashmap, NULL);
+}
+
+static NodeTree* octree_fill(Location* keys, unsigned int count)
+{
+    NodeTree* tree = node_tree_allocate(NULL, CHUNK_DEPTH, NULL);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        Node node;
+        node_tree_get(tree, keys[i], &node, true);
+    }
+    return tree;
+}
+
+static void run_octree_insert(Location* keys, unsigned int count, Trial* trial)
+{
+    size_t before = heap_used();
+
+    long long start = get_time();
+    NodeTree* tree = octree_fill(keys, count);
+    trial->time = get_time() - start;
+
+    trial->operations = count;
+    trial->memory = heap_used() - before;
+    node_tree_free(tree);
+}
+
+static void run_octree_get(Location* keys, unsigned int count, Trial* trial)
+{
+    size_t before = heap_used();
+    NodeTree* tree = octree_fill(keys, count);
+    trial->memory = heap_used() - before;
+
+    unsigned int found = 0;
+    long long start = get_time();
+    for (unsigned int i = 0; i < count; i++)
+    {
+        Node node;
+        node_tree_get(tree, keys[i], &node, false);
+        found += !NODE_IS_EMPTY(&node);
+    }
+    trial->time = get_time() - start;
+
+    assert(found == count);
+    trial->operations = count;
+    node_tree_free(tree);
+}
+
+static void run_octree_remove(Location* keys, unsigned int count, Trial* trial)
+{
+    size_t before = heap_used();
+    NodeTree* tree = octree_fill(keys, count);
+    trial->memory = heap_used() - before;
+
+    NodeData** removed = malloc(sizeof(NodeData*) * count);
+    CHECK_OOM(removed);
+
+    long long start = get_time();
+    for (unsigned int i = 0; i < count; i++)
+    {
+        Node node;
+        node_tree_remove(tree, keys[i], &node);
+        removed[i] = node.data;
+    }
+    trial->time = get_time() - start;
+
+    for (unsigned int i = 0; i < count; i++)
+        node_data_free(removed[i]);
+    free(removed);
+
+    trial->operations = count;
+    node_tree_free(tree);
+}
+
+static void octree_count(Node* node, void* args)
+{
+    (void)node;
+    (*(unsigned int*)args)++;
+}
+
+static void run_octree_each(Location* keys, unsigned int count, Trial* trial)
+{
+    size_t before = heap_used();
+    NodeTree* tree = octree_fill(keys, count);
+    trial->memory = heap_used() - before;
+
+    unsigned int found = 0;
+    long long start = get_time();
+    node_tree_each(tree, location_create(0, 0, 0), octree_count, &found);
+    trial->time = get_time() - start;
+
+    assert(found == count);
+    trial->operations = count;
+    node_tree_free(tree);
+}
+
+// Every node sends a message to each of the next few nodes, the same as a
+// tick where nodes power their neighbors
+static void queue_fill(Queue* queue, Location* keys, unsigned int count)
+{
+    queue_init(queue, true, true, 1024);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        Node source = {keys[i / QUEUE_FANOUT], NULL};
+        Node target = {keys[(i / QUEUE_FANOUT + 1 + i % QUEUE_FANOUT) % count], NULL};
+        queue_add_message(queue, 1, i % 3, &source, &target, (FieldValue){.integer = i});
+    }
+}
+
+static void queue_detail(Queue* queue, Trial* trial)
+{
+    snprintf(trial->detail, sizeof(trial->detail), "targets %u sources %u",
+             queue->targetmap.count, queue->sourcemap.count);
+}
+
+static void run_queue_push(Location* keys, unsigned int count, Trial* trial)
+{
+    Queue queue;
+    size_t before = heap_used();
+
+    long long start = get_time();
+    queue_fill(&queue, keys, count);
+    trial->time = get_time() - start;
+
+    trial->operations = count;
+    trial->memory = heap_used() - before;
+    queue_detail(&queue, trial);
+    queue_free(&queue);
+}
+
+static void run_queue_find(Location* keys, unsigned int count, Trial* trial)
+{
+    Queue queue;
+    size_t before = heap_used();
+    queue_fill(&queue, keys, count);
+    trial->memory = heap_used() - before;
+
+    unsigned int found = 0;
+    long long start = get_time();
+    FOR_QUEUE(node, &queue)
+        found += queue_find(&queue, node) != NULL;
+    trial->time = get_time() - start;
+
+    assert(found == queue.count);
+    trial->operations = queue.count;
+    queue_detail(&queue, trial);
+    queue_free(&queue);
+}
+
+static void run_queue_find_nodes(Location* keys, unsigned int count, Trial* trial)
+{
+    Queue queue;
+    size_t before = heap_used();
+    queue_fill(&queue, keys, count);
+    trial->memory = heap_used() - before;
+
+    unsigned int found = 0;
+    long long start = get_time();
+    for (unsigned int tick = 0; tick < 3; tick++)
+    {
+        for (unsigned int i = 0; i < count / QUEUE_FANOUT; i++)
+        {
+            Node target = {keys[i], NULL};
+            QueueNode* node;
+            unsigned int size = 0;
+            queue_find_nodes(&queue, &target, tick, &node, &size);
+            found += size > 0;
+        }
+    }
+    trial->time = get_time() - start;
+
+    trial->operations = (count / QUEUE_FANOUT) * 3;
+    snprintf(trial->detail, sizeof(trial->detail), "found %u", found);
+    queue_free(&queue);
+}
+
+static void run_queue_remove(Location* keys, unsigned int count, Trial* trial)
+{
+    Queue queue;
+    size_t before = heap_used();
+    queue_fill(&queue, keys, count);
+    trial->memory = heap_used() - before;
+    queue_detail(&queue, trial);
+
+    long long start = get_time();
+    while (queue.nodes != NULL)
+        queue_remove(&queue, queue.nodes);
+    trial->time = get_time() - start;
+
+    trial->operations = count;
+    queue_free(&queue);
+}
+
+// Stores messages for a few ticks ahead on a set of nodes while ticking
+// forward, so old stores are dropped by message_store_discard_old as new ones
+// are added, the same way node_find_store is used during a tick
+static void run_message_store(Location* keys, unsigned int count, Trial* trial)
+{
+    unsigned int nodes = count < STORE_NODES ? count : STORE_NODES;
+    NodeData* data = calloc(nodes, sizeof(NodeData));
+    CHECK_OOM(data);
+    size_t before = heap_used();
+
+    long long start = get_time();
+    for (unsigned int i = 0; i < count; i++)
+    {
+        unsigned long long tick = i / nodes;
+        Node node = {keys[i % nodes], data + (i % nodes)};
+        MessageStore* store = node_find_store(&node, tick + 1 + i % 3, tick);
+        unsigned int size = store->messages->size;
+        store->messages = messages_resize(store->messages, size + 1);
+        store->messages->data[size] = (Message){{node.location, NULL}, 1, i};
+    }
+    trial->time = get_time() - start;
+
+    unsigned int stores = 0;
+    for (unsigned int i = 0; i < nodes; i++)
+    {
+        for (MessageStore* store = data[i].store; store != NULL; store = store->next)
+            stores++;
+    }
+
+    trial->operations = count;
+    trial->memory = heap_used() - before;
+    snprintf(trial->detail, sizeof(trial->detail), "stores %u", stores);
+
+    for (unsigned int i = 0; i < nodes; i++)
+        message_store_free(data[i].store);
+    free(data);
+}
+
+static Microbench benchmarks[] = {
+    {"hashmap/insert",     false, ORDER_SEQUENTIAL, run_hashmap_insert},
+    {"hashmap/insert",     false, ORDER_MORTON,     run_hashmap_insert},
+    {"hashmap/insert",     false, ORDER_RANDOM,     run_hashmap_insert},
+    {"hashmap/get",        false, ORDER_SEQUENTIAL, run_hashmap_get},
+    {"hashmap/get",        false, ORDER_MORTON,     run_hashmap_get},
+    {"hashmap/get",        false, ORDER_RANDOM,     run_hashmap_get},
+    {"hashmap/miss",       false, ORDER_RANDOM,     run_hashmap_miss},
+    {"hashmap/remove",     false, ORDER_SEQUENTIAL, run_hashmap_remove},
+    {"hashmap/remove",     false, ORDER_RANDOM,     run_hashmap_remove},
+    {"hashmap/storm",      false, ORDER_SEQUENTIAL, run_hashmap_storm},
+    {"hashmap/storm",      false, ORDER_RANDOM,     run_hashmap_storm},
+    {"octree/insert",      true,  ORDER_SEQUENTIAL, run_octree_insert},
+    {"octree/insert",      true,  ORDER_MORTON,     run_octree_insert},
+    {"octree/insert",      true,  ORDER_RANDOM,     run_octree_insert},
+    {"octree/get",         true,  ORDER_SEQUENTIAL, run_octree_get},
+    {"octree/get",         true,  ORDER_MORTON,     run_octree_get},
+    {"octree/get",         true,  ORDER_RANDOM,     run_octree_get},
+    {"octree/remove",      true,  ORDER_SEQUENTIAL, run_octree_remove},
+    {"octree/remove",      true,  ORDER_RANDOM,     run_octree_remove},
+    {"octree/each",        true,  ORDER_SEQUENTIAL, run_octree_each},
+    {"queue/push",         false, ORDER_SEQUENTIAL, run_queue_push},
+    {"queue/push",         false, ORDER_RANDOM,     run_queue_push},
+    {"queue/find",         false, ORDER_RANDOM,     run_queue_find},
+    {"queue/find_nodes",   false, ORDER_RANDOM,     run_queue_find_nodes},
+    {"queue/remove",       false, ORDER_RANDOM,     run_queue_remove},
+    {"message/store",      false, ORDER_SEQUENTIAL, run_message_store},
+};
+
+static int compare_times(const void* a, const void* b)
+{
+    double first = *(const double*)a;
+    double second = *(const double*)b;
+    return (first > second) - (first < second);
+}
+
+static char* format_memory(char* buffer, size_t memory)
+{
+    if (memory < 1024)
+        sprintf(buffer, "%zuB", memory);
+    else if (memory < 1024 * 1024)
+        sprintf(buffer, "%.1fKB", memory / 1024.0);
+    else
+        sprintf(buffer, "%.1fMB", memory / (1024.0 * 1024.0));
+    return buffer;
+}
+
+static void print_help(void)
+{
+    printf("Usage: redpile-microbench [options] [filter]\n"
+           "Options:\n"
+           "    -t <milliseconds>, --time <milliseconds>\n"
+           "        Run each benchmark for the time specified (default %d)\n\n"
+           "    -n <count>, --count <count>\n"
+           "        The number of keys to use, octree benchmarks always fill one chunk (default %d)\n\n"
+           "    --json\n"
+           "        Print the results as JSON\n\n"
+           "Only benchmarks with names starting with the filter are run.\n",
+           DEFAULT_TIME, DEFAULT_COUNT);
+}
+
+static unsigned int parse_positive(const char* string, const char* name)
+{
+    char* parse_error = NULL;
+    long value = strtol(string, &parse_error, 10);
+    if (*parse_error || value <= 0)
+    {
+        fprintf(stderr, "You must provide a %s greater than zero\n", name);
+        exit(EXIT_FAILURE);
+    }
+    return (unsigned int)value;
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned int time = DEFAULT_TIME;
+    unsigned int count = DEFAULT_COUNT;
+    bool json = false;
+
+    static struct option long_options[] =
+    {
+        {"time",  required_argument, NULL, 't'},
+        {"count", required_argument, NULL, 'n'},
+        {"json",  no_argument,       NULL, 'j'},
+        {"help",  no_argument,       NULL, 'h'},
+        {NULL,    0,                 NULL,  0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:n:h", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+            case 't': time = parse_positive(optarg, "time"); break;
+            case 'n': count = parse_positive(optarg, "count"); break;
+            case 'j': json = true; break;
+            case 'h': print_help(); return EXIT_SUCCESS;
+            default: return EXIT_FAILURE;
+        }
+    }
+    const char* filter = optind < argc ? argv[optind] : "";
+
+    srand(get_time());
+    long long budget = (long long)time * 1000 * 1000;
+
+    if (json)
+        printf("{\n  \"unit\": \"ns\",\n  \"count\": %u,\n  \"benchmarks\": [", count);
+    else
+        printf("%-36s %10s %10s %10s  %s\n", "name", "ns/op", "stddev", "memory", "detail");
+
+    bool first = true;
+    for (unsigned int i = 0; i < sizeof(benchmarks) / sizeof(Microbench); i++)
+    {
+        Microbench* bench = &benchmarks[i];
+        char name[64];
+        snprintf(name, sizeof(name), "%s/%s", bench->name, order_names[bench->order]);
+        if (strncmp(name, filter, strlen(filter)) != 0)
+            continue;
+
+        unsigned int keys_count = bench->chunk ? CHUNK_NODES : count;
+        Location* keys = keys_allocate(bench->order, keys_count, bench->chunk);
+
+        // One untimed trial to warm up the allocator
+        Trial trial = {0, 0, 0, ""};
+        bench->run(keys, keys_count, &trial);
+
+        unsigned int trials = 0;
+        unsigned int capacity = 16;
+        double* times = malloc(sizeof(double) * capacity);
+        CHECK_OOM(times);
+
+        long long total = 0;
+        while (trials < MIN_TRIALS || total < budget)
+        {
+            if (trials == capacity)
+            {
+                capacity *= 2;
+                times = realloc(times, sizeof(double) * capacity);
+                CHECK_OOM(times);
+            }
+            bench->run(keys, keys_count, &trial);
+            times[trials++] = (double)trial.time / trial.operations;
+            total += trial.time;
+        }
+
+        qsort(times, trials, sizeof(double), compare_times);
+        double mean = 0;
+        for (unsigned int j = 0; j < trials; j++)
+            mean += times[j] / trials;
+        double variance = 0;
+        for (unsigned int j = 0; j < trials; j++)
+            variance += (times[j] - mean) * (times[j] - mean) / (trials - 1);
+        double median = trials % 2 == 0
+            ? (times[trials / 2 - 1] + times[trials / 2]) / 2
+            : times[trials / 2];
+
+        if (json)
+        {
+            printf("%s\n    {\"name\": \"%s\", \"trials\": %u, \"operations\": %u, \"median\": %.2f, "
+                   "\"stddev\": %.2f, \"min\": %.2f, \"max\": %.2f, \"memory\": %zu}",
+                   first ? "" : ",", name, trials, trial.operations, median,
+                   sqrt(variance), times[0], times[trials - 1], trial.memory);
+        }
+        else
+        {
+            char memory[32];
+            printf("%-36s %10.2f %10.2f %10s  %s\n", name, median, sqrt(variance),
+                   format_memory(memory, trial.memory), trial.detail);
+            fflush(stdout);
+        }
+        first = false;
+
+        free(times);
+        free(keys);
+    }
+
+    if (json)
+        printf("\n  ]\n}\n");
+
+    return EXIT_SUCCESS;
+}
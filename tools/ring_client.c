@@ -0,0 +1,236 @@
+/* ring_client.c - Reference client for shared memory rings
+ *
+ * Copyright (C) 2014 Ryan Mendivil <ryan@nullreff.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redpile nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Sends each line from stdin to a server started with --socket and prints
+// the reply, which is read from a shared memory ring rather than the socket.
+// Every command is followed by a PING so the end of its reply is the PONG.
+//
+//     redpile-ring-client [-s <ring size>] <socket>
+
+#define _GNU_SOURCE
+
+#include "ring.h"
+#include <ctype.h>
+#include <errno.h>
+#include <endian.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <linux/futex.h>
+
+static RingHeader* header;
+static char* data;
+static uint64_t tail = 0;
+
+static void fail(const char* message)
+{
+    fprintf(stderr, "%s: %s\n", message, strerror(errno));
+    exit(EXIT_FAILURE);
+}
+
+static int connect_socket(const char* path)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr*)&address, sizeof(address)) == -1)
+        fail("Error connecting");
+
+    return fd;
+}
+
+static void send_all(int fd, const char* buffer, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = write(fd, buffer, size);
+        if (written == -1)
+            fail("Error writing to socket");
+        buffer += written;
+        size -= written;
+    }
+}
+
+// Asks for a ring and maps the memfd that comes back with the reply
+static void open_ring(int fd, uint32_t size)
+{
+    char request[RING_REQUEST_SIZE];
+    memcpy(request, RING_MAGIC, RING_MAGIC_SIZE);
+    request[RING_MAGIC_SIZE] = RING_VERSION;
+    request[RING_MAGIC_SIZE + 1] = 0;
+    uint32_t encoded = htole32(size);
+    memcpy(request + RING_MAGIC_SIZE + 2, &encoded, sizeof(encoded));
+    send_all(fd, request, sizeof(request));
+
+    char reply[RING_MAGIC_SIZE + 1];
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec vector = {reply, sizeof(reply)};
+    struct msghdr message = {
+        .msg_iov = &vector,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control)
+    };
+
+    ssize_t received = recvmsg(fd, &message, MSG_WAITALL);
+    if (received != sizeof(reply) || memcmp(reply, RING_MAGIC, RING_MAGIC_SIZE) != 0)
+        fail("The server didn't accept the ring");
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+    if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS)
+        fail("The server didn't send the ring");
+
+    int ring_fd;
+    memcpy(&ring_fd, CMSG_DATA(cmsg), sizeof(int));
+
+    void* memory = mmap(NULL, RING_HEADER_SIZE + (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd, 0);
+    if (memory == MAP_FAILED)
+        fail("Error mapping ring");
+    close(ring_fd);
+
+    header = memory;
+    data = (char*)memory + RING_HEADER_SIZE;
+}
+
+// Waits for the server to write something and returns how much is there
+static size_t ring_wait(void)
+{
+    while (1)
+    {
+        uint32_t sequence = __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+        uint64_t head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+        if (head != tail)
+            return head - tail;
+
+        if (__atomic_load_n(&header->closed, __ATOMIC_ACQUIRE))
+        {
+            fprintf(stderr, "The server closed the connection\n");
+            exit(EXIT_FAILURE);
+        }
+
+        struct timespec timeout = {1, 0};
+        syscall(SYS_futex, &header->sequence, FUTEX_WAIT, sequence, &timeout, NULL, 0);
+    }
+}
+
+// Prints the reply up to the PONG that follows it
+static void read_reply(void)
+{
+    char* line = NULL;
+    size_t line_size = 0;
+    size_t line_capacity = 0;
+
+    while (1)
+    {
+        size_t available = ring_wait();
+        for (size_t i = 0; i < available; i++)
+        {
+            if (line_size == line_capacity)
+            {
+                line_capacity = line_capacity ? line_capacity * 2 : 256;
+                line = realloc(line, line_capacity);
+                if (line == NULL)
+                    fail("Error allocating memory");
+            }
+
+            char c = data[(tail + i) & (header->size - 1)];
+            line[line_size++] = c;
+            if (c != '\n')
+                continue;
+
+            if (line_size == 5 && memcmp(line, "PONG\n", 5) == 0)
+            {
+                tail += i + 1;
+                __atomic_store_n(&header->tail, tail, __ATOMIC_RELEASE);
+                free(line);
+                return;
+            }
+
+            fwrite(line, 1, line_size, stdout);
+            line_size = 0;
+        }
+
+        // Everything read has been copied out so the server can reuse it
+        tail += available;
+        __atomic_store_n(&header->tail, tail, __ATOMIC_RELEASE);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    uint32_t size = 1024 * 1024;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:")) != -1)
+    {
+        if (opt != 's')
+            return EXIT_FAILURE;
+        size = strtoul(optarg, NULL, 10);
+    }
+
+    if (optind >= argc)
+    {
+        fprintf(stderr, "Usage: %s [-s <ring size>] <socket>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (!ring_valid_size(size))
+    {
+        fprintf(stderr, "The ring size must be a power of two between %d and %d\n", RING_MIN_SIZE, RING_MAX_SIZE);
+        return EXIT_FAILURE;
+    }
+
+    int fd = connect_socket(argv[optind]);
+    open_ring(fd, size);
+
+    char* command = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    while ((length = getline(&command, &capacity, stdin)) != -1)
+    {
+        send_all(fd, command, length);
+        if (strncasecmp(command, "ping", 4) != 0 || isalnum(command[4]))
+            send_all(fd, "PING\n", 5);
+
+        read_reply();
+        fflush(stdout);
+    }
+
+    free(command);
+    close(fd);
+    return EXIT_SUCCESS;
+}